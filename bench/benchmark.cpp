@@ -0,0 +1,557 @@
+#include <atomic>
+#include <benchmark/benchmark.h>
+#include <cstdlib>
+#include <minipb/minipb.h>
+#include <minipb/parallel.h>
+#include <new>
+#include <string>
+#include <vector>
+
+#include <google/protobuf/io/coded_stream.h>
+#include <google/protobuf/io/zero_copy_stream_impl_lite.h>
+#include <google/protobuf/util/delimited_message_util.h>
+
+#include <bench.pb.h>
+#include <bench.proto.h>
+#include <flat_bench.proto.h>
+#include <flat_sample.proto.h>
+#include <sample.pb.h>
+#include <sample.proto.h>
+#include <table_bench.proto.h>
+#include <table_sample.proto.h>
+
+// Every heap allocation is counted to report allocations per operation
+static std::atomic<size_t> g_allocations{0};
+
+void* operator new(size_t size) {
+	g_allocations.fetch_add(1, std::memory_order_relaxed);
+	if (auto p = std::malloc(size == 0 ? 1 : size)) return p;
+	throw std::bad_alloc{};
+}
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete(void* p, size_t) noexcept { std::free(p); }
+
+namespace {
+	/**
+	 * \brief Payloads used by all benchmarks.
+	 *
+	 * Each payload fills the minipb message, the libprotobuf message is parsed from its encoding so both contain the same data.
+	 */
+	struct sample_payload {
+		using minipb_type = test::test_all;
+		using pb_type = pb::test::test_all;
+		using table_type = table::test::test_all;
+		using flat_type = flat::test::test_all;
+		static void fill(minipb_type& msg, int depth = 2) {
+			msg.a = 1.5;
+			msg.b = 2.5f;
+			msg.c = -12;
+			msg.d = -1234567890123;
+			msg.e = 300;
+			msg.f = UINT64_MAX;
+			msg.g = -5;
+			msg.h = INT64_MIN;
+			msg.i = 7;
+			msg.j = 8;
+			msg.k = -9;
+			msg.l = -10;
+			msg.m = true;
+			msg.o = std::string(200, 'o');
+			msg.p = "bytes";
+			msg.r_c = {-1, 1, 150};
+			msg.r_o = {"x", std::string(130, 'y')};
+			msg.rp_c = {-1, 1, 150, 70000};
+			msg.rp_f = {0, 127, 128};
+			msg.rp_g = {-1, 1, -150};
+			msg.rp_b = {1.0f, 2.0f, 3.0f};
+			if (depth > 0) {
+				msg.q = std::unique_ptr<minipb_type>(new minipb_type{});
+				fill(*msg.q, depth - 1);
+				for (int i = 0; i < 3; i++) {
+					msg.r_q.emplace_back(new minipb_type{});
+					fill(*msg.r_q.back(), depth - 1);
+				}
+			}
+		}
+	};
+
+	struct scalar_payload {
+		using minipb_type = bench::scalars;
+		using pb_type = pb::bench::scalars;
+		using table_type = table::bench::scalars;
+		using flat_type = flat::bench::scalars;
+		static void fill(minipb_type& msg) {
+			msg.id = 12345;
+			msg.timestamp = 1700000000000;
+			msg.flags = 0x5;
+			msg.sequence = 987654321;
+			msg.offset = -42;
+			msg.delta = -100000;
+			msg.crc = 0xdeadbeef;
+			msg.key = 0x0123456789abcdef;
+			msg.temperature = -20;
+			msg.position = 1234567;
+			msg.ratio = 0.25f;
+			msg.value = 3.14159;
+			msg.valid = true;
+			msg.id2 = 7;
+			msg.timestamp2 = 1700000000123;
+			msg.flags2 = 300;
+			msg.value2 = -2.5;
+			msg.ratio2 = 1.5f;
+		}
+	};
+
+	struct string_payload {
+		using minipb_type = bench::strings;
+		using pb_type = pb::bench::strings;
+		using table_type = table::bench::strings;
+		using flat_type = flat::bench::strings;
+		static void fill(minipb_type& msg) {
+			msg.host = "worker-17.eu-west.example.com";
+			msg.service = "ingest";
+			msg.message = std::string(300, 'm');
+			for (int i = 0; i < 16; i++)
+				msg.tags.push_back("tag-" + std::to_string(i));
+			msg.payload = std::string(4096, 'p');
+			for (int i = 0; i < 4; i++)
+				msg.attachments.push_back(std::string(1024, static_cast<char>('a' + i)));
+		}
+	};
+
+	struct nested_payload {
+		using minipb_type = bench::node;
+		using pb_type = pb::bench::node;
+		using table_type = table::bench::node;
+		using flat_type = flat::bench::node;
+		static void fill(minipb_type& msg, int depth = 64) {
+			msg.value = depth;
+			msg.label = "node";
+			if (depth % 8 == 0) {
+				for (int i = 0; i < 4; i++) {
+					msg.leaves.emplace_back(new minipb_type{});
+					msg.leaves.back()->value = i;
+					msg.leaves.back()->label = "leaf";
+				}
+			}
+			if (depth > 0) {
+				msg.child = std::unique_ptr<minipb_type>(new minipb_type{});
+				fill(*msg.child, depth - 1);
+			}
+		}
+	};
+
+	struct rows_payload {
+		using minipb_type = bench::rows;
+		using pb_type = pb::bench::rows;
+		using table_type = table::bench::rows;
+		using flat_type = flat::bench::rows;
+		static void fill(minipb_type& msg) {
+			for (int i = 0; i < 10000; i++) {
+				msg.items.emplace_back(new bench::row{});
+				msg.items.back()->id = 1000000 + i;
+				msg.items.back()->value = i * 0.5;
+				msg.items.back()->name = "row";
+			}
+		}
+	};
+
+	struct packed_payload {
+		using minipb_type = bench::packed_arrays;
+		using pb_type = pb::bench::packed_arrays;
+		using table_type = table::bench::packed_arrays;
+		using flat_type = flat::bench::packed_arrays;
+		static void fill(minipb_type& msg) {
+			for (int i = 0; i < 16384; i++) {
+				msg.counters.push_back(i % 100);
+				msg.ids.push_back(1000000007ull * i);
+				msg.deltas.push_back(i % 2 == 0 ? i % 64 : -(i % 64));
+				msg.mask.push_back(i % 3 == 0);
+			}
+			for (int i = 0; i < 1536; i++) {
+				msg.embedding.push_back(static_cast<float>(i) / 1536.0f);
+				msg.weights.push_back(i * 0.001);
+			}
+		}
+	};
+
+	// Message and encoding of a payload, created once
+	template <typename TPayload> struct payload_data {
+		typename TPayload::minipb_type msg{};
+		typename TPayload::pb_type pb{};
+		std::string encoded{};
+
+		payload_data() {
+			TPayload::fill(msg);
+			minipb::container_output_stream<std::string> stream{encoded};
+			minipb::basic_msg_builder<minipb::container_output_stream<std::string>> b{stream};
+			if (msg.encode(b) != minipb::result::ok || !pb.ParseFromString(encoded)) std::abort();
+		}
+
+		static const payload_data& get() {
+			static const payload_data data{};
+			return data;
+		}
+	};
+
+	// Reports bytes per second and heap allocations per operation
+	class op_counter {
+		benchmark::State& m_state;
+		size_t m_size;
+		size_t m_allocations;
+
+	public:
+		op_counter(benchmark::State& state, size_t size) : m_state{state}, m_size{size}, m_allocations{g_allocations.load()} {}
+		~op_counter() {
+			m_state.SetBytesProcessed(static_cast<int64_t>(m_state.iterations() * m_size));
+			m_state.counters["allocs"] = benchmark::Counter(static_cast<double>(g_allocations.load() - m_allocations), benchmark::Counter::kAvgIterations);
+		}
+	};
+
+	template <typename TPayload> void encode_minipb_array(benchmark::State& state) {
+		auto& data = payload_data<TPayload>::get();
+		std::vector<uint8_t> buf(data.msg.estimate_size());
+		op_counter counter{state, data.encoded.size()};
+		for (auto _ : state) {
+			minipb::array_output_stream stream{buf.data(), buf.size()};
+			minipb::basic_msg_builder<minipb::array_output_stream> b{stream};
+			if (data.msg.encode(b) != minipb::result::ok) state.SkipWithError("encode failed");
+			benchmark::DoNotOptimize(buf.data());
+		}
+	}
+
+	template <typename TPayload> void encode_minipb_unchecked(benchmark::State& state) {
+		auto& data = payload_data<TPayload>::get();
+		std::vector<uint8_t> buf(data.msg.estimate_size());
+		op_counter counter{state, data.encoded.size()};
+		for (auto _ : state) {
+			minipb::array_output_stream stream{buf.data(), buf.size()};
+			if (minipb::encode_unchecked(stream, data.msg) != minipb::result::ok) state.SkipWithError("encode failed");
+			benchmark::DoNotOptimize(buf.data());
+		}
+	}
+
+	template <typename TPayload> void encode_minipb_virtual(benchmark::State& state) {
+		auto& data = payload_data<TPayload>::get();
+		std::vector<uint8_t> buf(data.msg.estimate_size());
+		op_counter counter{state, data.encoded.size()};
+		for (auto _ : state) {
+			minipb::array_output_stream stream{buf.data(), buf.size()};
+			minipb::msg_builder b{stream};
+			if (data.msg.encode(b) != minipb::result::ok) state.SkipWithError("encode failed");
+			benchmark::DoNotOptimize(buf.data());
+		}
+	}
+
+	template <typename TPayload, typename TContainer> void encode_minipb_container(benchmark::State& state) {
+		auto& data = payload_data<TPayload>::get();
+		TContainer buf;
+		op_counter counter{state, data.encoded.size()};
+		for (auto _ : state) {
+			// Cleared but not shrunk, like a buffer reused between messages
+			buf.clear();
+			minipb::container_output_stream<TContainer> stream{buf};
+			minipb::basic_msg_builder<minipb::container_output_stream<TContainer>> b{stream};
+			if (data.msg.encode(b) != minipb::result::ok) state.SkipWithError("encode failed");
+			benchmark::DoNotOptimize(buf.data());
+		}
+	}
+
+	template <typename TPayload> void encode_minipb_segmented(benchmark::State& state) {
+		auto& data = payload_data<TPayload>::get();
+		minipb::block_pool pool;
+		op_counter counter{state, data.encoded.size()};
+		for (auto _ : state) {
+			minipb::segmented_output_stream stream{pool};
+			minipb::msg_builder b{stream};
+			if (data.msg.encode(b) != minipb::result::ok) state.SkipWithError("encode failed");
+			benchmark::DoNotOptimize(stream.bytes_used());
+		}
+	}
+
+	template <typename TPayload> void encode_minipb_reverse(benchmark::State& state) {
+		auto& data = payload_data<TPayload>::get();
+		minipb::reverse_msg_builder b;
+		op_counter counter{state, data.encoded.size()};
+		for (auto _ : state) {
+			b.reset();
+			if (data.msg.encode_reverse(b) != minipb::result::ok) state.SkipWithError("encode failed");
+			benchmark::DoNotOptimize(b.data());
+		}
+	}
+
+	template <typename TPayload> void encode_libprotobuf(benchmark::State& state) {
+		auto& data = payload_data<TPayload>::get();
+		std::vector<uint8_t> buf(data.pb.ByteSizeLong());
+		op_counter counter{state, data.encoded.size()};
+		for (auto _ : state) {
+			if (!data.pb.SerializeToArray(buf.data(), static_cast<int>(buf.size()))) state.SkipWithError("encode failed");
+			benchmark::DoNotOptimize(buf.data());
+		}
+	}
+
+	template <typename TPayload> void decode_minipb_array(benchmark::State& state) {
+		auto& data = payload_data<TPayload>::get();
+		op_counter counter{state, data.encoded.size()};
+		for (auto _ : state) {
+			minipb::array_input_stream stream{data.encoded.data(), data.encoded.size()};
+			minipb::basic_msg_parser<minipb::array_input_stream> p{stream};
+			typename TPayload::minipb_type msg{};
+			if (msg.decode(p) != minipb::result::ok) state.SkipWithError("decode failed");
+			benchmark::DoNotOptimize(msg);
+		}
+	}
+
+	template <typename TPayload> void decode_minipb_table(benchmark::State& state) {
+		auto& data = payload_data<TPayload>::get();
+		op_counter counter{state, data.encoded.size()};
+		for (auto _ : state) {
+			minipb::array_input_stream stream{data.encoded.data(), data.encoded.size()};
+			minipb::basic_msg_parser<minipb::array_input_stream> p{stream};
+			typename TPayload::table_type msg{};
+			if (msg.decode(p) != minipb::result::ok) state.SkipWithError("decode failed");
+			benchmark::DoNotOptimize(msg);
+		}
+	}
+
+	template <typename TPayload> void decode_minipb_inline(benchmark::State& state) {
+		auto& data = payload_data<TPayload>::get();
+		op_counter counter{state, data.encoded.size()};
+		for (auto _ : state) {
+			minipb::array_input_stream stream{data.encoded.data(), data.encoded.size()};
+			minipb::basic_msg_parser<minipb::array_input_stream> p{stream};
+			typename TPayload::flat_type msg{};
+			if (msg.decode(p) != minipb::result::ok) state.SkipWithError("decode failed");
+			benchmark::DoNotOptimize(msg);
+		}
+	}
+
+	template <typename TPayload> void decode_minipb_container(benchmark::State& state) {
+		auto& data = payload_data<TPayload>::get();
+		op_counter counter{state, data.encoded.size()};
+		for (auto _ : state) {
+			minipb::container_input_stream stream{data.encoded};
+			minipb::basic_msg_parser<minipb::container_input_stream> p{stream};
+			typename TPayload::minipb_type msg{};
+			if (msg.decode(p) != minipb::result::ok) state.SkipWithError("decode failed");
+			benchmark::DoNotOptimize(msg);
+		}
+	}
+
+	template <typename TPayload> void decode_minipb_virtual(benchmark::State& state) {
+		auto& data = payload_data<TPayload>::get();
+		op_counter counter{state, data.encoded.size()};
+		for (auto _ : state) {
+			minipb::array_input_stream stream{data.encoded.data(), data.encoded.size()};
+			minipb::msg_parser p{stream};
+			typename TPayload::minipb_type msg{};
+			if (msg.decode(p) != minipb::result::ok) state.SkipWithError("decode failed");
+			benchmark::DoNotOptimize(msg);
+		}
+	}
+
+	template <typename TPayload> void decode_libprotobuf(benchmark::State& state) {
+		auto& data = payload_data<TPayload>::get();
+		op_counter counter{state, data.encoded.size()};
+		for (auto _ : state) {
+			typename TPayload::pb_type msg{};
+			if (!msg.ParseFromArray(data.encoded.data(), static_cast<int>(data.encoded.size()))) state.SkipWithError("decode failed");
+			benchmark::DoNotOptimize(msg);
+		}
+	}
+
+	// Sums a field of every row, the default types chase a pointer per element
+	template <typename TRows> double sum_rows(const TRows& msg) {
+		double sum = 0;
+		for (auto& e : msg.items)
+			sum += e->value;
+		return sum;
+	}
+	template <> double sum_rows(const flat::bench::rows& msg) {
+		double sum = 0;
+		for (auto& e : msg.items)
+			sum += e.value;
+		return sum;
+	}
+
+	template <typename TRows> void iterate_rows(benchmark::State& state) {
+		auto& data = payload_data<rows_payload>::get();
+		minipb::array_input_stream stream{data.encoded.data(), data.encoded.size()};
+		minipb::basic_msg_parser<minipb::array_input_stream> p{stream};
+		TRows msg{};
+		if (msg.decode(p) != minipb::result::ok) std::abort();
+		for (auto _ : state)
+			benchmark::DoNotOptimize(sum_rows(msg));
+		state.counters["rows"] = benchmark::Counter(static_cast<double>(msg.items.size()), benchmark::Counter::kIsIterationInvariantRate);
+	}
+
+	// Number of records per iteration of the record benchmarks
+	constexpr size_t record_count = 1000;
+	// The parallel benchmarks need enough chunks to keep 32 workers busy, several per worker
+	constexpr size_t parallel_record_count = 256 * record_count;
+	constexpr size_t parallel_chunk_size = 64 * 1024;
+
+	// Reports records per second in addition to bytes per second
+	void count_records(benchmark::State& state, size_t count = record_count) {
+		state.counters["records"] = benchmark::Counter(static_cast<double>(count), benchmark::Counter::kIsIterationInvariantRate);
+	}
+
+	template <typename TPayload, size_t Count = record_count> const std::string& records_encoded() {
+		static const std::string encoded = [] {
+			std::string res;
+			minipb::container_output_stream<std::string> stream{res};
+			minipb::record_writer w{stream};
+			for (size_t i = 0; i < Count; i++)
+				if (w.write(payload_data<TPayload>::get().msg) != minipb::result::ok) std::abort();
+			if (w.flush() != minipb::result::ok) std::abort();
+			return res;
+		}();
+		return encoded;
+	}
+
+	template <typename TPayload> void write_records_minipb(benchmark::State& state) {
+		auto& data = payload_data<TPayload>::get();
+		std::string buf;
+		op_counter counter{state, records_encoded<TPayload>().size()};
+		for (auto _ : state) {
+			buf.clear();
+			minipb::container_output_stream<std::string> stream{buf};
+			minipb::record_writer w{stream};
+			for (size_t i = 0; i < record_count; i++)
+				if (w.write(data.msg) != minipb::result::ok) state.SkipWithError("encode failed");
+			if (w.flush() != minipb::result::ok) state.SkipWithError("encode failed");
+			benchmark::DoNotOptimize(buf.data());
+		}
+		count_records(state);
+	}
+
+	template <typename TPayload> void write_records_libprotobuf(benchmark::State& state) {
+		auto& data = payload_data<TPayload>::get();
+		std::string buf;
+		op_counter counter{state, records_encoded<TPayload>().size()};
+		for (auto _ : state) {
+			buf.clear();
+			google::protobuf::io::StringOutputStream stream{&buf};
+			google::protobuf::io::CodedOutputStream coded{&stream};
+			for (size_t i = 0; i < record_count; i++)
+				if (!google::protobuf::util::SerializeDelimitedToCodedStream(data.pb, &coded)) state.SkipWithError("encode failed");
+			coded.Trim();
+			benchmark::DoNotOptimize(buf.data());
+		}
+		count_records(state);
+	}
+
+	template <typename TPayload> void read_records_minipb(benchmark::State& state) {
+		auto& encoded = records_encoded<TPayload>();
+		op_counter counter{state, encoded.size()};
+		for (auto _ : state) {
+			minipb::array_input_stream stream{encoded.data(), encoded.size()};
+			minipb::basic_record_reader<minipb::array_input_stream> r{stream};
+			while (!r.is_eof()) {
+				typename TPayload::minipb_type msg{};
+				if (r.read(msg) != minipb::result::ok) state.SkipWithError("decode failed");
+				benchmark::DoNotOptimize(msg);
+			}
+		}
+		count_records(state);
+	}
+
+	template <typename TPayload, bool Ordered> void read_records_minipb_parallel(benchmark::State& state) {
+		auto& encoded = records_encoded<TPayload, parallel_record_count>();
+		minipb::thread_pool pool{static_cast<size_t>(state.range(0))};
+		minipb::parallel_decoder<typename TPayload::minipb_type> decoder{pool, Ordered};
+		op_counter counter{state, encoded.size()};
+		for (auto _ : state) {
+			auto res = decoder.decode(
+				encoded.data(), encoded.size(), [](typename TPayload::minipb_type& msg) { benchmark::DoNotOptimize(msg); }, parallel_chunk_size);
+			if (res != minipb::result::ok) state.SkipWithError("decode failed");
+		}
+		count_records(state, parallel_record_count);
+	}
+
+	template <typename TPayload> void read_records_libprotobuf(benchmark::State& state) {
+		auto& encoded = records_encoded<TPayload>();
+		op_counter counter{state, encoded.size()};
+		for (auto _ : state) {
+			google::protobuf::io::CodedInputStream coded{reinterpret_cast<const uint8_t*>(encoded.data()), static_cast<int>(encoded.size())};
+			for (size_t i = 0; i < record_count; i++) {
+				typename TPayload::pb_type msg{};
+				if (!google::protobuf::util::ParseDelimitedFromCodedStream(&msg, &coded, nullptr)) state.SkipWithError("decode failed");
+				benchmark::DoNotOptimize(msg);
+			}
+		}
+		count_records(state);
+	}
+
+	// A chain of depth nested nodes, the leaf carrying a label
+	std::string nested_chain(int depth) {
+		bench::node root{};
+		auto cur = &root;
+		for (int i = 0; i < depth; i++) {
+			cur->value = i;
+			cur->child = std::unique_ptr<bench::node>(new bench::node{});
+			cur = cur->child.get();
+		}
+		cur->label = std::string(256, 'l');
+		std::string encoded;
+		minipb::container_output_stream<std::string> stream{encoded};
+		minipb::msg_builder b{stream};
+		if (root.encode(b) != minipb::result::ok) std::abort();
+		return encoded;
+	}
+
+	// Time per level should not grow with the depth
+	template <typename TStream> void decode_minipb_depth(benchmark::State& state) {
+		auto encoded = nested_chain(static_cast<int>(state.range(0)));
+		op_counter counter{state, encoded.size()};
+		for (auto _ : state) {
+			minipb::array_input_stream stream{encoded.data(), encoded.size()};
+			minipb::basic_msg_parser<TStream> p{stream};
+			bench::node msg{};
+			if (msg.decode(p) != minipb::result::ok) state.SkipWithError("decode failed");
+			benchmark::DoNotOptimize(msg);
+		}
+		state.counters["per_level"] =
+			benchmark::Counter(static_cast<double>(state.range(0)), benchmark::Counter::kIsIterationInvariantRate | benchmark::Counter::kInvert);
+	}
+} // namespace
+
+BENCHMARK_TEMPLATE(decode_minipb_depth, minipb::array_input_stream)->RangeMultiplier(4)->Range(4, 1024);
+BENCHMARK_TEMPLATE(decode_minipb_depth, minipb::input_stream)->RangeMultiplier(4)->Range(4, 1024);
+
+#define MINIPB_BENCHMARKS(payload)                                                                                                                   \
+	BENCHMARK_TEMPLATE(encode_minipb_array, payload);                                                                                                \
+	BENCHMARK_TEMPLATE(encode_minipb_unchecked, payload);                                                                                            \
+	BENCHMARK_TEMPLATE(encode_minipb_virtual, payload);                                                                                              \
+	BENCHMARK_TEMPLATE(encode_minipb_container, payload, std::string);                                                                               \
+	BENCHMARK_TEMPLATE(encode_minipb_container, payload, std::vector<uint8_t>);                                                                      \
+	BENCHMARK_TEMPLATE(encode_minipb_segmented, payload);                                                                                            \
+	BENCHMARK_TEMPLATE(encode_minipb_reverse, payload);                                                                                              \
+	BENCHMARK_TEMPLATE(encode_libprotobuf, payload);                                                                                                 \
+	BENCHMARK_TEMPLATE(decode_minipb_array, payload);                                                                                                \
+	BENCHMARK_TEMPLATE(decode_minipb_table, payload);                                                                                                \
+	BENCHMARK_TEMPLATE(decode_minipb_inline, payload);                                                                                               \
+	BENCHMARK_TEMPLATE(decode_minipb_container, payload);                                                                                            \
+	BENCHMARK_TEMPLATE(decode_minipb_virtual, payload);                                                                                              \
+	BENCHMARK_TEMPLATE(decode_libprotobuf, payload)
+
+MINIPB_BENCHMARKS(sample_payload);
+MINIPB_BENCHMARKS(scalar_payload);
+MINIPB_BENCHMARKS(string_payload);
+MINIPB_BENCHMARKS(nested_payload);
+MINIPB_BENCHMARKS(packed_payload);
+MINIPB_BENCHMARKS(rows_payload);
+
+// Iterating the elements of a decoded repeated submessage field
+BENCHMARK_TEMPLATE(iterate_rows, bench::rows);
+BENCHMARK_TEMPLATE(iterate_rows, flat::bench::rows);
+
+// Streams of small records
+BENCHMARK_TEMPLATE(write_records_minipb, scalar_payload);
+BENCHMARK_TEMPLATE(write_records_libprotobuf, scalar_payload);
+BENCHMARK_TEMPLATE(read_records_minipb, scalar_payload);
+BENCHMARK_TEMPLATE(read_records_minipb_parallel, scalar_payload, false)->RangeMultiplier(2)->Range(1, 32)->UseRealTime();
+BENCHMARK_TEMPLATE(read_records_minipb_parallel, scalar_payload, true)->RangeMultiplier(2)->Range(1, 32)->UseRealTime();
+BENCHMARK_TEMPLATE(read_records_libprotobuf, scalar_payload);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,35 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+
+namespace minipb {
+	/**
+	 * \brief Encoded size of a generated message, stored by byte_size() and used while encoding its parent.
+	 *
+	 * byte_size() is const, so the size lives in a mutable member. It is accessed using relaxed atomics, which keeps encoding the same
+	 * const message from multiple threads free of data races (all threads store the same value). This header is kept small, since every
+	 * generated header includes it.
+	 */
+	class cached_size {
+		std::atomic<size_t> m_size{0};
+
+	public:
+		cached_size() noexcept = default;
+		cached_size(const cached_size& other) noexcept : m_size{other.get()} {}
+		cached_size& operator=(const cached_size& other) noexcept {
+			set(other.get());
+			return *this;
+		}
+
+		/**
+		 * \brief Get the size stored by the last call to byte_size().
+		 * \return The size in bytes
+		 */
+		size_t get() const noexcept { return m_size.load(std::memory_order_relaxed); }
+		/**
+		 * \brief Store a newly calculated size.
+		 * \param size The size in bytes
+		 */
+		void set(size_t size) noexcept { m_size.store(size, std::memory_order_relaxed); }
+	};
+} // namespace minipb
@@ -1,8 +1,23 @@
 #pragma once
+#include <atomic>
 #include <cstddef>
+#include <cstdint>
 #include <cstring>
+#include <memory>
+#include <new>
 #include <string>
 #include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <minipb/cached_size.h>
+
+// Packed fields are encoded and decoded using AVX2 or SSE4.1 depending on the CPU the code is running on (see simd_level).
+// Define MINIPB_NO_SIMD to always use the scalar code.
+#if !defined(MINIPB_NO_SIMD) && defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define MINIPB_SIMD_DISPATCH 1
+#include <immintrin.h>
+#endif
 
 namespace minipb {
 	/**
@@ -21,6 +36,8 @@ namespace minipb {
 		out_of_memory,
 		/// The provided protobuf message is invalid or does not match the message schema.
 		invalid_input,
+		/// Returned by msg_parser::next_field() when the end tag of the group being parsed is reached, handled by msg_parser::message_field().
+		end_of_group,
 	};
 
 	/**
@@ -61,6 +78,33 @@ namespace minipb {
 		 * \return A result code. Everything other than result::ok will cancel the encoding.
 		 */
 		virtual result write_at(size_t pos, const void* data, size_t data_size) noexcept = 0;
+		/**
+		 * \brief Write a block of data owned by the caller, which stays valid and unmodified until the output has been consumed.
+		 *
+		 * Used for string and bytes fields. Streams producing a list of buffers (e.g. gather_output_stream) can reference the data
+		 * instead of copying it, all others simply write it. Positions of referenced data are never passed to write_at().
+		 * \param data The data to write to the stream.
+		 * \param data_size The size of the data in bytes.
+		 * \return A result code. Everything other than result::ok will cancel the encoding.
+		 */
+		virtual result write_external(const void* data, size_t data_size) noexcept { return write(data, data_size); }
+		/**
+		 * \brief Get writable memory for the next data_size bytes of the stream, to be filled by the caller and finished by commit().
+		 *
+		 * Used by encode_unchecked() to write a whole message through a raw pointer. Streams without contiguous memory available
+		 * return nullptr, which makes the caller fall back to write().
+		 * \param data_size The number of bytes needed.
+		 * \return Pointer to data_size writable bytes or nullptr if not supported.
+		 */
+		virtual unsigned char* reserve(size_t data_size) noexcept {
+			(void)data_size;
+			return nullptr;
+		}
+		/**
+		 * \brief Mark bytes of the memory returned by the last call to reserve() as written.
+		 * \param data_size The number of bytes written, at most the reserved size.
+		 */
+		virtual void commit(size_t data_size) noexcept { (void)data_size; }
 	};
 
 	/**
@@ -109,6 +153,8 @@ namespace minipb {
 			memcpy(m_start + pos, data, data_size);
 			return result::ok;
 		}
+		unsigned char* reserve(size_t data_size) noexcept override { return data_size > bytes_available() ? nullptr : m_current; }
+		void commit(size_t data_size) noexcept override { m_current += data_size; }
 		/**
 		 * \brief Reset the stream by putting the iterator at the start of the array.
 		 * \note The buffer data is not cleared.
@@ -160,6 +206,24 @@ namespace minipb {
 			memcpy(reinterpret_cast<unsigned char*>(const_cast<element_type*>(m_container.data()) + m_base_size) + pos, data, data_size);
 			return result::ok;
 		}
+		unsigned char* reserve(size_t data_size) noexcept override {
+			try {
+				if ((m_container.size() - m_base_size) * sizeof(element_type) < (m_offset + data_size)) {
+					m_container.resize(((m_offset + data_size + sizeof(element_type) - 1) / sizeof(element_type)) + m_base_size);
+				}
+			} catch (...) {
+				return nullptr;
+			}
+			return reinterpret_cast<unsigned char*>(const_cast<element_type*>(m_container.data()) + m_base_size) + m_offset;
+		}
+		void commit(size_t data_size) noexcept override {
+			m_offset += data_size;
+			// Drop the reserved bytes which were not used
+			try {
+				m_container.resize(((m_offset + sizeof(element_type) - 1) / sizeof(element_type)) + m_base_size);
+			} catch (...) {
+			}
+		}
 
 		/**
 		 * \brief Reset the stream by putting the iterator at the start of the array.
@@ -171,6 +235,355 @@ namespace minipb {
 		}
 	};
 
+	/**
+	 * \brief Pool of fixed size memory blocks used by segmented_output_stream.
+	 *
+	 * Blocks returned to the pool are kept and handed out again, so encoding many messages in a row does not allocate once the pool
+	 * has warmed up. The pool needs to outlive all streams using it.
+	 */
+	class block_pool {
+	public:
+		/// Header of a block, the data follows directly after it
+		struct block {
+			block* next;
+			/**
+			 * \brief Get the data of the block.
+			 * \return Pointer to the first byte of the block
+			 */
+			unsigned char* data() noexcept { return reinterpret_cast<unsigned char*>(this + 1); }
+		};
+
+	private:
+		block* m_free{nullptr};
+		size_t m_free_count{0};
+		size_t m_block_size;
+
+	public:
+		/**
+		 * \brief Construct a new pool.
+		 * \param block_size The number of data bytes in each block
+		 */
+		explicit block_pool(size_t block_size = 64 * 1024) noexcept : m_block_size{block_size == 0 ? 1 : block_size} {}
+		block_pool(const block_pool&) = delete;
+		block_pool& operator=(const block_pool&) = delete;
+		~block_pool() { trim(); }
+
+		/**
+		 * \brief Get the number of data bytes in each block.
+		 * \return The block size in bytes
+		 */
+		size_t block_size() const noexcept { return m_block_size; }
+		/**
+		 * \brief Get the number of blocks kept for reuse.
+		 * \return The number of free blocks
+		 */
+		size_t free_blocks() const noexcept { return m_free_count; }
+		/**
+		 * \brief Take a block from the pool, allocating a new one if none is free.
+		 * \return The block or nullptr if no memory is available
+		 */
+		block* acquire() noexcept {
+			if (m_free == nullptr) return static_cast<block*>(::operator new(sizeof(block) + m_block_size, std::nothrow));
+			auto b = m_free;
+			m_free = b->next;
+			m_free_count--;
+			return b;
+		}
+		/**
+		 * \brief Return a chain of blocks linked using next to the pool.
+		 * \param first The first block of the chain, may be nullptr
+		 */
+		void release(block* first) noexcept {
+			while (first != nullptr) {
+				auto next = first->next;
+				first->next = m_free;
+				m_free = first;
+				m_free_count++;
+				first = next;
+			}
+		}
+		/**
+		 * \brief Free all blocks kept for reuse.
+		 */
+		void trim() noexcept {
+			while (m_free != nullptr) {
+				auto next = m_free->next;
+				::operator delete(m_free);
+				m_free = next;
+			}
+			m_free_count = 0;
+		}
+	};
+
+	/**
+	 * \brief Output stream appending to a chain of fixed size blocks taken from a block_pool.
+	 *
+	 * Unlike container_output_stream, growing the output never reallocates or copies bytes already written. The result can be
+	 * consumed block by block using for_each_segment() (e.g. to build an iovec list for writev()) or copied into a contiguous
+	 * buffer once at the end using flatten(). All blocks are returned to the pool on reset() or destruction.
+	 */
+	class segmented_output_stream final : public output_stream {
+		block_pool& m_pool;
+		block_pool::block* m_first{nullptr};
+		block_pool::block* m_last{nullptr};
+		// Bytes stored in all blocks before m_last
+		size_t m_full{0};
+		// Bytes used in m_last
+		size_t m_used{0};
+
+	public:
+		/**
+		 * \brief Construct a new stream.
+		 * \param pool The pool providing the blocks. Needs to outlive the stream.
+		 */
+		explicit segmented_output_stream(block_pool& pool) noexcept : m_pool{pool} {}
+		segmented_output_stream(const segmented_output_stream&) = delete;
+		segmented_output_stream& operator=(const segmented_output_stream&) = delete;
+		~segmented_output_stream() { reset(); }
+
+		/**
+		 * \brief Get the number of bytes used so far.
+		 * \return The number of bytes used.
+		 */
+		size_t bytes_used() const noexcept { return m_full + m_used; }
+		size_t position() const noexcept override { return m_full + m_used; }
+		result write(const void* data, size_t data_size) noexcept override {
+			auto ptr = static_cast<const unsigned char*>(data);
+			auto block_size = m_pool.block_size();
+			while (data_size != 0) {
+				if (m_last == nullptr || m_used == block_size) {
+					auto b = m_pool.acquire();
+					if (b == nullptr) return result::out_of_memory;
+					b->next = nullptr;
+					if (m_last == nullptr) {
+						m_first = b;
+					} else {
+						m_last->next = b;
+						m_full += m_used;
+					}
+					m_last = b;
+					m_used = 0;
+				}
+				auto n = block_size - m_used < data_size ? block_size - m_used : data_size;
+				memcpy(m_last->data() + m_used, ptr, n);
+				m_used += n;
+				ptr += n;
+				data_size -= n;
+			}
+			return result::ok;
+		}
+		result write_at(size_t pos, const void* data, size_t data_size) noexcept override {
+			if (pos + data_size > bytes_used()) return result::invalid_position;
+			auto ptr = static_cast<const unsigned char*>(data);
+			auto block_size = m_pool.block_size();
+			auto b = m_first;
+			// Patches are usually close to the end, which is reached directly
+			if (pos >= m_full) {
+				b = m_last;
+				pos -= m_full;
+			}
+			for (; pos >= block_size; pos -= block_size)
+				b = b->next;
+			while (data_size != 0) {
+				auto n = block_size - pos < data_size ? block_size - pos : data_size;
+				memcpy(b->data() + pos, ptr, n);
+				ptr += n;
+				data_size -= n;
+				pos = 0;
+				b = b->next;
+			}
+			return result::ok;
+		}
+		// Only possible if the data fits into the remainder of the last block, all blocks but the last one need to be full
+		unsigned char* reserve(size_t data_size) noexcept override {
+			auto block_size = m_pool.block_size();
+			if (m_last == nullptr || m_used == block_size) {
+				if (data_size > block_size) return nullptr;
+				auto b = m_pool.acquire();
+				if (b == nullptr) return nullptr;
+				b->next = nullptr;
+				if (m_last == nullptr) {
+					m_first = b;
+				} else {
+					m_last->next = b;
+					m_full += m_used;
+				}
+				m_last = b;
+				m_used = 0;
+			}
+			return block_size - m_used >= data_size ? m_last->data() + m_used : nullptr;
+		}
+		void commit(size_t data_size) noexcept override { m_used += data_size; }
+		/**
+		 * \brief Call f(const unsigned char* data, size_t size) for every block containing data, in order.
+		 * \param f The function to call
+		 */
+		template <typename F> void for_each_segment(F&& f) const {
+			for (auto b = m_first; b != nullptr; b = b->next) {
+				auto size = b == m_last ? m_used : m_pool.block_size();
+				if (size != 0) f(static_cast<const unsigned char*>(b->data()), size);
+			}
+		}
+		/**
+		 * \brief Copy the data into a contiguous buffer.
+		 * \param out A buffer of at least bytes_used() bytes
+		 */
+		void copy_to(void* out) const noexcept {
+			auto ptr = static_cast<unsigned char*>(out);
+			for_each_segment([&ptr](const unsigned char* data, size_t size) {
+				memcpy(ptr, data, size);
+				ptr += size;
+			});
+		}
+		/**
+		 * \brief Replace the contents of a container supporting resize(size_t) and data() by the data written so far.
+		 * \param container The container to fill
+		 * \return result::ok or result::out_of_memory if the container failed to resize
+		 */
+		template <typename T> result flatten(T& container) const noexcept {
+			using element_type = typename std::remove_reference<decltype(*container.data())>::type;
+			static_assert(std::is_pod<element_type>::value, "Container needs to only contain pod types");
+			try {
+				container.resize((bytes_used() + sizeof(element_type) - 1) / sizeof(element_type));
+			} catch (...) {
+				return result::out_of_memory;
+			}
+			if (bytes_used() != 0) copy_to(&container[0]);
+			return result::ok;
+		}
+		/**
+		 * \brief Reset the stream and return all blocks to the pool.
+		 */
+		void reset() noexcept {
+			m_pool.release(m_first);
+			m_first = m_last = nullptr;
+			m_full = m_used = 0;
+		}
+	};
+
+	/**
+	 * \brief Output stream producing a list of buffers for writev()/sendmsg() without copying large string/bytes fields.
+	 *
+	 * Data passed to write_external() (string and bytes fields) of at least threshold bytes is referenced in place, everything
+	 * else is copied into an internal buffer. The referenced memory (i.e. the message being encoded) needs to stay valid and unmodified
+	 * until the segments have been consumed. The result is consumed using for_each_segment(), e.g. using write_segments() from
+	 * minipb/posix.h.
+	 */
+	class gather_output_stream final : public output_stream {
+		struct entry {
+			// Stream position of the first byte
+			size_t position;
+			// Referenced data or nullptr if the data is stored in m_buffer
+			const unsigned char* external;
+			// Offset inside m_buffer if the data is not referenced
+			size_t offset;
+			size_t size;
+		};
+		std::vector<unsigned char> m_buffer{};
+		std::vector<entry> m_entries{};
+		size_t m_position{0};
+		size_t m_threshold;
+
+	public:
+		/// Default minimum size of referenced blocks
+		static constexpr size_t default_threshold = 1024;
+
+		/**
+		 * \brief Construct a new stream.
+		 * \param threshold The minimum size of a string/bytes field to get referenced instead of copied
+		 */
+		explicit gather_output_stream(size_t threshold = default_threshold) noexcept : m_threshold{threshold} {}
+
+		/**
+		 * \brief Get the number of bytes written so far, including referenced ones.
+		 * \return The number of bytes used.
+		 */
+		size_t bytes_used() const noexcept { return m_position; }
+		/**
+		 * \brief Get the number of bytes copied into the internal buffer.
+		 * \return The number of bytes copied.
+		 */
+		size_t bytes_copied() const noexcept { return m_buffer.size(); }
+		/**
+		 * \brief Get the number of segments produced by for_each_segment().
+		 * \return The number of segments
+		 */
+		size_t segment_count() const noexcept { return m_entries.size(); }
+		size_t position() const noexcept override { return m_position; }
+		result write(const void* data, size_t data_size) noexcept override {
+			if (data_size == 0) return result::ok;
+			try {
+				if (m_entries.empty() || m_entries.back().external != nullptr)
+					m_entries.push_back(entry{m_position, nullptr, m_buffer.size(), 0});
+				auto ptr = static_cast<const unsigned char*>(data);
+				m_buffer.insert(m_buffer.end(), ptr, ptr + data_size);
+			} catch (...) {
+				return result::out_of_memory;
+			}
+			m_entries.back().size += data_size;
+			m_position += data_size;
+			return result::ok;
+		}
+		result write_external(const void* data, size_t data_size) noexcept override {
+			if (data_size == 0 || data_size < m_threshold) return write(data, data_size);
+			try {
+				m_entries.push_back(entry{m_position, static_cast<const unsigned char*>(data), 0, data_size});
+			} catch (...) {
+				return result::out_of_memory;
+			}
+			m_position += data_size;
+			return result::ok;
+		}
+		result write_at(size_t pos, const void* data, size_t data_size) noexcept override {
+			if (pos + data_size > m_position) return result::invalid_position;
+			if (data_size == 0) return result::ok;
+			auto ptr = static_cast<const unsigned char*>(data);
+			// Patches are usually close to the end, so search backwards
+			auto it = m_entries.end();
+			do {
+				--it;
+			} while (it->position > pos);
+			while (data_size != 0) {
+				if (it->external != nullptr) return result::invalid_position;
+				auto offset = pos - it->position;
+				auto n = it->size - offset < data_size ? it->size - offset : data_size;
+				memcpy(m_buffer.data() + it->offset + offset, ptr, n);
+				ptr += n;
+				pos += n;
+				data_size -= n;
+				++it;
+			}
+			return result::ok;
+		}
+		/**
+		 * \brief Call f(const unsigned char* data, size_t size) for every segment, in order.
+		 * \param f The function to call
+		 */
+		template <typename F> void for_each_segment(F&& f) const {
+			for (auto& e : m_entries)
+				f(e.external != nullptr ? e.external : m_buffer.data() + e.offset, e.size);
+		}
+		/**
+		 * \brief Copy the data into a contiguous buffer.
+		 * \param out A buffer of at least bytes_used() bytes
+		 */
+		void copy_to(void* out) const noexcept {
+			auto ptr = static_cast<unsigned char*>(out);
+			for_each_segment([&ptr](const unsigned char* data, size_t size) {
+				memcpy(ptr, data, size);
+				ptr += size;
+			});
+		}
+		/**
+		 * \brief Reset the stream, dropping all segments. The internal buffer keeps its capacity.
+		 */
+		void reset() noexcept {
+			m_buffer.clear();
+			m_entries.clear();
+			m_position = 0;
+		}
+	};
+
 	/**
 	 * \brief Base class for an input stream.
 	 */
@@ -216,6 +629,13 @@ namespace minipb {
 		 * \note Protobuf does not contain a code for end of data, which means the size of a message needs to be communicated in some other way.
 		 */
 		virtual size_t bytes_available() const noexcept = 0;
+		/**
+		 * \brief Get the remaining data of the stream as a contiguous block of memory.
+		 * \return A pointer to the next byte to be read or nullptr if the stream is not backed by contiguous memory.
+		 * \note If a pointer is returned, bytes_available() bytes starting at it need to be readable until the next read() or skip().
+		 * The library uses this to decode directly from memory instead of peeking into a temporary buffer.
+		 */
+		virtual const unsigned char* data() const noexcept { return nullptr; }
 	};
 
 	/**
@@ -265,9 +685,19 @@ namespace minipb {
 		}
 		size_t peek(void* data, size_t data_size) noexcept override {
 			if (data_size > bytes_available()) data_size = bytes_available();
-			memcpy(data, m_current, data_size);
+			if (data_size != 0) memcpy(data, m_current, data_size);
 			return data_size;
 		}
+		const unsigned char* data() const noexcept override { return m_current; }
+		/**
+		 * \brief Get a stream covering the next len bytes without consuming them.
+		 * \param len The maximum number of bytes the new stream covers. Clamped to the bytes available.
+		 * \return A new stream starting at the current position.
+		 */
+		array_input_stream subset(size_t len) const noexcept {
+			if (len > bytes_available()) len = bytes_available();
+			return array_input_stream{m_current, len};
+		}
 		/**
 		 * \brief Reset the stream by putting the iterator at the start of the array.
 		 */
@@ -303,6 +733,13 @@ namespace minipb {
 		result read(void* data, size_t data_size) noexcept override { return m_array.read(data, data_size); }
 		result skip(size_t data_size) noexcept override { return m_array.skip(data_size); }
 		size_t peek(void* data, size_t data_size) noexcept override { return m_array.peek(data, data_size); }
+		const unsigned char* data() const noexcept override { return m_array.data(); }
+		/**
+		 * \brief Get a stream covering the next len bytes without consuming them.
+		 * \param len The maximum number of bytes the new stream covers. Clamped to the bytes available.
+		 * \return A new stream starting at the current position.
+		 */
+		array_input_stream subset(size_t len) const noexcept { return m_array.subset(len); }
 		/**
 		 * \brief Reset the stream by putting the iterator at the start of the container.
 		 */
@@ -311,11 +748,21 @@ namespace minipb {
 
 	/**
 	 * \brief Container input stream that wraps a subset of a different input stream.
+	 *
+	 * Nested subsets created using subset() refer to the same root stream directly and share a single counter of the bytes consumed,
+	 * each subset only stores where it ends. Every call costs the same, no matter how deep the subsets are nested, and the parent is
+	 * only asked for bytes_available() once, when the outermost subset is constructed.
 	 */
 	class subset_input_stream final : public input_stream {
-		input_stream& m_parent;
-		size_t m_length;
+		input_stream& m_root;
+		// Bytes consumed from the root by the outermost subset, including those consumed through nested subsets
 		size_t m_position{0};
+		// Points to m_position of the outermost subset
+		size_t* m_consumed;
+		// Value of *m_consumed at the end of the subset
+		size_t m_end;
+
+		subset_input_stream(input_stream& root, size_t* consumed, size_t end) noexcept : m_root{root}, m_consumed{consumed}, m_end{end} {}
 
 	public:
 		/**
@@ -324,126 +771,818 @@ namespace minipb {
 		 * \param len The maximum len available for reading. The actual size available
 		 * for reading is the less of this and the number of bytes available in the parent stream.
 		 */
-		subset_input_stream(input_stream& parent, size_t len) noexcept : m_parent{parent}, m_length{parent.bytes_available()} {
-			if (len < m_length) m_length = len;
+		subset_input_stream(input_stream& parent, size_t len) noexcept : m_root{parent}, m_consumed{&m_position}, m_end{parent.bytes_available()} {
+			if (len < m_end) m_end = len;
 		}
-		size_t bytes_available() const noexcept override { return m_length - m_position; }
+		subset_input_stream(const subset_input_stream& other) noexcept
+			: m_root{other.m_root}, m_position{other.m_position}, m_consumed{other.m_consumed == &other.m_position ? &m_position : other.m_consumed},
+			  m_end{other.m_end} {}
+		subset_input_stream& operator=(const subset_input_stream&) = delete;
+		size_t bytes_available() const noexcept override { return m_end - *m_consumed; }
 		result read(void* data, size_t data_size) noexcept override {
 			if (data_size > bytes_available()) return result::out_of_space;
-			auto res = m_parent.read(data, data_size);
-			if (res == result::ok) m_position += data_size;
+			auto res = m_root.read(data, data_size);
+			if (res == result::ok) *m_consumed += data_size;
 			return res;
 		}
 		result skip(size_t data_size) noexcept override {
 			if (data_size > bytes_available()) return result::out_of_space;
-			auto res = m_parent.skip(data_size);
-			if (res == result::ok) m_position += data_size;
+			auto res = m_root.skip(data_size);
+			if (res == result::ok) *m_consumed += data_size;
 			return res;
 		}
 		size_t peek(void* data, size_t data_size) noexcept override {
 			if (data_size > bytes_available()) data_size = bytes_available();
-			return m_parent.peek(data, data_size);
+			return m_root.peek(data, data_size);
+		}
+		const unsigned char* data() const noexcept override { return m_root.data(); }
+		/**
+		 * \brief Get a stream covering the next len bytes without consuming them.
+		 *
+		 * The new stream reads from the root stream directly instead of going through this one. It must not outlive the outermost
+		 * subset, which holds the shared counter.
+		 * \param len The maximum number of bytes the new stream covers. Clamped to the bytes available.
+		 * \return A new stream starting at the current position.
+		 */
+		subset_input_stream subset(size_t len) const noexcept {
+			auto available = bytes_available();
+			if (len > available) len = available;
+			return subset_input_stream{m_root, m_consumed, *m_consumed + len};
 		}
-	};
-
-	/// The wiretype of a field
-	enum class wire_type {
-		// Integer stored in variable lenght encoding using 1-10 bytes
-		varint = 0,
-		// A fixed 64bit field
-		fixed64 = 1,
-		// A length delimited blob of data (string, bytes or submessage)
-		length_blob = 2,
-		// Deprecated group start
-		group_start = 3,
-		// Deprecated group end
-		group_end = 4,
-		// A fixed 32bit field
-		fixed32 = 5,
 	};
 
 	/**
-	 * \brief Encoder class used to encode fields into a protobuf data stream.
-	 * \note This is a lowlevel class and should only be used if you need full control over
-	 * the emitted data. For normal operation use msg_builder or the generated message classes.
+	 * \brief Input stream adding a read-ahead buffer to a source that can only be read sequentially (pipes, sockets, FILE*, ...).
+	 *
+	 * The source is a callable `size_t(void* data, size_t size)` that reads up to size bytes into data and returns the number of
+	 * bytes read (0 on error or end of input). The stream refills its buffer in large chunks, so peek() is always cheap and varints
+	 * never fall back to single byte reads. Reads larger than the buffer go to the source directly. Since protobuf messages are not
+	 * self delimiting the size of the message needs to be known up front (e.g. from a length prefix or the file size). Once the rest of
+	 * the message is buffered, data() exposes it and the contiguous fast paths apply.
 	 */
-	class encoder final {
-		output_stream& m_stream;
+	class buffered_input_stream final : public input_stream {
+		void* m_source;
+		size_t (*m_read)(void*, void*, size_t);
+		unsigned char* m_buffer;
+		size_t m_capacity;
+		unsigned char* m_current;
+		unsigned char* m_end;
+		// Bytes of the message not consumed yet, including the buffered ones
+		size_t m_remaining;
+
+		size_t buffered() const noexcept { return m_end - m_current; }
+		// Move the unread bytes to the front and read as much of the message as fits into the buffer
+		result fill() noexcept {
+			auto left = buffered();
+			if (m_current != m_buffer) {
+				if (left != 0) memmove(m_buffer, m_current, left);
+				m_current = m_buffer;
+				m_end = m_buffer + left;
+			}
+			auto wanted = m_capacity - left;
+			if (wanted > m_remaining - left) wanted = m_remaining - left;
+			while (wanted != 0) {
+				auto n = m_read(m_source, m_end, wanted);
+				if (n == 0 || n > wanted) return result::general_error;
+				m_end += n;
+				wanted -= n;
+			}
+			return result::ok;
+		}
 
 	public:
-		/**
-		 * \brief Construct a new encoder using the specified stream for data output.
-		 * \param stream Output stream used for the emitted data.
-		 */
-		encoder(output_stream& stream) noexcept : m_stream{stream} {}
+		/// Default size of the read-ahead buffer in bytes
+		static constexpr size_t default_buffer_size = 64 * 1024;
+		/// Minimum size of the read-ahead buffer, enough to peek a varint
+		static constexpr size_t min_buffer_size = 16;
 
 		/**
-		 * \brief Get the underlying data stream.
-		 * \return The data stream.
+		 * \brief Construct a new buffered stream around a source.
+		 * \param source Callable reading from the source, needs to outlive the stream.
+		 * \param size The size of the message in bytes.
+		 * \param buffer_size The size of the read-ahead buffer in bytes.
 		 */
-		output_stream& stream() const noexcept { return m_stream; }
+		template <typename TSource>
+		buffered_input_stream(TSource& source, size_t size, size_t buffer_size = default_buffer_size) noexcept
+			: m_source{&source}, m_read{[](void* src, void* data, size_t len) -> size_t { return (*static_cast<TSource*>(src))(data, len); }},
+			  m_buffer{nullptr}, m_capacity{buffer_size}, m_current{nullptr}, m_end{nullptr}, m_remaining{size} {
+			// Never allocate more than the message needs
+			if (m_capacity > size) m_capacity = size;
+			if (m_capacity < min_buffer_size) m_capacity = min_buffer_size;
+			m_buffer = new (std::nothrow) unsigned char[m_capacity];
+			if (m_buffer == nullptr) m_capacity = 0;
+			m_current = m_end = m_buffer;
+		}
+		buffered_input_stream(const buffered_input_stream&) = delete;
+		buffered_input_stream& operator=(const buffered_input_stream&) = delete;
+		~buffered_input_stream() { delete[] m_buffer; }
 
 		/**
-		 * \brief Write an unsigned integer in varint encoding.
-		 * \param val The value to write.
-		 * \return result::ok or the error that occurred.
+		 * \brief Check if the buffer was allocated successfully.
+		 * \return result::ok or result::out_of_memory
 		 */
-		result varint(uint64_t val) noexcept {
-			uint8_t buf[10];
-			auto i = varint_build(val, buf);
-			return m_stream.write(buf, i);
+		result status() const noexcept { return m_buffer != nullptr ? result::ok : result::out_of_memory; }
+		size_t bytes_available() const noexcept override { return m_remaining; }
+		result read(void* data, size_t data_size) noexcept override {
+			if (data_size > m_remaining) return result::out_of_space;
+			auto out = static_cast<unsigned char*>(data);
+			auto left = buffered();
+			if (data_size > left) {
+				if (left != 0) memcpy(out, m_current, left);
+				out += left;
+				data_size -= left;
+				m_remaining -= left;
+				m_current = m_end = m_buffer;
+				// Large reads bypass the buffer
+				if (data_size >= m_capacity) {
+					while (data_size != 0) {
+						auto n = m_read(m_source, out, data_size);
+						if (n == 0 || n > data_size) return result::general_error;
+						out += n;
+						data_size -= n;
+						m_remaining -= n;
+					}
+					return result::ok;
+				}
+				auto res = fill();
+				if (res != result::ok) return res;
+			}
+			memcpy(out, m_current, data_size);
+			m_current += data_size;
+			m_remaining -= data_size;
+			return result::ok;
 		}
-
+		result skip(size_t data_size) noexcept override {
+			if (data_size > m_remaining) return result::out_of_space;
+			while (data_size > buffered()) {
+				data_size -= buffered();
+				m_remaining -= buffered();
+				m_current = m_end = m_buffer;
+				auto res = fill();
+				if (res != result::ok) return res;
+			}
+			m_current += data_size;
+			m_remaining -= data_size;
+			return result::ok;
+		}
+		size_t peek(void* data, size_t data_size) noexcept override {
+			if (data_size > m_remaining) data_size = m_remaining;
+			if (data_size > buffered() && fill() != result::ok) return 0;
+			if (data_size > buffered()) data_size = buffered();
+			memcpy(data, m_current, data_size);
+			return data_size;
+		}
+		const unsigned char* data() const noexcept override { return m_remaining != 0 && buffered() == m_remaining ? m_current : nullptr; }
 		/**
-		 * \brief Write an signed integer in varint encoding (using zig zag encoding).
-		 * \param val The value to write.
-		 * \return result::ok or the error that occurred.
+		 * \brief Read the rest of the message into the buffer if it fits, which enables the contiguous fast paths.
+		 * \return result::ok or the error returned while reading the source.
 		 */
-		result varint_signed(int64_t val) noexcept {
-			if (val < 0)
-				return varint(~(static_cast<uint64_t>(val) << 1));
-			else
-				return varint(static_cast<uint64_t>(val) << 1);
+		result prefetch() noexcept {
+			if (buffered() == m_remaining || m_remaining > m_capacity) return result::ok;
+			return fill();
 		}
+	};
 
+	/**
+	 * \brief Non owning view of a string/bytes value.
+	 *
+	 * Used by code generated with the `string_view` option to reference string and bytes fields inside the buffer they
+	 * were decoded from instead of copying them. The buffer needs to outlive the view.
+	 */
+	class string_view {
+		const char* m_data{nullptr};
+		size_t m_size{0};
+
+	public:
 		/**
-		 * \brief Write a field header to the stream (field id & wire_type).
-		 * \param field_id The field id
-		 * \param type The wiretype of the data
-		 * \return result::ok or the error that occurred.
+		 * \brief Construct an empty view.
 		 */
-		result field_header(uint64_t field_id, wire_type type) noexcept { return varint(field_id << 3 | static_cast<uint64_t>(type)); }
-
+		string_view() noexcept = default;
 		/**
-		 * \brief Write a int32_t in fixed32 encoding.
-		 * \param val The value to write.
-		 * \return result::ok or the error that occurred.
+		 * \brief Construct a view of size bytes starting at data.
+		 * \param data Pointer to the first byte
+		 * \param size Number of bytes in the view
 		 */
-		result fixed32(int32_t val) noexcept { return m_stream.write(&val, sizeof(val)); }
-
+		string_view(const char* data, size_t size) noexcept : m_data{data}, m_size{size} {}
 		/**
-		 * \brief Write a uint32_t in fixed32 encoding.
-		 * \param val The value to write.
-		 * \return result::ok or the error that occurred.
+		 * \brief Construct a view of the contents of a string.
+		 * \param str The string to reference. Needs to outlive the view.
 		 */
-		result fixed32(uint32_t val) noexcept { return m_stream.write(&val, sizeof(val)); }
-
+		string_view(const std::string& str) noexcept : m_data{str.data()}, m_size{str.size()} {}
 		/**
-		 * \brief Write a float in fixed32 encoding.
-		 * \param val The value to write.
-		 * \return result::ok or the error that occurred.
+		 * \brief Get a pointer to the first byte of the view.
+		 * \return Pointer to the data (not null terminated)
 		 */
-		result fixed32(float val) noexcept { return m_stream.write(&val, sizeof(val)); }
-
+		const char* data() const noexcept { return m_data; }
 		/**
-		 * \brief Write a int64_t in fixed64 encoding.
-		 * \param val The value to write.
-		 * \return result::ok or the error that occurred.
+		 * \brief Get the size of the view.
+		 * \return The size in bytes
 		 */
-		result fixed64(int64_t val) noexcept { return m_stream.write(&val, sizeof(val)); }
-
+		size_t size() const noexcept { return m_size; }
 		/**
-		 * \brief Write a uint64_t in fixed64 encoding.
+		 * \brief Check if the view is empty.
+		 * \return true if the view contains no bytes
+		 */
+		bool empty() const noexcept { return m_size == 0; }
+		const char* begin() const noexcept { return m_data; }
+		const char* end() const noexcept { return m_data + m_size; }
+		char operator[](size_t idx) const noexcept { return m_data[idx]; }
+		/**
+		 * \brief Copy the referenced data into a std::string.
+		 * \return A string containing a copy of the data
+		 */
+		std::string str() const { return std::string(m_data, m_size); }
+
+		friend bool operator==(const string_view& lhs, const string_view& rhs) noexcept {
+			return lhs.m_size == rhs.m_size && (lhs.m_size == 0 || memcmp(lhs.m_data, rhs.m_data, lhs.m_size) == 0);
+		}
+		friend bool operator!=(const string_view& lhs, const string_view& rhs) noexcept { return !(lhs == rhs); }
+	};
+
+	/**
+	 * \brief Bump allocator used by code generated with the `arena` option.
+	 *
+	 * Memory is handed out from a chain of blocks. Individual allocations are never freed, instead reset() releases everything
+	 * allocated so far in O(1) while keeping the blocks for reuse. Objects placed in an arena do not get their destructors called,
+	 * which is why the generated arena types only contain trivially destructible members.
+	 */
+	class arena {
+		struct block {
+			block* next;
+			size_t size;
+		};
+		block* m_first{nullptr};
+		block* m_current{nullptr};
+		unsigned char* m_ptr{nullptr};
+		unsigned char* m_end{nullptr};
+		size_t m_block_size;
+
+		static unsigned char* block_begin(block* b) noexcept { return reinterpret_cast<unsigned char*>(b) + sizeof(block); }
+
+		void use_block(block* b) noexcept {
+			m_current = b;
+			m_ptr = block_begin(b);
+			m_end = m_ptr + b->size;
+		}
+
+		bool next_block(size_t min_size) noexcept {
+			// Reuse the following block from a previous reset() if it is large enough
+			if (m_current != nullptr && m_current->next != nullptr && m_current->next->size >= min_size) {
+				use_block(m_current->next);
+				return true;
+			}
+			size_t size = min_size > m_block_size ? min_size : m_block_size;
+			auto b = static_cast<block*>(::operator new(sizeof(block) + size, std::nothrow));
+			if (b == nullptr) return false;
+			b->size = size;
+			if (m_current == nullptr) {
+				b->next = m_first;
+				m_first = b;
+			} else {
+				b->next = m_current->next;
+				m_current->next = b;
+			}
+			use_block(b);
+			return true;
+		}
+
+	public:
+		/**
+		 * \brief Construct a new arena.
+		 * \param block_size The size of the memory blocks requested from the system. Larger allocations get a block of their own.
+		 */
+		explicit arena(size_t block_size = 4096) noexcept : m_block_size{block_size} {}
+		arena(const arena&) = delete;
+		arena& operator=(const arena&) = delete;
+		~arena() {
+			while (m_first != nullptr) {
+				auto next = m_first->next;
+				::operator delete(m_first);
+				m_first = next;
+			}
+		}
+
+		/**
+		 * \brief Allocate a block of memory.
+		 * \param size The size in bytes
+		 * \param align The required alignment, needs to be a power of two
+		 * \return A pointer to the memory or nullptr if no memory is available
+		 */
+		void* allocate(size_t size, size_t align = alignof(std::max_align_t)) noexcept {
+			auto offset = (align - (reinterpret_cast<uintptr_t>(m_ptr) & (align - 1))) & (align - 1);
+			if (m_ptr == nullptr || offset + size > static_cast<size_t>(m_end - m_ptr)) {
+				if (!next_block(size + align)) return nullptr;
+				offset = (align - (reinterpret_cast<uintptr_t>(m_ptr) & (align - 1))) & (align - 1);
+			}
+			auto res = m_ptr + offset;
+			m_ptr = res + size;
+			return res;
+		}
+
+		/**
+		 * \brief Create a value initialized object inside the arena.
+		 * \tparam T The type to create. Its destructor will never be called.
+		 * \return A pointer to the new object or nullptr if no memory is available
+		 */
+		template <typename T> T* create() noexcept {
+			auto mem = allocate(sizeof(T), alignof(T));
+			if (mem == nullptr) return nullptr;
+			return new (mem) T{};
+		}
+
+		/**
+		 * \brief Release all allocations at once.
+		 * \note All memory blocks are kept and reused by subsequent allocations.
+		 */
+		void reset() noexcept {
+			if (m_first != nullptr)
+				use_block(m_first);
+			else
+				m_ptr = m_end = nullptr;
+		}
+	};
+
+	/**
+	 * \brief Minimal vector type storing its elements inside an arena.
+	 *
+	 * The vector is trivially destructible and can be placed inside an arena itself. Growing the vector copies the elements
+	 * into a new, larger arena allocation and abandons the old one until the arena is reset.
+	 * \tparam T The element type, needs to be trivially copyable.
+	 */
+	template <typename T> class arena_vector {
+		static_assert(std::is_trivially_copyable<T>::value, "arena_vector needs a trivially copyable element type");
+		T* m_data{nullptr};
+		size_t m_size{0};
+		size_t m_capacity{0};
+		arena* m_arena{nullptr};
+
+	public:
+		using value_type = T;
+
+		/**
+		 * \brief Construct an empty vector without an arena. set_arena() needs to be called before adding elements.
+		 */
+		arena_vector() noexcept = default;
+		/**
+		 * \brief Construct an empty vector allocating from the specified arena.
+		 * \param a The arena used for element storage
+		 */
+		explicit arena_vector(arena& a) noexcept : m_arena{&a} {}
+
+		/**
+		 * \brief Set the arena used for future allocations.
+		 * \param a The arena used for element storage
+		 */
+		void set_arena(arena& a) noexcept { m_arena = &a; }
+		/**
+		 * \brief Get the arena used for allocations.
+		 * \return The arena or nullptr if none is set
+		 */
+		arena* get_arena() const noexcept { return m_arena; }
+
+		/**
+		 * \brief Make sure the vector can hold at least n elements without reallocating.
+		 * \param n The number of elements
+		 * \throw std::bad_alloc if there is no arena or it is out of memory
+		 */
+		void reserve(size_t n) {
+			if (n <= m_capacity) return;
+			if (m_arena == nullptr) throw std::bad_alloc{};
+			auto mem = static_cast<T*>(m_arena->allocate(n * sizeof(T), alignof(T)));
+			if (mem == nullptr) throw std::bad_alloc{};
+			if (m_size != 0) memcpy(mem, m_data, m_size * sizeof(T));
+			m_data = mem;
+			m_capacity = n;
+		}
+		/**
+		 * \brief Append an element.
+		 * \param v The element to append
+		 * \throw std::bad_alloc if there is no arena or it is out of memory
+		 */
+		void push_back(const T& v) {
+			if (m_size == m_capacity) reserve(m_capacity == 0 ? 8 : m_capacity * 2);
+			m_data[m_size++] = v;
+		}
+		/**
+		 * \brief Change the number of elements. New elements are value initialized.
+		 * \param n The new number of elements
+		 * \throw std::bad_alloc if there is no arena or it is out of memory
+		 */
+		void resize(size_t n) {
+			if (n > m_capacity) reserve(n > m_capacity * 2 ? n : m_capacity * 2);
+			for (size_t i = m_size; i < n; i++)
+				m_data[i] = T{};
+			m_size = n;
+		}
+		/**
+		 * \brief Remove all elements. The storage is kept.
+		 */
+		void clear() noexcept { m_size = 0; }
+
+		size_t size() const noexcept { return m_size; }
+		bool empty() const noexcept { return m_size == 0; }
+		T* data() noexcept { return m_data; }
+		const T* data() const noexcept { return m_data; }
+		T* begin() noexcept { return m_data; }
+		T* end() noexcept { return m_data + m_size; }
+		const T* begin() const noexcept { return m_data; }
+		const T* end() const noexcept { return m_data + m_size; }
+		T& operator[](size_t idx) noexcept { return m_data[idx]; }
+		const T& operator[](size_t idx) const noexcept { return m_data[idx]; }
+	};
+
+	/// The wiretype of a field
+	enum class wire_type {
+		// Integer stored in variable lenght encoding using 1-10 bytes
+		varint = 0,
+		// A fixed 64bit field
+		fixed64 = 1,
+		// A length delimited blob of data (string, bytes or submessage)
+		length_blob = 2,
+		// Deprecated group start
+		group_start = 3,
+		// Deprecated group end
+		group_end = 4,
+		// A fixed 32bit field
+		fixed32 = 5,
+	};
+
+	/**
+	 * \brief Check if a container stores its elements contiguously in their fixed32/fixed64 wire representation.
+	 *
+	 * True if `data()` returns a pointer to an arithmetic type of Size bytes. Packed blocks of such containers are copied as a whole.
+	 * \tparam T The container type
+	 * \tparam Size The size of the encoded element (4 or 8)
+	 */
+	template <typename T, size_t Size> class has_fixed_storage {
+		template <typename U, typename E = typename std::remove_pointer<decltype(std::declval<const U&>().data())>::type>
+		static std::integral_constant<bool, std::is_arithmetic<E>::value && sizeof(E) == Size> test(int);
+		template <typename U> static std::false_type test(...);
+
+	public:
+		static constexpr bool value = decltype(test<T>(0))::value;
+	};
+
+	/**
+	 * \brief Check if a container stores 32 or 64bit integers contiguously.
+	 *
+	 * True if `data()` returns a pointer to such an integer type. Packed varint blocks of these containers are encoded in bulk.
+	 * \tparam T The container type
+	 */
+	template <typename T> class has_varint_storage {
+		template <typename U, typename E = typename std::remove_pointer<decltype(std::declval<const U&>().data())>::type>
+		static std::integral_constant<bool, std::is_integral<E>::value && (sizeof(E) == 4 || sizeof(E) == 8)> test(int);
+		template <typename U> static std::false_type test(...);
+
+	public:
+		static constexpr bool value = decltype(test<T>(0))::value;
+	};
+
+	/**
+	 * \brief Field number known at compile time.
+	 *
+	 * The generated code passes these to basic_msg_builder instead of plain integers, which writes the field headers as constant bytes.
+	 * \tparam FieldId The field number
+	 */
+	template <uint32_t FieldId> struct field_number {
+		/// The field number
+		static constexpr uint32_t value = FieldId;
+	};
+
+	/**
+	 * \brief Field header (field number and wire_type) known at compile time, with its encoded bytes.
+	 * \tparam FieldId The field number
+	 * \tparam Type The wire type
+	 */
+	template <uint32_t FieldId, wire_type Type> struct field_tag {
+		/// The header value before varint encoding
+		static constexpr uint64_t value = static_cast<uint64_t>(FieldId) << 3 | static_cast<uint64_t>(Type);
+		/// The size of the encoded header in bytes (1 - 5)
+		static constexpr size_t size = value < (1ull << 7) ? 1 : value < (1ull << 14) ? 2 : value < (1ull << 21) ? 3 : value < (1ull << 28) ? 4 : 5;
+
+		/**
+		 * \brief Get a byte of the encoded header.
+		 * \param i The index of the byte (0 - 4)
+		 * \return The encoded byte
+		 */
+		static constexpr uint8_t byte(size_t i) noexcept {
+			return static_cast<uint8_t>(((value >> (7 * i)) & 0x7f) | ((value >> (7 * (i + 1))) != 0 ? 0x80 : 0));
+		}
+	};
+
+	/**
+	 * \brief Check if a singular field without explicit presence holds its default value, which is not encoded.
+	 * \param value The value of the field
+	 * \return true if the value is 0 or false
+	 */
+	template <typename T> constexpr typename std::enable_if<std::is_integral<T>::value, bool>::type is_default(T value) noexcept { return value == 0; }
+	/**
+	 * \brief Check if a double field holds its default value. Like protobuf, only +0.0 is the default while -0.0 is encoded.
+	 * \param value The value of the field
+	 * \return true if all bits of the value are zero
+	 */
+	inline bool is_default(double value) noexcept {
+		uint64_t bits;
+		memcpy(&bits, &value, sizeof(bits));
+		return bits == 0;
+	}
+	/**
+	 * \brief Check if a float field holds its default value. Like protobuf, only +0.0 is the default while -0.0 is encoded.
+	 * \param value The value of the field
+	 * \return true if all bits of the value are zero
+	 */
+	inline bool is_default(float value) noexcept {
+		uint32_t bits;
+		memcpy(&bits, &value, sizeof(bits));
+		return bits == 0;
+	}
+	/**
+	 * \brief Check if a string or bytes field holds its default value.
+	 * \param value The value of the field
+	 * \return true if the string is empty
+	 */
+	inline bool is_default(const std::string& value) noexcept { return value.empty(); }
+	/**
+	 * \brief Check if a string or bytes field holds its default value.
+	 * \param value The value of the field
+	 * \return true if the string is empty
+	 */
+	inline bool is_default(string_view value) noexcept { return value.size() == 0; }
+
+	/**
+	 * \brief Presence bits of the fields with explicit presence (proto3 `optional`) of a generated message.
+	 *
+	 * Fields with explicit presence are only encoded if their bit is set, regardless of their value. Decoding sets the bit of
+	 * every field read. Bits are numbered in declaration order of those fields.
+	 * \tparam N The number of bits
+	 */
+	template <size_t N> class has_bits {
+		uint32_t m_words[(N + 31) / 32]{};
+
+	public:
+		/**
+		 * \brief Check if a field is present.
+		 * \param i The index of the bit
+		 * \return true if the bit is set
+		 */
+		bool test(size_t i) const noexcept { return (m_words[i / 32] >> (i % 32) & 1) != 0; }
+		/**
+		 * \brief Mark a field as present or absent.
+		 * \param i The index of the bit
+		 * \param value The new state of the bit
+		 */
+		void set(size_t i, bool value = true) noexcept {
+			if (value)
+				m_words[i / 32] |= 1u << (i % 32);
+			else
+				m_words[i / 32] &= ~(1u << (i % 32));
+		}
+		/**
+		 * \brief Mark all fields as absent.
+		 */
+		void clear() noexcept {
+			for (auto& w : m_words)
+				w = 0;
+		}
+		/**
+		 * \brief Check if any field is present.
+		 * \return true if at least one bit is set
+		 */
+		bool any() const noexcept {
+			for (auto w : m_words)
+				if (w != 0) return true;
+			return false;
+		}
+	};
+
+	/**
+	 * \brief Instruction sets used for encoding and decoding packed varints.
+	 */
+	enum class simd_level {
+		/// Portable scalar code
+		scalar,
+		/// SSE4.1 (16 bytes per step)
+		sse41,
+		/// AVX2 (32 bytes per step)
+		avx2,
+	};
+
+	/**
+	 * \brief Get the best instruction set supported by the CPU the code is running on.
+	 * \return The detected level, always simd_level::scalar if MINIPB_NO_SIMD is defined or the compiler does not support runtime dispatch
+	 */
+	inline simd_level supported_simd_level() noexcept {
+#if defined(MINIPB_SIMD_DISPATCH)
+		static const simd_level level = [] {
+			__builtin_cpu_init();
+			if (__builtin_cpu_supports("avx2")) return simd_level::avx2;
+			if (__builtin_cpu_supports("sse4.1")) return simd_level::sse41;
+			return simd_level::scalar;
+		}();
+		return level;
+#else
+		return simd_level::scalar;
+#endif
+	}
+
+	/// Storage of the active level, use active_simd_level() and set_simd_level() instead
+	inline std::atomic<simd_level>& simd_level_storage() noexcept {
+		static std::atomic<simd_level> level{supported_simd_level()};
+		return level;
+	}
+
+	/**
+	 * \brief Get the instruction set currently used for packed varints.
+	 * \return The active level, supported_simd_level() unless limited by set_simd_level()
+	 */
+	inline simd_level active_simd_level() noexcept { return simd_level_storage().load(std::memory_order_relaxed); }
+
+	/**
+	 * \brief Limit the instruction set used for packed varints, e.g. to test or benchmark the individual code paths.
+	 * \param level The requested level, levels not supported by the CPU are lowered to supported_simd_level()
+	 */
+	inline void set_simd_level(simd_level level) noexcept {
+		auto supported = supported_simd_level();
+		simd_level_storage().store(static_cast<int>(level) < static_cast<int>(supported) ? level : supported, std::memory_order_relaxed);
+	}
+
+	/**
+	 * \brief Encoder class used to encode fields into a protobuf data stream.
+	 * \note This is a lowlevel class and should only be used if you need full control over
+	 * the emitted data. For normal operation use msg_builder or the generated message classes.
+	 * \tparam TStream The stream type used for output. Using a concrete (final) stream type instead of output_stream
+	 * allows the compiler to inline all stream calls.
+	 */
+	template <typename TStream> class basic_encoder final {
+		TStream& m_stream;
+
+		template <bool Zigzag, typename X> static uint64_t varint_value(X v) noexcept {
+			return Zigzag ? varint_signed_value(static_cast<int64_t>(v)) : static_cast<uint64_t>(v);
+		}
+
+		template <bool Zigzag, typename X> static size_t packed_varint_build_scalar(const X* values, size_t count, uint8_t* buf) noexcept {
+			auto out = buf;
+			for (size_t i = 0; i < count; i++)
+				out += varint_build(varint_value<Zigzag>(values[i]), out);
+			return out - buf;
+		}
+
+#if defined(MINIPB_SIMD_DISPATCH)
+		// Each narrow_* function checks if the next few values are single byte varints and writes them if they are
+		template <bool Zigzag> __attribute__((target("avx2"))) static bool narrow_avx2(const uint32_t* values, uint8_t* out) noexcept {
+			auto v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(values));
+			if (Zigzag) v = _mm256_xor_si256(_mm256_slli_epi32(v, 1), _mm256_srai_epi32(v, 31));
+			if (!_mm256_testz_si256(v, _mm256_set1_epi32(~0x7f))) return false;
+			auto bytes = _mm256_shuffle_epi8(v, _mm256_setr_epi8(0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 0, 4, 8, 12, -1, -1, -1,
+																  -1, -1, -1, -1, -1, -1, -1, -1, -1));
+			auto lo = _mm_cvtsi128_si32(_mm256_castsi256_si128(bytes));
+			auto hi = _mm_cvtsi128_si32(_mm256_extracti128_si256(bytes, 1));
+			memcpy(out, &lo, 4);
+			memcpy(out + 4, &hi, 4);
+			return true;
+		}
+		template <bool Zigzag> __attribute__((target("avx2"))) static bool narrow_avx2(const uint64_t* values, uint8_t* out) noexcept {
+			auto v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(values));
+			if (Zigzag) v = _mm256_xor_si256(_mm256_slli_epi64(v, 1), _mm256_cmpgt_epi64(_mm256_setzero_si256(), v));
+			if (!_mm256_testz_si256(v, _mm256_set1_epi64x(~0x7f))) return false;
+			auto bytes = _mm256_shuffle_epi8(v, _mm256_setr_epi8(0, 8, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 0, 8, -1, -1, -1, -1, -1,
+																  -1, -1, -1, -1, -1, -1, -1, -1, -1));
+			auto lo = static_cast<uint16_t>(_mm_cvtsi128_si32(_mm256_castsi256_si128(bytes)));
+			auto hi = static_cast<uint16_t>(_mm_cvtsi128_si32(_mm256_extracti128_si256(bytes, 1)));
+			memcpy(out, &lo, 2);
+			memcpy(out + 2, &hi, 2);
+			return true;
+		}
+		template <bool Zigzag> __attribute__((target("sse4.1"))) static bool narrow_sse41(const uint32_t* values, uint8_t* out) noexcept {
+			auto v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(values));
+			if (Zigzag) v = _mm_xor_si128(_mm_slli_epi32(v, 1), _mm_srai_epi32(v, 31));
+			if (!_mm_testz_si128(v, _mm_set1_epi32(~0x7f))) return false;
+			auto bytes = _mm_cvtsi128_si32(_mm_shuffle_epi8(v, _mm_setr_epi8(0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1)));
+			memcpy(out, &bytes, 4);
+			return true;
+		}
+		template <bool Zigzag> __attribute__((target("sse4.1"))) static bool narrow_sse41(const uint64_t* values, uint8_t* out) noexcept {
+			auto v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(values));
+			// No 64bit arithmetic shift, the sign is spread from the upper halves instead
+			if (Zigzag) v = _mm_xor_si128(_mm_slli_epi64(v, 1), _mm_shuffle_epi32(_mm_srai_epi32(v, 31), _MM_SHUFFLE(3, 3, 1, 1)));
+			if (!_mm_testz_si128(v, _mm_set1_epi64x(~0x7f))) return false;
+			auto bytes = static_cast<uint16_t>(_mm_cvtsi128_si32(_mm_shuffle_epi8(v, _mm_setr_epi8(0, 8, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1))));
+			memcpy(out, &bytes, 2);
+			return true;
+		}
+
+		template <bool Zigzag, typename X>
+		__attribute__((target("avx2"))) static size_t packed_varint_build_avx2(const X* values, size_t count, uint8_t* buf) noexcept {
+			using raw_type = typename std::conditional<sizeof(X) == 4, uint32_t, uint64_t>::type;
+			constexpr size_t width = 32 / sizeof(X);
+			auto out = buf;
+			size_t i = 0;
+			for (; i + width <= count; i += width) {
+				if (narrow_avx2<Zigzag>(reinterpret_cast<const raw_type*>(values + i), out))
+					out += width;
+				else
+					out += packed_varint_build_scalar<Zigzag>(values + i, width, out);
+			}
+			return (out - buf) + packed_varint_build_scalar<Zigzag>(values + i, count - i, out);
+		}
+
+		template <bool Zigzag, typename X>
+		__attribute__((target("sse4.1"))) static size_t packed_varint_build_sse41(const X* values, size_t count, uint8_t* buf) noexcept {
+			using raw_type = typename std::conditional<sizeof(X) == 4, uint32_t, uint64_t>::type;
+			constexpr size_t width = 16 / sizeof(X);
+			auto out = buf;
+			size_t i = 0;
+			for (; i + width <= count; i += width) {
+				if (narrow_sse41<Zigzag>(reinterpret_cast<const raw_type*>(values + i), out))
+					out += width;
+				else
+					out += packed_varint_build_scalar<Zigzag>(values + i, width, out);
+			}
+			return (out - buf) + packed_varint_build_scalar<Zigzag>(values + i, count - i, out);
+		}
+#endif
+
+	public:
+		/**
+		 * \brief Construct a new encoder using the specified stream for data output.
+		 * \param stream Output stream used for the emitted data.
+		 */
+		basic_encoder(TStream& stream) noexcept : m_stream{stream} {}
+
+		/**
+		 * \brief Get the underlying data stream.
+		 * \return The data stream.
+		 */
+		TStream& stream() const noexcept { return m_stream; }
+
+		/**
+		 * \brief Write an unsigned integer in varint encoding.
+		 * \param val The value to write.
+		 * \return result::ok or the error that occurred.
+		 */
+		result varint(uint64_t val) noexcept {
+			uint8_t buf[10];
+			auto i = varint_build(val, buf);
+			return m_stream.write(buf, i);
+		}
+
+		/**
+		 * \brief Write an signed integer in varint encoding (using zig zag encoding).
+		 * \param val The value to write.
+		 * \return result::ok or the error that occurred.
+		 */
+		result varint_signed(int64_t val) noexcept { return varint(varint_signed_value(val)); }
+
+		/**
+		 * \brief Write a field header to the stream (field id & wire_type).
+		 * \param field_id The field id
+		 * \param type The wiretype of the data
+		 * \return result::ok or the error that occurred.
+		 */
+		result field_header(uint64_t field_id, wire_type type) noexcept { return varint(field_id << 3 | static_cast<uint64_t>(type)); }
+
+		/**
+		 * \brief Write a field header known at compile time, its bytes are constants.
+		 * \param tag The field header
+		 * \return result::ok or the error that occurred.
+		 */
+		template <uint32_t FieldId, wire_type Type> result field_header(field_tag<FieldId, Type> tag) noexcept {
+			(void)tag;
+			using tag_type = field_tag<FieldId, Type>;
+			const uint8_t buf[5] = {tag_type::byte(0), tag_type::byte(1), tag_type::byte(2), tag_type::byte(3), tag_type::byte(4)};
+			return m_stream.write(buf, tag_type::size);
+		}
+
+		/**
+		 * \brief Write a int32_t in fixed32 encoding.
+		 * \param val The value to write.
+		 * \return result::ok or the error that occurred.
+		 */
+		result fixed32(int32_t val) noexcept { return m_stream.write(&val, sizeof(val)); }
+
+		/**
+		 * \brief Write a uint32_t in fixed32 encoding.
+		 * \param val The value to write.
+		 * \return result::ok or the error that occurred.
+		 */
+		result fixed32(uint32_t val) noexcept { return m_stream.write(&val, sizeof(val)); }
+
+		/**
+		 * \brief Write a float in fixed32 encoding.
+		 * \param val The value to write.
+		 * \return result::ok or the error that occurred.
+		 */
+		result fixed32(float val) noexcept { return m_stream.write(&val, sizeof(val)); }
+
+		/**
+		 * \brief Write a int64_t in fixed64 encoding.
+		 * \param val The value to write.
+		 * \return result::ok or the error that occurred.
+		 */
+		result fixed64(int64_t val) noexcept { return m_stream.write(&val, sizeof(val)); }
+
+		/**
+		 * \brief Write a uint64_t in fixed64 encoding.
 		 * \param val The value to write.
 		 * \return result::ok or the error that occurred.
 		 */
@@ -454,65 +1593,1029 @@ namespace minipb {
 		 * \param val The value to write.
 		 * \return result::ok or the error that occurred.
 		 */
-		result fixed64(double val) noexcept { return m_stream.write(&val, sizeof(val)); }
-
+		result fixed64(double val) noexcept { return m_stream.write(&val, sizeof(val)); }
+
+		/**
+		 * \brief Write a fixed number of bytes to the stream.
+		 * \param val Pointer to the raw data about to be written.
+		 * \param len The size of the data to be written in bytes.
+		 * \return result::ok or the error that occurred.
+		 */
+		result fixed(const void* val, size_t len) noexcept { return m_stream.write(val, len); }
+
+		/**
+		 * \brief Write a block of data owned by the caller, which the stream may reference instead of copying.
+		 * \param val Pointer to the data, needs to stay valid until the output has been consumed.
+		 * \param len The size of the data in bytes.
+		 * \return result::ok or the error that occurred.
+		 */
+		result external(const void* val, size_t len) noexcept { return m_stream.write_external(val, len); }
+
+		/**
+		 * \brief Get the size in bytes required to store a varint with the specified value.
+		 * \param v The varint to size
+		 * \return The required space in bytes (1 - 10)
+		 */
+		static size_t varint_size(uint64_t v) noexcept {
+#if defined(__GNUC__)
+			// Branch free: 7 bits per byte, derived from the index of the highest set bit
+			return static_cast<size_t>(9 * (63 - __builtin_clzll(v | 1)) + 73) / 64;
+#else
+			if (v < (1ull << 7)) return 1;
+			if (v < (1ull << 14)) return 2;
+			if (v < (1ull << 21)) return 3;
+			if (v < (1ull << 28)) return 4;
+			if (v < (1ull << 35)) return 5;
+			if (v < (1ull << 42)) return 6;
+			if (v < (1ull << 49)) return 7;
+			if (v < (1ull << 56)) return 8;
+			if (v < (1ull << 63)) return 9;
+			return 10;
+#endif
+		}
+
+		/**
+		 * \brief Get the size in bytes required to store a signed varint (using zig zag encoding).
+		 * \param v The value to size
+		 * \return The required space in bytes (1 - 10)
+		 */
+		static size_t varint_signed_size(int64_t v) noexcept { return varint_size(varint_signed_value(v)); }
+
+		/**
+		 * \brief Get the zig zag encoded representation of a signed value.
+		 * \param v The value to encode
+		 * \return The unsigned value stored as varint
+		 */
+		static uint64_t varint_signed_value(int64_t v) noexcept { return v < 0 ? ~(static_cast<uint64_t>(v) << 1) : static_cast<uint64_t>(v) << 1; }
+
+		/**
+		 * \brief Get the size of the data of a packed varint block (excluding header and length).
+		 * \param value A container type providing the values.
+		 * \return The size in bytes
+		 */
+		template <typename T> static size_t packed_varint_size(const T& value) noexcept {
+			size_t size{0};
+			for (auto e : value)
+				size += varint_size(e);
+			return size;
+		}
+
+		/**
+		 * \brief Get the size of the data of a packed varint block using zig zag encoding (excluding header and length).
+		 * \param value A container type providing the values.
+		 * \return The size in bytes
+		 */
+		template <typename T> static size_t packed_varint_signed_size(const T& value) noexcept {
+			size_t size{0};
+			for (auto e : value)
+				size += varint_signed_size(e);
+			return size;
+		}
+
+		/**
+		 * \brief Serialize the varint into the specified buffer.
+		 * \param val The varint to serialize
+		 * \param buf A buffer large enough to store the encoded varint.
+		 * \return The used space in bytes (1 - 10)
+		 */
+		static size_t varint_build(uint64_t val, uint8_t* buf) noexcept {
+			buf[0] = val & 0x7f;
+			val >>= 7;
+			int i = 1;
+			for (; val != 0; i++) {
+				buf[i - 1] |= 0x80;
+				buf[i] = val & 0x7f;
+				val >>= 7;
+			}
+			return i;
+		}
+
+		/**
+		 * \brief Serialize an array of values as packed varints into the specified buffer.
+		 *
+		 * Runs of values fitting into a single byte are narrowed using AVX2 or SSE4.1, selected at runtime based on the CPU.
+		 * \param values Pointer to the first value (32 or 64bit integers)
+		 * \param count The number of values
+		 * \param buf A buffer large enough to store the encoded varints (packed_varint_size() or 10 bytes per value)
+		 * \tparam Zigzag Encode the values using zig zag encoding
+		 * \return The used space in bytes
+		 */
+		template <bool Zigzag, typename X> static size_t packed_varint_build(const X* values, size_t count, uint8_t* buf) noexcept {
+			static_assert(std::is_integral<X>::value && (sizeof(X) == 4 || sizeof(X) == 8), "Packed varints need 32 or 64bit integers");
+#if defined(MINIPB_SIMD_DISPATCH)
+			// Values are reinterpreted as raw bits, zig zag encoding in SIMD registers is only correct for signed types
+			if (!Zigzag || std::is_signed<X>::value) {
+				auto level = active_simd_level();
+				if (level == simd_level::avx2) return packed_varint_build_avx2<Zigzag>(values, count, buf);
+				if (level == simd_level::sse41) return packed_varint_build_sse41<Zigzag>(values, count, buf);
+			}
+#endif
+			return packed_varint_build_scalar<Zigzag>(values, count, buf);
+		}
+	};
+
+	/// Encoder using virtual dispatch for all stream calls, compatible with every output_stream.
+	using encoder = basic_encoder<output_stream>;
+
+	/**
+	 * \brief How basic_msg_builder encodes submessages.
+	 */
+	enum class message_encoding {
+		/// Length prefixed (the standard encoding), the length is calculated up front or patched using write_at()
+		length_delimited,
+		/// Enclosed in group start/end tags, allowing forward only output without any sizing or patching. Not understood by most other
+		/// protobuf implementations.
+		group,
+	};
+
+	/**
+	 * \brief Helper class for building a message from individual fields
+	 * \tparam TStream The stream type used for output. Using a concrete (final) stream type instead of output_stream
+	 * allows the compiler to inline all stream calls.
+	 */
+	template <typename TStream> class basic_msg_builder final {
+		basic_encoder<TStream> m_encoder;
+		result m_error{result::ok};
+		// Set while encoding the children of a message sized by byte_size(), whose cached sizes are up to date
+		bool m_sizes_cached{false};
+		message_encoding m_message_encoding;
+
+		template <typename T> class has_byte_size {
+			template <typename U> static auto test(int) -> decltype(std::declval<const U&>().byte_size(), std::declval<const U&>().cached_size(), std::true_type{});
+			template <typename U> static std::false_type test(...);
+
+		public:
+			static constexpr bool value = decltype(test<T>(0))::value;
+		};
+
+		template <wire_type Type> result header(int64_t field_id) noexcept { return m_encoder.field_header(field_id, Type); }
+		template <wire_type Type, uint32_t FieldId> result header(field_number<FieldId>) noexcept {
+			return m_encoder.field_header(field_tag<FieldId, Type>{});
+		}
+		template <wire_type Type, typename T> result fixed_field(int64_t field_id, T value) noexcept {
+			if (m_error != result::ok) return m_error;
+			m_error = header<Type>(field_id);
+			if (m_error == result::ok) m_error = m_encoder.stream().write(&value, sizeof(value));
+			return m_error;
+		}
+		// A constant header and the value following it take a single stream write, which keeps conditionally written fields small
+		template <wire_type Type, uint32_t FieldId, typename T> result fixed_field(field_number<FieldId>, T value) noexcept {
+			using tag_type = field_tag<FieldId, Type>;
+			if (m_error != result::ok) return m_error;
+			uint8_t buf[tag_type::size + sizeof(T)];
+			for (size_t i = 0; i < tag_type::size; i++)
+				buf[i] = tag_type::byte(i);
+			memcpy(buf + tag_type::size, &value, sizeof(value));
+			m_error = m_encoder.stream().write(buf, sizeof(buf));
+			return m_error;
+		}
+
+		template <typename T> result delimited_message(const T& msg, std::true_type) noexcept {
+			// The outermost sized message calculates the sizes of its whole subtree, all nested ones use the cached values
+			auto size = m_sizes_cached ? msg.cached_size() : msg.byte_size();
+			m_error = m_encoder.varint(size);
+			if (m_error != result::ok) return m_error;
+			auto pos = m_encoder.stream().position();
+			auto sizes_cached = m_sizes_cached;
+			m_sizes_cached = true;
+			m_error = msg.encode(*this);
+			m_sizes_cached = sizes_cached;
+			if (m_error != result::ok) return m_error;
+			// The message changed after its size was calculated
+			if (m_encoder.stream().position() - pos != size) m_error = result::general_error;
+			return m_error;
+		}
+
+		template <typename T> result delimited_message(const T& msg, std::false_type) noexcept {
+			// This gives us a worst case estimate of the blob size
+			auto size = msg.estimate_size();
+			if (size == 0) size = SIZE_MAX;
+			auto dummy_size = encoder::varint_size(size);
+			uint8_t dummy_varint[10] = {};
+			// note down the current position
+			auto pos = m_encoder.stream().position();
+			// write a dummy varint based on the estimated size
+			m_error = m_encoder.fixed(dummy_varint, dummy_size);
+			if (m_error != result::ok) return m_error;
+			// and hand of encoding to the message type, whose children have no cached sizes
+			auto sizes_cached = m_sizes_cached;
+			m_sizes_cached = false;
+			m_error = msg.encode(*this);
+			m_sizes_cached = sizes_cached;
+			if (m_error != result::ok) return m_error;
+			// after it is done, we calculate the size difference
+			auto real_size = m_encoder.stream().position() - (pos + dummy_size);
+			if (real_size > size) return minipb::result::general_error;
+			// Build our real size and patch it to the dummy size
+			encoder::varint_build(real_size, dummy_varint);
+			for (size_t i = 0; i < dummy_size - 1; i++)
+				dummy_varint[i] |= 0x80;
+			// Patch out our dummy size
+			m_error = m_encoder.stream().write_at(pos, dummy_varint, dummy_size);
+			return m_error;
+		}
+
+		// The values are stored in their wire representation (fixed values use host byte order), write them all at once
+		template <typename TFixed, typename T> result packed_fixed_values(const T& value, std::true_type) noexcept {
+			if (value.size() != 0) m_error = m_encoder.fixed(value.data(), value.size() * sizeof(TFixed));
+			return m_error;
+		}
+
+		template <typename TFixed, typename T> result packed_fixed_values(const T& value, std::false_type) noexcept {
+			for (auto e : value) {
+				TFixed v = e;
+				m_error = m_encoder.fixed(&v, sizeof(v));
+				if (m_error != result::ok) break;
+			}
+			return m_error;
+		}
+
+		// Packed varints are built in chunks on the stack, each chunk is written with a single call
+		static constexpr size_t varint_chunk_size = 64;
+
+		template <bool Zigzag, typename T> result packed_varint_values(const T& value, std::true_type) noexcept {
+			uint8_t buf[varint_chunk_size * 10];
+			auto data = value.data();
+			for (size_t i = 0; i < value.size() && m_error == result::ok; i += varint_chunk_size) {
+				auto count = value.size() - i < varint_chunk_size ? value.size() - i : varint_chunk_size;
+				m_error = m_encoder.fixed(buf, encoder::packed_varint_build<Zigzag>(data + i, count, buf));
+			}
+			return m_error;
+		}
+
+		template <bool Zigzag, typename T> result packed_varint_values(const T& value, std::false_type) noexcept {
+			uint8_t buf[varint_chunk_size * 10];
+			size_t used = 0;
+			for (auto e : value) {
+				if (used > sizeof(buf) - 10) {
+					m_error = m_encoder.fixed(buf, used);
+					if (m_error != result::ok) return m_error;
+					used = 0;
+				}
+				if (Zigzag)
+					used += encoder::varint_build(encoder::varint_signed_value(e), buf + used);
+				else
+					used += encoder::varint_build(e, buf + used);
+			}
+			if (used != 0) m_error = m_encoder.fixed(buf, used);
+			return m_error;
+		}
+
+	public:
+		/**
+		 * \brief Construct a new message builder for the specified output stream.
+		 * \param stream The output stream to use
+		 * \param encoding How submessages are encoded. message_encoding::group never calls write_at() and needs no size calculation.
+		 */
+		basic_msg_builder(TStream& stream, message_encoding encoding = message_encoding::length_delimited)
+			: m_encoder{stream}, m_message_encoding{encoding} {}
+
+		/**
+		 * \brief Emit a double field to the stream.
+		 * \param field_id The id of the field, a field_number writes the header as constant bytes.
+		 * \param value The value of the field.
+		 * \return A value of result if the operation succeeded.
+		 */
+		template <typename TId> result double_field(TId field_id, double value) noexcept {
+			return fixed_field<wire_type::fixed64>(field_id, value);
+		}
+		/**
+		 * \brief Emit a float field to the stream.
+		 * \param field_id The id of the field, a field_number writes the header as constant bytes.
+		 * \param value The value of the field.
+		 * \return A value of result if the operation succeeded.
+		 */
+		template <typename TId> result float_field(TId field_id, float value) noexcept {
+			return fixed_field<wire_type::fixed32>(field_id, value);
+		}
+		/**
+		 * \brief Emit a int32 field to the stream.
+		 * \param field_id The id of the field, a field_number writes the header as constant bytes.
+		 * \param value The value of the field.
+		 * \return A value of result if the operation succeeded.
+		 */
+		template <typename TId> result int32_field(TId field_id, int32_t value) noexcept {
+			if (m_error != result::ok) return m_error;
+			m_error = header<wire_type::varint>(field_id);
+			if (m_error == result::ok) m_error = m_encoder.varint(static_cast<uint32_t>(value));
+			return m_error;
+		}
+		/**
+		 * \brief Emit a int64 field to the stream.
+		 * \param field_id The id of the field, a field_number writes the header as constant bytes.
+		 * \param value The value of the field.
+		 * \return A value of result if the operation succeeded.
+		 */
+		template <typename TId> result int64_field(TId field_id, int64_t value) noexcept {
+			if (m_error != result::ok) return m_error;
+			m_error = header<wire_type::varint>(field_id);
+			if (m_error == result::ok) m_error = m_encoder.varint(static_cast<uint64_t>(value));
+			return m_error;
+		}
+		/**
+		 * \brief Emit a unsigend int32 field to the stream.
+		 * \param field_id The id of the field, a field_number writes the header as constant bytes.
+		 * \param value The value of the field.
+		 * \return A value of result if the operation succeeded.
+		 */
+		template <typename TId> result uint32_field(TId field_id, uint32_t value) noexcept {
+			if (m_error != result::ok) return m_error;
+			m_error = header<wire_type::varint>(field_id);
+			if (m_error == result::ok) m_error = m_encoder.varint(value);
+			return m_error;
+		}
+		/**
+		 * \brief Emit a unsigend int64 field to the stream.
+		 * \param field_id The id of the field, a field_number writes the header as constant bytes.
+		 * \param value The value of the field.
+		 * \return A value of result if the operation succeeded.
+		 */
+		template <typename TId> result uint64_field(TId field_id, uint64_t value) noexcept {
+			if (m_error != result::ok) return m_error;
+			m_error = header<wire_type::varint>(field_id);
+			if (m_error == result::ok) m_error = m_encoder.varint(value);
+			return m_error;
+		}
+		/**
+		 * \brief Emit a signed int32 field to the stream.
+		 * \param field_id The id of the field, a field_number writes the header as constant bytes.
+		 * \param value The value of the field.
+		 * \return A value of result if the operation succeeded.
+		 */
+		template <typename TId> result sint32_field(TId field_id, int32_t value) noexcept {
+			if (m_error != result::ok) return m_error;
+			m_error = header<wire_type::varint>(field_id);
+			if (m_error == result::ok) m_error = m_encoder.varint_signed(value);
+			return m_error;
+		}
+		/**
+		 * \brief Emit a signed int64 field to the stream.
+		 * \param field_id The id of the field, a field_number writes the header as constant bytes.
+		 * \param value The value of the field.
+		 * \return A value of result if the operation succeeded.
+		 */
+		template <typename TId> result sint64_field(TId field_id, int64_t value) noexcept {
+			if (m_error != result::ok) return m_error;
+			m_error = header<wire_type::varint>(field_id);
+			if (m_error == result::ok) m_error = m_encoder.varint_signed(value);
+			return m_error;
+		}
+		/**
+		 * \brief Emit a fixed int32 field to the stream.
+		 * \param field_id The id of the field, a field_number writes the header as constant bytes.
+		 * \param value The value of the field.
+		 * \return A value of result if the operation succeeded.
+		 */
+		template <typename TId> result fixed32_field(TId field_id, uint32_t value) noexcept {
+			return fixed_field<wire_type::fixed32>(field_id, value);
+		}
+		/**
+		 * \brief Emit a fixed int64 field to the stream.
+		 * \param field_id The id of the field, a field_number writes the header as constant bytes.
+		 * \param value The value of the field.
+		 * \return A value of result if the operation succeeded.
+		 */
+		template <typename TId> result fixed64_field(TId field_id, uint64_t value) noexcept {
+			return fixed_field<wire_type::fixed64>(field_id, value);
+		}
+		/**
+		 * \brief Emit a signed fixed int32 field to the stream.
+		 * \param field_id The id of the field, a field_number writes the header as constant bytes.
+		 * \param value The value of the field.
+		 * \return A value of result if the operation succeeded.
+		 */
+		template <typename TId> result sfixed32_field(TId field_id, int32_t value) noexcept {
+			return fixed_field<wire_type::fixed32>(field_id, value);
+		}
+		/**
+		 * \brief Emit a signed fixed int64 field to the stream.
+		 * \param field_id The id of the field, a field_number writes the header as constant bytes.
+		 * \param value The value of the field.
+		 * \return A value of result if the operation succeeded.
+		 */
+		template <typename TId> result sfixed64_field(TId field_id, int64_t value) noexcept {
+			return fixed_field<wire_type::fixed64>(field_id, value);
+		}
+		/**
+		 * \brief Emit a bool field to the stream.
+		 * \param field_id The id of the field, a field_number writes the header as constant bytes.
+		 * \param value The value of the field.
+		 * \return A value of result if the operation succeeded.
+		 */
+		template <typename TId> result bool_field(TId field_id, bool value) noexcept {
+			if (m_error != result::ok) return m_error;
+			m_error = header<wire_type::varint>(field_id);
+			if (m_error == result::ok) m_error = m_encoder.varint(value ? 1 : 0);
+			return m_error;
+		}
+		/**
+		 * \brief Emit a string/bytes field to the stream.
+		 *
+		 * The value is passed to output_stream::write_external(), streams supporting it reference it instead of copying it.
+		 * \param field_id The id of the field, a field_number writes the header as constant bytes.
+		 * \param value The value of the field.
+		 * \param len The length of value in bytes.
+		 * \return A value of result if the operation succeeded.
+		 */
+		template <typename TId> result string_field(TId field_id, const void* value, size_t len) noexcept {
+			if (m_error != result::ok) return m_error;
+			m_error = header<wire_type::length_blob>(field_id);
+			if (m_error == result::ok) m_error = m_encoder.varint(len);
+			if (m_error == result::ok && len != 0) m_error = m_encoder.external(value, len);
+			return m_error;
+		}
+		/**
+		 * \brief Emit a string/bytes field to the stream.
+		 * \param field_id The id of the field, a field_number writes the header as constant bytes.
+		 * \param value The value of the field.
+		 * \return A value of result if the operation succeeded.
+		 */
+		template <typename TId> result string_field(TId field_id, const std::string& value) noexcept {
+			if (m_error != result::ok) return m_error;
+			m_error = string_field(field_id, value.c_str(), value.size());
+			return m_error;
+		}
+		/**
+		 * \brief Emit a string/bytes field to the stream.
+		 * \param field_id The id of the field, a field_number writes the header as constant bytes.
+		 * \param value The value of the field.
+		 * \return A value of result if the operation succeeded.
+		 */
+		template <typename TId> result string_field(TId field_id, string_view value) noexcept {
+			if (m_error != result::ok) return m_error;
+			m_error = string_field(field_id, value.data(), value.size());
+			return m_error;
+		}
+
+		/**
+		 * \brief Emit a message field to the stream.
+		 * \param field_id The id of the field, a field_number writes the header as constant bytes.
+		 * \param msg The message to emit.
+		 * \tparam T The message type to accept.
+		 * \return A value of result if the operation succeeded.
+		 * \note This function is designed to work in conjunction with the code generated by the generator,
+		 * however it can also be used with custom classes that follow the same interface. At the very minimum it
+		 * needs an `size_t estimate_size()` function returning an upper bound of the encoded size or 0 if it is unknown
+		 * or expensive to calculate, as well as an `result encode(basic_msg_builder<TStream>&)` function that serializes the message into
+		 * the provided builder. If the message additionally provides `size_t byte_size()` (returning the exact size and caching it
+		 * as well as the sizes of all submessages) and `size_t cached_size()`, the exact length is written up front instead of
+		 * patching an estimated length field after encoding. With message_encoding::group the message is enclosed in group tags
+		 * instead and neither size function is used.
+		 */
+		template <typename TId, typename T> result message_field(TId field_id, const T& msg) noexcept {
+			if (m_error != result::ok) return m_error;
+			if (m_message_encoding == message_encoding::group) {
+				m_error = header<wire_type::group_start>(field_id);
+				if (m_error == result::ok) m_error = msg.encode(*this);
+				if (m_error == result::ok) m_error = header<wire_type::group_end>(field_id);
+				return m_error;
+			}
+			m_error = header<wire_type::length_blob>(field_id);
+			if (m_error != result::ok) return m_error;
+			return delimited_message(msg, std::integral_constant<bool, has_byte_size<T>::value>{});
+		}
+
+		/**
+		 * \brief Emit a message prefixed by its length as varint, without a field header.
+		 *
+		 * This is the framing used by streams of length delimited records (see record_writer). The length prefix is always written,
+		 * the message_encoding of the builder only applies to submessages.
+		 * \param msg The message to emit.
+		 * \tparam T The message type to accept, see message_field() for the requirements.
+		 * \return A value of result if the operation succeeded.
+		 */
+		template <typename T> result delimited_message(const T& msg) noexcept {
+			if (m_error != result::ok) return m_error;
+			return delimited_message(msg, std::integral_constant<bool, has_byte_size<T>::value>{});
+		}
+
+		/**
+		 * \brief Emit a block of packed 64bit values (double, int64_t or uint64_t).
+		 *
+		 * The function is compatible with any container type that is range iterable
+		 * (i.e. provides `begin()` and `end()`) and has a `size()` function returning the number
+		 * of elements in the container. This is true for all stl containers except maps.
+		 * \param field_id The id of the field, a field_number writes the header as constant bytes.
+		 * \param value A container type providing the values.
+		 * \return A value of result if the operation succeeded.
+		 */
+		template <typename TId, typename T> result packed_fixed64_field(TId field_id, const T& value) noexcept {
+			if (m_error != result::ok) return m_error;
+			m_error = header<wire_type::length_blob>(field_id);
+			if (m_error == result::ok) m_error = m_encoder.varint(value.size() * 8);
+			if (m_error != result::ok) return m_error;
+			using element_type = typename std::decay<decltype(*value.begin())>::type;
+			using fixed_type = typename std::conditional<std::is_floating_point<element_type>::value, double, uint64_t>::type;
+			return packed_fixed_values<fixed_type>(value, std::integral_constant<bool, has_fixed_storage<T, 8>::value>{});
+		}
+
+		/**
+		 * \brief Emit a block of packed 32bit values (float, int32_t or uint32_t).
+		 *
+		 * The function is compatible with any container type that is range iterable
+		 * (i.e. provides `begin()` and `end()`) and has a `size()` function returning the number
+		 * of elements in the container. This is true for all stl containers except maps.
+		 * \param field_id The id of the field, a field_number writes the header as constant bytes.
+		 * \param value A container type providing the values.
+		 * \return A value of result if the operation succeeded.
+		 */
+		template <typename TId, typename T> result packed_fixed32_field(TId field_id, const T& value) noexcept {
+			if (m_error != result::ok) return m_error;
+			m_error = header<wire_type::length_blob>(field_id);
+			if (m_error == result::ok) m_error = m_encoder.varint(value.size() * 4);
+			if (m_error != result::ok) return m_error;
+			using element_type = typename std::decay<decltype(*value.begin())>::type;
+			using fixed_type = typename std::conditional<std::is_floating_point<element_type>::value, float, uint32_t>::type;
+			return packed_fixed_values<fixed_type>(value, std::integral_constant<bool, has_fixed_storage<T, 4>::value>{});
+		}
+
+		/**
+		 * \brief Emit a block of packed varint values.
+		 *
+		 * The function is compatible with any container type that is range iterable
+		 * (i.e. provides `begin()` and `end()`) and has a `size()` function returning the number
+		 * of elements in the container. This is true for all stl containers except maps.
+		 * \param field_id The id of the field, a field_number writes the header as constant bytes.
+		 * \param value A container type providing the values.
+		 * \return A value of result if the operation succeeded.
+		 */
+		template <typename TId, typename T> result packed_varint_field(TId field_id, const T& value) noexcept {
+			if (m_error != result::ok) return m_error;
+			m_error = header<wire_type::length_blob>(field_id);
+			if (m_error == result::ok) m_error = m_encoder.varint(encoder::packed_varint_size(value));
+			if (m_error != result::ok) return m_error;
+			return packed_varint_values<false>(value, std::integral_constant<bool, has_varint_storage<T>::value>{});
+		}
+
+		/**
+		 * \brief Emit a block of packed varint values using zig zag encoding.
+		 *
+		 * The function is compatible with any container type that is range iterable
+		 * (i.e. provides `begin()` and `end()`) and has a `size()` function returning the number
+		 * of elements in the container. This is true for all stl containers except maps.
+		 * \param field_id The id of the field, a field_number writes the header as constant bytes.
+		 * \param value A container type providing the values.
+		 * \return A value of result if the operation succeeded.
+		 */
+		template <typename TId, typename T> result packed_varint_signed_field(TId field_id, const T& value) noexcept {
+			if (m_error != result::ok) return m_error;
+			m_error = header<wire_type::length_blob>(field_id);
+			if (m_error == result::ok) m_error = m_encoder.varint(encoder::packed_varint_signed_size(value));
+			if (m_error != result::ok) return m_error;
+			return packed_varint_values<true>(value, std::integral_constant<bool, has_varint_storage<T>::value>{});
+		}
+
+		/**
+		 * \brief Return the last error produced
+		 * \return The last error produced or result::ok if none occurred
+		 */
+		result last_error() const noexcept { return m_error; }
+	};
+
+	/// Message builder using virtual dispatch for all stream calls, compatible with every output_stream.
+	using msg_builder = basic_msg_builder<output_stream>;
+
+	/**
+	 * \brief Message builder writing through a raw pointer into memory known to be large enough, without any bounds or error checks.
+	 *
+	 * No write can fail, so fields are written directly without the error state and stream calls of basic_msg_builder. The caller needs
+	 * to provide at least `estimate_size()` bytes for the message. Submessages are prefixed by their exact length, using `byte_size()`
+	 * for the outermost one and the cached sizes for the ones nested inside. The output is the same as produced by basic_msg_builder.
+	 * Use it with the `encode_unchecked()` function of generated messages or minipb::encode_unchecked().
+	 */
+	class unchecked_msg_builder final {
+		uint8_t* m_start;
+		uint8_t* m_current;
+		// Set while encoding the children of a message sized by byte_size(), whose cached sizes are up to date
+		bool m_sizes_cached{false};
+
+		// All writes go through a local pointer, byte stores could otherwise alias m_current and force a reload after each one
+		// Kept small enough to be inlined at every field, also when the fields are written conditionally
+		static uint8_t* varint(uint8_t* out, uint64_t val) noexcept {
+			for (; val >= 0x80; val >>= 7)
+				*out++ = static_cast<uint8_t>(val | 0x80);
+			*out++ = static_cast<uint8_t>(val);
+			return out;
+		}
+		template <typename T> static uint8_t* fixed(uint8_t* out, T value) noexcept {
+			memcpy(out, &value, sizeof(value));
+			return out + sizeof(value);
+		}
+		template <wire_type Type> static uint8_t* header(uint8_t* out, int64_t field_id) noexcept {
+			return varint(out, static_cast<uint64_t>(field_id) << 3 | static_cast<uint64_t>(Type));
+		}
+		template <wire_type Type, uint32_t FieldId> static uint8_t* header(uint8_t* out, field_number<FieldId>) noexcept {
+			using tag_type = field_tag<FieldId, Type>;
+			for (size_t i = 0; i < tag_type::size; i++)
+				out[i] = tag_type::byte(i);
+			return out + tag_type::size;
+		}
+		template <typename TId> result varint_field(TId field_id, uint64_t value) noexcept {
+			m_current = varint(header<wire_type::varint>(m_current, field_id), value);
+			return result::ok;
+		}
+		template <wire_type Type, typename TId, typename T> result fixed_field(TId field_id, T value) noexcept {
+			m_current = fixed(header<Type>(m_current, field_id), value);
+			return result::ok;
+		}
+
+		template <typename TFixed, typename T> uint8_t* packed_fixed_values(uint8_t* out, const T& value, std::true_type) noexcept {
+			if (value.size() != 0) memcpy(out, value.data(), value.size() * sizeof(TFixed));
+			return out + value.size() * sizeof(TFixed);
+		}
+		template <typename TFixed, typename T> uint8_t* packed_fixed_values(uint8_t* out, const T& value, std::false_type) noexcept {
+			for (auto e : value)
+				out = fixed<TFixed>(out, e);
+			return out;
+		}
+		template <bool Zigzag, typename T> uint8_t* packed_varint_values(uint8_t* out, const T& value, std::true_type) noexcept {
+			return out + encoder::packed_varint_build<Zigzag>(value.data(), value.size(), out);
+		}
+		template <bool Zigzag, typename T> uint8_t* packed_varint_values(uint8_t* out, const T& value, std::false_type) noexcept {
+			for (auto e : value)
+				out = varint(out, Zigzag ? encoder::varint_signed_value(e) : static_cast<uint64_t>(e));
+			return out;
+		}
+
+	public:
+		/**
+		 * \brief Construct a new builder.
+		 * \param out The memory to write to, at least `estimate_size()` bytes of the encoded message.
+		 */
+		explicit unchecked_msg_builder(uint8_t* out) noexcept : m_start{out}, m_current{out} {}
+		unchecked_msg_builder(const unchecked_msg_builder&) = delete;
+		unchecked_msg_builder& operator=(const unchecked_msg_builder&) = delete;
+
+		/**
+		 * \brief Get the end of the data written so far.
+		 * \return Pointer after the last byte written
+		 */
+		uint8_t* data() const noexcept { return m_current; }
+		/**
+		 * \brief Get the number of bytes written so far.
+		 * \return The number of bytes
+		 */
+		size_t size() const noexcept { return m_current - m_start; }
+
+		/**
+		 * \brief Emit a double field.
+		 * \param field_id The id of the field, a field_number writes the header as constant bytes.
+		 * \param value The value of the field.
+		 * \return Always result::ok
+		 */
+		template <typename TId> result double_field(TId field_id, double value) noexcept { return fixed_field<wire_type::fixed64>(field_id, value); }
+		/**
+		 * \brief Emit a float field.
+		 * \param field_id The id of the field, a field_number writes the header as constant bytes.
+		 * \param value The value of the field.
+		 * \return Always result::ok
+		 */
+		template <typename TId> result float_field(TId field_id, float value) noexcept { return fixed_field<wire_type::fixed32>(field_id, value); }
+		/**
+		 * \brief Emit a int32 field.
+		 * \param field_id The id of the field, a field_number writes the header as constant bytes.
+		 * \param value The value of the field.
+		 * \return Always result::ok
+		 */
+		template <typename TId> result int32_field(TId field_id, int32_t value) noexcept { return varint_field(field_id, static_cast<uint32_t>(value)); }
+		/**
+		 * \brief Emit a int64 field.
+		 * \param field_id The id of the field, a field_number writes the header as constant bytes.
+		 * \param value The value of the field.
+		 * \return Always result::ok
+		 */
+		template <typename TId> result int64_field(TId field_id, int64_t value) noexcept { return varint_field(field_id, static_cast<uint64_t>(value)); }
+		/**
+		 * \brief Emit a unsigend int32 field.
+		 * \param field_id The id of the field, a field_number writes the header as constant bytes.
+		 * \param value The value of the field.
+		 * \return Always result::ok
+		 */
+		template <typename TId> result uint32_field(TId field_id, uint32_t value) noexcept { return varint_field(field_id, value); }
+		/**
+		 * \brief Emit a unsigend int64 field.
+		 * \param field_id The id of the field, a field_number writes the header as constant bytes.
+		 * \param value The value of the field.
+		 * \return Always result::ok
+		 */
+		template <typename TId> result uint64_field(TId field_id, uint64_t value) noexcept { return varint_field(field_id, value); }
+		/**
+		 * \brief Emit a signed int32 field.
+		 * \param field_id The id of the field, a field_number writes the header as constant bytes.
+		 * \param value The value of the field.
+		 * \return Always result::ok
+		 */
+		template <typename TId> result sint32_field(TId field_id, int32_t value) noexcept { return varint_field(field_id, encoder::varint_signed_value(value)); }
+		/**
+		 * \brief Emit a signed int64 field.
+		 * \param field_id The id of the field, a field_number writes the header as constant bytes.
+		 * \param value The value of the field.
+		 * \return Always result::ok
+		 */
+		template <typename TId> result sint64_field(TId field_id, int64_t value) noexcept { return varint_field(field_id, encoder::varint_signed_value(value)); }
+		/**
+		 * \brief Emit a fixed int32 field.
+		 * \param field_id The id of the field, a field_number writes the header as constant bytes.
+		 * \param value The value of the field.
+		 * \return Always result::ok
+		 */
+		template <typename TId> result fixed32_field(TId field_id, uint32_t value) noexcept { return fixed_field<wire_type::fixed32>(field_id, value); }
+		/**
+		 * \brief Emit a fixed int64 field.
+		 * \param field_id The id of the field, a field_number writes the header as constant bytes.
+		 * \param value The value of the field.
+		 * \return Always result::ok
+		 */
+		template <typename TId> result fixed64_field(TId field_id, uint64_t value) noexcept { return fixed_field<wire_type::fixed64>(field_id, value); }
+		/**
+		 * \brief Emit a signed fixed int32 field.
+		 * \param field_id The id of the field, a field_number writes the header as constant bytes.
+		 * \param value The value of the field.
+		 * \return Always result::ok
+		 */
+		template <typename TId> result sfixed32_field(TId field_id, int32_t value) noexcept { return fixed_field<wire_type::fixed32>(field_id, value); }
+		/**
+		 * \brief Emit a signed fixed int64 field.
+		 * \param field_id The id of the field, a field_number writes the header as constant bytes.
+		 * \param value The value of the field.
+		 * \return Always result::ok
+		 */
+		template <typename TId> result sfixed64_field(TId field_id, int64_t value) noexcept { return fixed_field<wire_type::fixed64>(field_id, value); }
+		/**
+		 * \brief Emit a bool field.
+		 * \param field_id The id of the field, a field_number writes the header as constant bytes.
+		 * \param value The value of the field.
+		 * \return Always result::ok
+		 */
+		template <typename TId> result bool_field(TId field_id, bool value) noexcept { return varint_field(field_id, value ? 1 : 0); }
+		/**
+		 * \brief Emit a string/bytes field.
+		 * \param field_id The id of the field, a field_number writes the header as constant bytes.
+		 * \param value The value of the field.
+		 * \param len The length of value in bytes.
+		 * \return Always result::ok
+		 */
+		template <typename TId> result string_field(TId field_id, const void* value, size_t len) noexcept {
+			auto out = varint(header<wire_type::length_blob>(m_current, field_id), len);
+			if (len != 0) memcpy(out, value, len);
+			m_current = out + len;
+			return result::ok;
+		}
+		/**
+		 * \brief Emit a string/bytes field.
+		 * \param field_id The id of the field, a field_number writes the header as constant bytes.
+		 * \param value The value of the field.
+		 * \return Always result::ok
+		 */
+		template <typename TId> result string_field(TId field_id, const std::string& value) noexcept {
+			return string_field(field_id, value.data(), value.size());
+		}
+		/**
+		 * \brief Emit a string/bytes field.
+		 * \param field_id The id of the field, a field_number writes the header as constant bytes.
+		 * \param value The value of the field.
+		 * \return Always result::ok
+		 */
+		template <typename TId> result string_field(TId field_id, string_view value) noexcept { return string_field(field_id, value.data(), value.size()); }
+
+		/**
+		 * \brief Emit a message field.
+		 * \param field_id The id of the field, a field_number writes the header as constant bytes.
+		 * \param msg The message to emit.
+		 * \tparam T The message type to accept, needs to provide `size_t byte_size()`, `size_t cached_size()` and
+		 * `result encode(unchecked_msg_builder&)` like the generated messages.
+		 * \return The result of encoding the message
+		 */
+		template <typename TId, typename T> result message_field(TId field_id, const T& msg) noexcept {
+			// The outermost message calculates the sizes of its whole subtree, all nested ones use the cached values
+			auto size = m_sizes_cached ? msg.cached_size() : msg.byte_size();
+			m_current = varint(header<wire_type::length_blob>(m_current, field_id), size);
+			auto sizes_cached = m_sizes_cached;
+			m_sizes_cached = true;
+			auto res = msg.encode(*this);
+			m_sizes_cached = sizes_cached;
+			return res;
+		}
+
+		/**
+		 * \brief Emit a block of packed 64bit values (double, int64_t or uint64_t).
+		 * \param field_id The id of the field, a field_number writes the header as constant bytes.
+		 * \param value A container type providing the values.
+		 * \return Always result::ok
+		 */
+		template <typename TId, typename T> result packed_fixed64_field(TId field_id, const T& value) noexcept {
+			using element_type = typename std::decay<decltype(*value.begin())>::type;
+			using fixed_type = typename std::conditional<std::is_floating_point<element_type>::value, double, uint64_t>::type;
+			auto out = varint(header<wire_type::length_blob>(m_current, field_id), value.size() * 8);
+			m_current = packed_fixed_values<fixed_type>(out, value, std::integral_constant<bool, has_fixed_storage<T, 8>::value>{});
+			return result::ok;
+		}
+		/**
+		 * \brief Emit a block of packed 32bit values (float, int32_t or uint32_t).
+		 * \param field_id The id of the field, a field_number writes the header as constant bytes.
+		 * \param value A container type providing the values.
+		 * \return Always result::ok
+		 */
+		template <typename TId, typename T> result packed_fixed32_field(TId field_id, const T& value) noexcept {
+			using element_type = typename std::decay<decltype(*value.begin())>::type;
+			using fixed_type = typename std::conditional<std::is_floating_point<element_type>::value, float, uint32_t>::type;
+			auto out = varint(header<wire_type::length_blob>(m_current, field_id), value.size() * 4);
+			m_current = packed_fixed_values<fixed_type>(out, value, std::integral_constant<bool, has_fixed_storage<T, 4>::value>{});
+			return result::ok;
+		}
 		/**
-		 * \brief Write a fixed number of bytes to the stream.
-		 * \param val Pointer to the raw data about to be written.
-		 * \param len The size of the data to be written in bytes.
-		 * \return result::ok or the error that occurred.
+		 * \brief Emit a block of packed varint values.
+		 * \param field_id The id of the field, a field_number writes the header as constant bytes.
+		 * \param value A container type providing the values.
+		 * \return Always result::ok
 		 */
-		result fixed(const void* val, size_t len) noexcept { return m_stream.write(val, len); }
-
+		template <typename TId, typename T> result packed_varint_field(TId field_id, const T& value) noexcept {
+			auto out = varint(header<wire_type::length_blob>(m_current, field_id), encoder::packed_varint_size(value));
+			m_current = packed_varint_values<false>(out, value, std::integral_constant<bool, has_varint_storage<T>::value>{});
+			return result::ok;
+		}
 		/**
-		 * \brief Get the size in bytes required to store a varint with the specified value.
-		 * \param v The varint to size
-		 * \return The required space in bytes (1 - 10)
+		 * \brief Emit a block of packed varint values using zig zag encoding.
+		 * \param field_id The id of the field, a field_number writes the header as constant bytes.
+		 * \param value A container type providing the values.
+		 * \return Always result::ok
 		 */
-		static size_t varint_size(uint64_t v) noexcept {
-			if (v < (1 << 8)) return 1;
-			if (v < (1 << 15)) return 2;
-			if (v < (1 << 22)) return 3;
-			if (v < (1 << 29)) return 4;
-			if (v < (1l << 36)) return 5;
-			if (v < (1l << 43)) return 7;
-			if (v < (1l << 50)) return 8;
-			if (v < (1l << 57)) return 9;
-			return 10;
+		template <typename TId, typename T> result packed_varint_signed_field(TId field_id, const T& value) noexcept {
+			auto out = varint(header<wire_type::length_blob>(m_current, field_id), encoder::packed_varint_signed_size(value));
+			m_current = packed_varint_values<true>(out, value, std::integral_constant<bool, has_varint_storage<T>::value>{});
+			return result::ok;
 		}
 
 		/**
-		 * \brief Serialize the varint into the specified buffer.
-		 * \param val The varint to serialize
-		 * \param buf A buffer large enough to store the encoded varint.
-		 * \return The used space in bytes (1 - 10)
+		 * \brief Return the last error produced, writes never fail.
+		 * \return Always result::ok
 		 */
-		static size_t varint_build(int64_t val, uint8_t* buf) noexcept {
-			buf[0] = val & 0x7f;
-			val >>= 7;
-			int i = 1;
-			for (; val != 0; i++) {
-				buf[i - 1] |= 0x80;
-				buf[i] = val & 0x7f;
-				val >>= 7;
-			}
-			return i;
-		}
+		result last_error() const noexcept { return result::ok; }
 	};
 
 	/**
-	 * \brief Helper class for building a message from individual fields
+	 * \brief Encode a message by reserving its estimated size on the stream once and writing it without any bounds or error checks.
+	 *
+	 * The estimate is an upper bound of the encoded size, the bytes not used are returned to the stream. If the stream can not provide
+	 * contiguous memory (see output_stream::reserve()) the message is encoded using basic_msg_builder instead.
+	 * \param stream The stream to write the message to.
+	 * \param msg The message to encode, needs to provide `estimate_size()`, `encode(basic_msg_builder<TStream>&)` and
+	 * `uint8_t* encode_unchecked(uint8_t*)` like the generated messages. It must not be modified concurrently.
+	 * \tparam TStream The stream type used for output.
+	 * \return A value of result if the operation succeeded.
+	 */
+	template <typename TStream, typename T> result encode_unchecked(TStream& stream, const T& msg) noexcept {
+		auto size = msg.estimate_size();
+		auto out = stream.reserve(size);
+		if (out == nullptr) {
+			basic_msg_builder<TStream> b{stream};
+			return msg.encode(b);
+		}
+		stream.commit(static_cast<size_t>(msg.encode_unchecked(out) - out));
+		return result::ok;
+	}
+
+	/**
+	 * \brief Message builder serializing fields back to front into a buffer growing downward.
+	 *
+	 * Fields are emitted in reverse order (last field first, repeated elements last to first). Since a submessage is completely
+	 * written before its length prefix, every length is known exactly at the time it is written. This produces the same canonical
+	 * encoding as msg_builder in a single pass, without size calculations and without patching data using write_at.
+	 * Use it with the `encode_reverse()` function of generated messages. The result is available using data() and size().
 	 */
-	class msg_builder final {
-		encoder m_encoder;
+	class reverse_msg_builder final {
+		uint8_t* m_begin{nullptr};
+		uint8_t* m_end{nullptr};
+		uint8_t* m_current{nullptr};
 		result m_error{result::ok};
 
+		bool reserve(size_t n) noexcept {
+			if (static_cast<size_t>(m_current - m_begin) >= n) return true;
+			auto used = size();
+			auto capacity = static_cast<size_t>(m_end - m_begin) * 2;
+			if (capacity < used + n) capacity = used + n;
+			if (capacity < 256) capacity = 256;
+			auto mem = static_cast<uint8_t*>(::operator new(capacity, std::nothrow));
+			if (mem == nullptr) {
+				m_error = result::out_of_memory;
+				return false;
+			}
+			// The data lives at the end of the buffer
+			if (used != 0) memcpy(mem + capacity - used, m_current, used);
+			::operator delete(m_begin);
+			m_begin = mem;
+			m_end = mem + capacity;
+			m_current = m_end - used;
+			return true;
+		}
+
+		void raw(const void* data, size_t len) noexcept {
+			if (!reserve(len)) return;
+			m_current -= len;
+			memcpy(m_current, data, len);
+		}
+
+		void varint(uint64_t val) noexcept {
+			if (!reserve(10)) return;
+			auto len = encoder::varint_size(val);
+			m_current -= len;
+			encoder::varint_build(val, m_current);
+		}
+
+		void varint_signed(int64_t val) noexcept {
+			if (val < 0)
+				varint(~(static_cast<uint64_t>(val) << 1));
+			else
+				varint(static_cast<uint64_t>(val) << 1);
+		}
+
+		void field_header(int64_t field_id, wire_type type) noexcept { varint(static_cast<uint64_t>(field_id) << 3 | static_cast<uint64_t>(type)); }
+
+		template <typename T> void fixed_field(int64_t field_id, wire_type type, T value) noexcept {
+			raw(&value, sizeof(value));
+			if (m_error == result::ok) field_header(field_id, type);
+		}
+
+		void varint_field(int64_t field_id, uint64_t value) noexcept {
+			varint(value);
+			if (m_error == result::ok) field_header(field_id, wire_type::varint);
+		}
+
+		void blob_header(int64_t field_id, size_t len) noexcept {
+			varint(len);
+			if (m_error == result::ok) field_header(field_id, wire_type::length_blob);
+		}
+
+		template <typename TElement, typename T> result packed_fixed_field(int64_t field_id, const T& value) noexcept {
+			if (m_error != result::ok) return m_error;
+			if (!reserve(value.size() * sizeof(TElement))) return m_error;
+			packed_fixed_values<TElement>(value, std::integral_constant<bool, has_fixed_storage<T, sizeof(TElement)>::value>{});
+			blob_header(field_id, value.size() * sizeof(TElement));
+			return m_error;
+		}
+
+		// Contiguous values are sized first and then encoded front to back in bulk
+		template <bool Zigzag, typename T> void packed_varint_values(const T& value, std::true_type) noexcept {
+			auto len = Zigzag ? encoder::packed_varint_signed_size(value) : encoder::packed_varint_size(value);
+			if (!reserve(len)) return;
+			m_current -= len;
+			encoder::packed_varint_build<Zigzag>(value.data(), value.size(), m_current);
+		}
+
+		template <bool Zigzag, typename T> void packed_varint_values(const T& value, std::false_type) noexcept {
+			for (auto it = value.end(); it != value.begin() && m_error == result::ok;) {
+				--it;
+				if (Zigzag)
+					varint_signed(*it);
+				else
+					varint(*it);
+			}
+		}
+
+		// Both expect the space to be reserved already
+		template <typename TElement, typename T> void packed_fixed_values(const T& value, std::true_type) noexcept {
+			m_current -= value.size() * sizeof(TElement);
+			if (value.size() != 0) memcpy(m_current, value.data(), value.size() * sizeof(TElement));
+		}
+
+		template <typename TElement, typename T> void packed_fixed_values(const T& value, std::false_type) noexcept {
+			for (auto it = value.end(); it != value.begin();) {
+				--it;
+				TElement e = *it;
+				m_current -= sizeof(TElement);
+				memcpy(m_current, &e, sizeof(TElement));
+			}
+		}
+
 	public:
 		/**
-		 * \brief Construct a new message builder for the specified output stream.
-		 * \param stream The output stream to use
+		 * \brief Construct a new builder.
+		 * \param initial_capacity The initial size of the buffer in bytes. The buffer grows as needed.
+		 */
+		explicit reverse_msg_builder(size_t initial_capacity = 0) noexcept {
+			if (initial_capacity != 0) reserve(initial_capacity);
+		}
+		reverse_msg_builder(const reverse_msg_builder&) = delete;
+		reverse_msg_builder& operator=(const reverse_msg_builder&) = delete;
+		~reverse_msg_builder() { ::operator delete(m_begin); }
+
+		/**
+		 * \brief Get a pointer to the encoded message.
+		 * \return The first byte of the message
+		 */
+		const uint8_t* data() const noexcept { return m_current; }
+		/**
+		 * \brief Get the size of the encoded message.
+		 * \return The number of bytes written so far
+		 */
+		size_t size() const noexcept { return m_end - m_current; }
+		/**
+		 * \brief Discard the encoded data and clear the error state. The buffer is kept for reuse.
 		 */
-		msg_builder(output_stream& stream) : m_encoder{stream} {}
+		void reset() noexcept {
+			m_current = m_end;
+			m_error = result::ok;
+		}
 
 		/**
 		 * \brief Emit a double field to the stream.
@@ -521,9 +2624,7 @@ namespace minipb {
 		 * \return A value of result if the operation succeeded.
 		 */
 		result double_field(int64_t field_id, double value) noexcept {
-			if (m_error != result::ok) return m_error;
-			m_error = m_encoder.field_header(field_id, wire_type::fixed64);
-			if (m_error == result::ok) m_error = m_encoder.fixed64(value);
+			if (m_error == result::ok) fixed_field(field_id, wire_type::fixed64, value);
 			return m_error;
 		}
 		/**
@@ -533,9 +2634,7 @@ namespace minipb {
 		 * \return A value of result if the operation succeeded.
 		 */
 		result float_field(int64_t field_id, float value) noexcept {
-			if (m_error != result::ok) return m_error;
-			m_error = m_encoder.field_header(field_id, wire_type::fixed32);
-			if (m_error == result::ok) m_error = m_encoder.fixed32(value);
+			if (m_error == result::ok) fixed_field(field_id, wire_type::fixed32, value);
 			return m_error;
 		}
 		/**
@@ -545,9 +2644,7 @@ namespace minipb {
 		 * \return A value of result if the operation succeeded.
 		 */
 		result int32_field(int64_t field_id, int32_t value) noexcept {
-			if (m_error != result::ok) return m_error;
-			m_error = m_encoder.field_header(field_id, wire_type::varint);
-			if (m_error == result::ok) m_error = m_encoder.varint(static_cast<uint32_t>(value));
+			if (m_error == result::ok) varint_field(field_id, static_cast<uint32_t>(value));
 			return m_error;
 		}
 		/**
@@ -557,9 +2654,7 @@ namespace minipb {
 		 * \return A value of result if the operation succeeded.
 		 */
 		result int64_field(int64_t field_id, int64_t value) noexcept {
-			if (m_error != result::ok) return m_error;
-			m_error = m_encoder.field_header(field_id, wire_type::varint);
-			if (m_error == result::ok) m_error = m_encoder.varint(static_cast<uint64_t>(value));
+			if (m_error == result::ok) varint_field(field_id, static_cast<uint64_t>(value));
 			return m_error;
 		}
 		/**
@@ -569,9 +2664,7 @@ namespace minipb {
 		 * \return A value of result if the operation succeeded.
 		 */
 		result uint32_field(int64_t field_id, uint32_t value) noexcept {
-			if (m_error != result::ok) return m_error;
-			m_error = m_encoder.field_header(field_id, wire_type::varint);
-			if (m_error == result::ok) m_error = m_encoder.varint(value);
+			if (m_error == result::ok) varint_field(field_id, value);
 			return m_error;
 		}
 		/**
@@ -581,9 +2674,7 @@ namespace minipb {
 		 * \return A value of result if the operation succeeded.
 		 */
 		result uint64_field(int64_t field_id, uint64_t value) noexcept {
-			if (m_error != result::ok) return m_error;
-			m_error = m_encoder.field_header(field_id, wire_type::varint);
-			if (m_error == result::ok) m_error = m_encoder.varint(value);
+			if (m_error == result::ok) varint_field(field_id, value);
 			return m_error;
 		}
 		/**
@@ -592,12 +2683,7 @@ namespace minipb {
 		 * \param value The value of the field.
 		 * \return A value of result if the operation succeeded.
 		 */
-		result sint32_field(int64_t field_id, int32_t value) noexcept {
-			if (m_error != result::ok) return m_error;
-			m_error = m_encoder.field_header(field_id, wire_type::varint);
-			if (m_error == result::ok) m_error = m_encoder.varint_signed(value);
-			return m_error;
-		}
+		result sint32_field(int64_t field_id, int32_t value) noexcept { return sint64_field(field_id, value); }
 		/**
 		 * \brief Emit a signed int64 field to the stream.
 		 * \param field_id The id of the field.
@@ -606,8 +2692,8 @@ namespace minipb {
 		 */
 		result sint64_field(int64_t field_id, int64_t value) noexcept {
 			if (m_error != result::ok) return m_error;
-			m_error = m_encoder.field_header(field_id, wire_type::varint);
-			if (m_error == result::ok) m_error = m_encoder.varint_signed(value);
+			varint_signed(value);
+			if (m_error == result::ok) field_header(field_id, wire_type::varint);
 			return m_error;
 		}
 		/**
@@ -617,9 +2703,7 @@ namespace minipb {
 		 * \return A value of result if the operation succeeded.
 		 */
 		result fixed32_field(int64_t field_id, uint32_t value) noexcept {
-			if (m_error != result::ok) return m_error;
-			m_error = m_encoder.field_header(field_id, wire_type::fixed32);
-			if (m_error == result::ok) m_error = m_encoder.fixed32(value);
+			if (m_error == result::ok) fixed_field(field_id, wire_type::fixed32, value);
 			return m_error;
 		}
 		/**
@@ -629,9 +2713,7 @@ namespace minipb {
 		 * \return A value of result if the operation succeeded.
 		 */
 		result fixed64_field(int64_t field_id, uint64_t value) noexcept {
-			if (m_error != result::ok) return m_error;
-			m_error = m_encoder.field_header(field_id, wire_type::fixed64);
-			if (m_error == result::ok) m_error = m_encoder.fixed64(value);
+			if (m_error == result::ok) fixed_field(field_id, wire_type::fixed64, value);
 			return m_error;
 		}
 		/**
@@ -641,9 +2723,7 @@ namespace minipb {
 		 * \return A value of result if the operation succeeded.
 		 */
 		result sfixed32_field(int64_t field_id, int32_t value) noexcept {
-			if (m_error != result::ok) return m_error;
-			m_error = m_encoder.field_header(field_id, wire_type::fixed32);
-			if (m_error == result::ok) m_error = m_encoder.fixed32(value);
+			if (m_error == result::ok) fixed_field(field_id, wire_type::fixed32, value);
 			return m_error;
 		}
 		/**
@@ -653,9 +2733,7 @@ namespace minipb {
 		 * \return A value of result if the operation succeeded.
 		 */
 		result sfixed64_field(int64_t field_id, int64_t value) noexcept {
-			if (m_error != result::ok) return m_error;
-			m_error = m_encoder.field_header(field_id, wire_type::fixed64);
-			if (m_error == result::ok) m_error = m_encoder.fixed64(value);
+			if (m_error == result::ok) fixed_field(field_id, wire_type::fixed64, value);
 			return m_error;
 		}
 		/**
@@ -665,9 +2743,7 @@ namespace minipb {
 		 * \return A value of result if the operation succeeded.
 		 */
 		result bool_field(int64_t field_id, bool value) noexcept {
-			if (m_error != result::ok) return m_error;
-			m_error = m_encoder.field_header(field_id, wire_type::varint);
-			if (m_error == result::ok) m_error = m_encoder.varint(value ? 1 : 0);
+			if (m_error == result::ok) varint_field(field_id, value ? 1 : 0);
 			return m_error;
 		}
 		/**
@@ -679,9 +2755,8 @@ namespace minipb {
 		 */
 		result string_field(int64_t field_id, const void* value, size_t len) noexcept {
 			if (m_error != result::ok) return m_error;
-			m_error = m_encoder.field_header(field_id, wire_type::length_blob);
-			if (m_error == result::ok) m_error = m_encoder.varint(len);
-			if (m_error == result::ok) m_error = m_encoder.fixed(value, len);
+			if (len != 0) raw(value, len);
+			if (m_error == result::ok) blob_header(field_id, len);
 			return m_error;
 		}
 		/**
@@ -690,11 +2765,14 @@ namespace minipb {
 		 * \param value The value of the field.
 		 * \return A value of result if the operation succeeded.
 		 */
-		result string_field(int64_t field_id, const std::string& value) noexcept {
-			if (m_error != result::ok) return m_error;
-			m_error = string_field(field_id, value.c_str(), value.size());
-			return m_error;
-		}
+		result string_field(int64_t field_id, const std::string& value) noexcept { return string_field(field_id, value.data(), value.size()); }
+		/**
+		 * \brief Emit a string/bytes field to the stream.
+		 * \param field_id The id of the field.
+		 * \param value The value of the field.
+		 * \return A value of result if the operation succeeded.
+		 */
+		result string_field(int64_t field_id, string_view value) noexcept { return string_field(field_id, value.data(), value.size()); }
 
 		/**
 		 * \brief Emit a message field to the stream.
@@ -702,157 +2780,76 @@ namespace minipb {
 		 * \param msg The message to emit.
 		 * \tparam T The message type to accept.
 		 * \return A value of result if the operation succeeded.
-		 * \note This function is designed to work in conjunction with the code generated by the generator,
-		 * however it can also be used with custom classes that follow the same interface. At the very minimum it
-		 * needs an `size_t estimate_size()` function returning an upper bound of the encoded size or 0 if it is unknown
-		 * or expensive to calculate, as well as an `result encode(msg_builder&)` function that serializes the message into
-		 * the provided builder.
+		 * \note The message needs to provide a `result encode_reverse(reverse_msg_builder&)` function emitting its fields
+		 * in reverse order, like the one generated by the generator.
 		 */
 		template <typename T> result message_field(int64_t field_id, const T& msg) noexcept {
 			if (m_error != result::ok) return m_error;
-			// This gives us a worst case estimate of the blob size
-			auto size = msg.estimate_size();
-			if (size == 0) size = SIZE_MAX;
-			auto dummy_size = encoder::varint_size(size);
-			uint8_t dummy_varint[10] = {};
-			// We write the object header
-			m_error = m_encoder.field_header(field_id, wire_type::length_blob);
-			if (m_error != result::ok) return m_error;
-			// note down the current position
-			auto pos = m_encoder.stream().position();
-			// write a dummy varint based on the estimated size
-			m_error = m_encoder.fixed(dummy_varint, dummy_size);
-			if (m_error != result::ok) return m_error;
-			// and hand of encoding to the message type
-			m_error = msg.encode(*this);
-			if (m_error != result::ok) return m_error;
-			// after it is done, we calculate the size difference
-			auto real_size = m_encoder.stream().position() - (pos + dummy_size);
-			if (real_size > size) return minipb::result::general_error;
-			// Build our real size and patch it to the dummy size
-			encoder::varint_build(real_size, dummy_varint);
-			for (size_t i = 0; i < dummy_size - 1; i++)
-				dummy_varint[i] |= 0x80;
-			// Patch out our dummy size
-			m_error = m_encoder.stream().write_at(pos, dummy_varint, dummy_size);
+			auto end = size();
+			m_error = msg.encode_reverse(*this);
+			if (m_error == result::ok) blob_header(field_id, size() - end);
 			return m_error;
 		}
 
 		/**
 		 * \brief Emit a block of packed 64bit values (double, int64_t or uint64_t).
 		 *
-		 * The function is compatible with any container type that is range iterable
-		 * (i.e. provides `begin()` and `end()`) and has a `size()` function returning the number
-		 * of elements in the container. This is true for all stl containers except maps.
+		 * The function is compatible with any container type that provides bidirectional iterators using `begin()` and `end()`
+		 * and has a `size()` function returning the number of elements in the container.
 		 * \param field_id The id of the field.
 		 * \param value A container type providing the values.
 		 * \return A value of result if the operation succeeded.
 		 */
 		template <typename T> result packed_fixed64_field(int64_t field_id, const T& value) noexcept {
-			if (m_error != result::ok) return m_error;
-			m_error = m_encoder.field_header(field_id, wire_type::length_blob);
-			if (m_error == result::ok) m_error = m_encoder.varint(value.size() * 8);
-			for (auto e : value) {
-				if (m_error != result::ok) break;
-				m_error = m_encoder.fixed64(e);
-			}
-			return m_error;
+			using element_type = typename std::decay<decltype(*value.begin())>::type;
+			using fixed_type = typename std::conditional<std::is_floating_point<element_type>::value, double, uint64_t>::type;
+			return packed_fixed_field<fixed_type>(field_id, value);
 		}
 
 		/**
 		 * \brief Emit a block of packed 32bit values (float, int32_t or uint32_t).
 		 *
-		 * The function is compatible with any container type that is range iterable
-		 * (i.e. provides `begin()` and `end()`) and has a `size()` function returning the number
-		 * of elements in the container. This is true for all stl containers except maps.
+		 * The function is compatible with any container type that provides bidirectional iterators using `begin()` and `end()`
+		 * and has a `size()` function returning the number of elements in the container.
 		 * \param field_id The id of the field.
 		 * \param value A container type providing the values.
 		 * \return A value of result if the operation succeeded.
 		 */
 		template <typename T> result packed_fixed32_field(int64_t field_id, const T& value) noexcept {
-			if (m_error != result::ok) return m_error;
-			m_error = m_encoder.field_header(field_id, wire_type::length_blob);
-			if (m_error == result::ok) m_error = m_encoder.varint(value.size() * 4);
-			for (auto e : value) {
-				if (m_error != result::ok) break;
-				m_error = m_encoder.fixed32(e);
-			}
-			return m_error;
+			using element_type = typename std::decay<decltype(*value.begin())>::type;
+			using fixed_type = typename std::conditional<std::is_floating_point<element_type>::value, float, uint32_t>::type;
+			return packed_fixed_field<fixed_type>(field_id, value);
 		}
 
 		/**
 		 * \brief Emit a block of packed varint values.
 		 *
-		 * The function is compatible with any container type that is range iterable
-		 * (i.e. provides `begin()` and `end()`) and has a `size()` function returning the number
-		 * of elements in the container. This is true for all stl containers except maps.
+		 * The function is compatible with any container type that provides bidirectional iterators using `begin()` and `end()`.
 		 * \param field_id The id of the field.
 		 * \param value A container type providing the values.
 		 * \return A value of result if the operation succeeded.
 		 */
 		template <typename T> result packed_varint_field(int64_t field_id, const T& value) noexcept {
 			if (m_error != result::ok) return m_error;
-			m_error = m_encoder.field_header(field_id, wire_type::length_blob);
-			// Worst case estimate
-			auto dummy_size = encoder::varint_size(10 * value.size());
-			uint8_t dummy_varint[10] = {};
-			// note down the current position
-			auto pos = m_encoder.stream().position();
-			// write a dummy varint based on the estimated size
-			m_error = m_encoder.fixed(dummy_varint, dummy_size);
-			if (m_error != result::ok) return m_error;
-			// Write our data
-			for (auto e : value) {
-				if (m_error != result::ok) break;
-				m_error = m_encoder.varint(e);
-			}
-			// after it is done, we calculate the size difference
-			auto real_size = m_encoder.stream().position() - (pos + dummy_size);
-			if (real_size > 10 * value.size()) return minipb::result::general_error;
-			// Build our real size and patch it to the dummy size
-			encoder::varint_build(real_size, dummy_varint);
-			for (size_t i = 0; i < dummy_size - 1; i++)
-				dummy_varint[i] |= 0x80;
-			// Patch out our dummy size
-			m_error = m_encoder.stream().write_at(pos, dummy_varint, dummy_size);
+			auto end = size();
+			packed_varint_values<false>(value, std::integral_constant<bool, has_varint_storage<T>::value>{});
+			if (m_error == result::ok) blob_header(field_id, size() - end);
 			return m_error;
 		}
 
 		/**
 		 * \brief Emit a block of packed varint values using zig zag encoding.
 		 *
-		 * The function is compatible with any container type that is range iterable
-		 * (i.e. provides `begin()` and `end()`) and has a `size()` function returning the number
-		 * of elements in the container. This is true for all stl containers except maps.
+		 * The function is compatible with any container type that provides bidirectional iterators using `begin()` and `end()`.
 		 * \param field_id The id of the field.
 		 * \param value A container type providing the values.
 		 * \return A value of result if the operation succeeded.
 		 */
 		template <typename T> result packed_varint_signed_field(int64_t field_id, const T& value) noexcept {
 			if (m_error != result::ok) return m_error;
-			m_error = m_encoder.field_header(field_id, wire_type::length_blob);
-			// Worst case estimate
-			auto dummy_size = encoder::varint_size(10 * value.size());
-			uint8_t dummy_varint[10] = {};
-			// note down the current position
-			auto pos = m_encoder.stream().position();
-			// write a dummy varint based on the estimated size
-			m_error = m_encoder.fixed(dummy_varint, dummy_size);
-			if (m_error != result::ok) return m_error;
-			// Write our data
-			for (auto e : value) {
-				if (m_error != result::ok) break;
-				m_error = m_encoder.varint_signed(e);
-			}
-			// after it is done, we calculate the size difference
-			auto real_size = m_encoder.stream().position() - (pos + dummy_size);
-			if (real_size > 10 * value.size()) return minipb::result::general_error;
-			// Build our real size and patch it to the dummy size
-			encoder::varint_build(real_size, dummy_varint);
-			for (size_t i = 0; i < dummy_size - 1; i++)
-				dummy_varint[i] |= 0x80;
-			// Patch out our dummy size
-			m_error = m_encoder.stream().write_at(pos, dummy_varint, dummy_size);
+			auto end = size();
+			packed_varint_values<true>(value, std::integral_constant<bool, has_varint_storage<T>::value>{});
+			if (m_error == result::ok) blob_header(field_id, size() - end);
 			return m_error;
 		}
 
@@ -867,22 +2864,162 @@ namespace minipb {
 	 * \brief Decoder class used to decode fields from a protobuf data stream.
 	 * \note This is a lowlevel class and should only be used if you need full control over
 	 * the read data. For normal operation use msg_parser or the generated message classes.
+	 * \tparam TStream The stream type used for input. Using a concrete (final) stream type instead of input_stream
+	 * allows the compiler to inline all stream calls.
 	 */
-	class decoder final {
-		input_stream& m_stream;
+	template <typename TStream> class basic_decoder final {
+		TStream& m_stream;
+
+		static size_t popcount(uint32_t v) noexcept {
+#if defined(__GNUC__)
+			return static_cast<size_t>(__builtin_popcount(v));
+#else
+			size_t count{0};
+			for (; v != 0; v &= v - 1)
+				count++;
+			return count;
+#endif
+		}
+
+		static size_t varint_count_scalar(const unsigned char* ptr, const unsigned char* end) noexcept {
+			size_t count{0};
+			for (; ptr < end; ptr++)
+				count += *ptr < 0x80;
+			return count;
+		}
+
+		// Decode varints until stop was reached or passed, the last varint may extend up to end. out is advanced past the decoded values.
+		template <bool Zigzag, typename X>
+		static const unsigned char* packed_varint_parse_scalar(const unsigned char* ptr, const unsigned char* stop, const unsigned char* end, X*& out) noexcept {
+			while (ptr < stop) {
+				uint64_t v;
+				ptr = varint_parse(ptr, end, v);
+				if (ptr == nullptr) return nullptr;
+				*out++ = convert<Zigzag, X>(v);
+			}
+			return ptr;
+		}
+
+#if defined(MINIPB_SIMD_DISPATCH)
+		// Widen 32 single byte varints, 8 per instruction for 32bit and 4 for 64bit elements
+		template <bool Zigzag> __attribute__((target("avx2"))) static void widen_avx2(const unsigned char* ptr, uint32_t* out) noexcept {
+			for (size_t i = 0; i < 32; i += 8) {
+				auto v = _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(ptr + i)));
+				if (Zigzag) v = _mm256_xor_si256(_mm256_srli_epi32(v, 1), _mm256_sub_epi32(_mm256_setzero_si256(), _mm256_and_si256(v, _mm256_set1_epi32(1))));
+				_mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), v);
+			}
+		}
+		template <bool Zigzag> __attribute__((target("avx2"))) static void widen_avx2(const unsigned char* ptr, uint64_t* out) noexcept {
+			for (size_t i = 0; i < 32; i += 4) {
+				int32_t bytes;
+				memcpy(&bytes, ptr + i, sizeof(bytes));
+				auto v = _mm256_cvtepu8_epi64(_mm_cvtsi32_si128(bytes));
+				if (Zigzag) v = _mm256_xor_si256(_mm256_srli_epi64(v, 1), _mm256_sub_epi64(_mm256_setzero_si256(), _mm256_and_si256(v, _mm256_set1_epi64x(1))));
+				_mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), v);
+			}
+		}
+		template <bool Zigzag> __attribute__((target("avx2"))) static void widen_avx2(const unsigned char* ptr, bool* out) noexcept {
+			auto v = _mm256_min_epu8(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(ptr)), _mm256_set1_epi8(1));
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(out), v);
+		}
+		template <bool Zigzag> __attribute__((target("avx2"))) static void widen_avx2(const unsigned char* ptr, int32_t* out) noexcept {
+			widen_avx2<Zigzag>(ptr, reinterpret_cast<uint32_t*>(out));
+		}
+		template <bool Zigzag> __attribute__((target("avx2"))) static void widen_avx2(const unsigned char* ptr, int64_t* out) noexcept {
+			widen_avx2<Zigzag>(ptr, reinterpret_cast<uint64_t*>(out));
+		}
+
+		// Widen 16 single byte varints, 4 per instruction for 32bit and 2 for 64bit elements
+		template <bool Zigzag> __attribute__((target("sse4.1"))) static void widen_sse41(const unsigned char* ptr, uint32_t* out) noexcept {
+			for (size_t i = 0; i < 16; i += 4) {
+				int32_t bytes;
+				memcpy(&bytes, ptr + i, sizeof(bytes));
+				auto v = _mm_cvtepu8_epi32(_mm_cvtsi32_si128(bytes));
+				if (Zigzag) v = _mm_xor_si128(_mm_srli_epi32(v, 1), _mm_sub_epi32(_mm_setzero_si128(), _mm_and_si128(v, _mm_set1_epi32(1))));
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), v);
+			}
+		}
+		template <bool Zigzag> __attribute__((target("sse4.1"))) static void widen_sse41(const unsigned char* ptr, uint64_t* out) noexcept {
+			for (size_t i = 0; i < 16; i += 2) {
+				uint16_t bytes;
+				memcpy(&bytes, ptr + i, sizeof(bytes));
+				auto v = _mm_cvtepu8_epi64(_mm_cvtsi32_si128(bytes));
+				if (Zigzag) v = _mm_xor_si128(_mm_srli_epi64(v, 1), _mm_sub_epi64(_mm_setzero_si128(), _mm_and_si128(v, _mm_set1_epi64x(1))));
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), v);
+			}
+		}
+		template <bool Zigzag> __attribute__((target("sse4.1"))) static void widen_sse41(const unsigned char* ptr, bool* out) noexcept {
+			auto v = _mm_min_epu8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(ptr)), _mm_set1_epi8(1));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(out), v);
+		}
+		template <bool Zigzag> __attribute__((target("sse4.1"))) static void widen_sse41(const unsigned char* ptr, int32_t* out) noexcept {
+			widen_sse41<Zigzag>(ptr, reinterpret_cast<uint32_t*>(out));
+		}
+		template <bool Zigzag> __attribute__((target("sse4.1"))) static void widen_sse41(const unsigned char* ptr, int64_t* out) noexcept {
+			widen_sse41<Zigzag>(ptr, reinterpret_cast<uint64_t*>(out));
+		}
+		static_assert(sizeof(bool) == 1, "SIMD decoding of bool fields needs single byte bools");
+
+		__attribute__((target("avx2"))) static size_t varint_count_avx2(const unsigned char* ptr, const unsigned char* end) noexcept {
+			size_t count{0};
+			for (; end - ptr >= 32; ptr += 32) {
+				auto mask = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(ptr))));
+				count += popcount(~mask);
+			}
+			return count + varint_count_scalar(ptr, end);
+		}
+		__attribute__((target("sse4.1"))) static size_t varint_count_sse41(const unsigned char* ptr, const unsigned char* end) noexcept {
+			size_t count{0};
+			for (; end - ptr >= 16; ptr += 16) {
+				auto mask = static_cast<uint32_t>(_mm_movemask_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(ptr))));
+				count += popcount(~mask & 0xffff);
+			}
+			return count + varint_count_scalar(ptr, end);
+		}
+
+		// Blocks without continuation bits are widened at once, other blocks are decoded scalar until their end was passed
+		template <bool Zigzag, typename X>
+		__attribute__((target("avx2"))) static const unsigned char* packed_varint_parse_avx2(const unsigned char* ptr, const unsigned char* end, X* out) noexcept {
+			while (end - ptr >= 32) {
+				if (_mm256_movemask_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(ptr))) == 0) {
+					widen_avx2<Zigzag>(ptr, out);
+					ptr += 32;
+					out += 32;
+					continue;
+				}
+				ptr = packed_varint_parse_scalar<Zigzag>(ptr, ptr + 32, end, out);
+				if (ptr == nullptr) return nullptr;
+			}
+			return packed_varint_parse_scalar<Zigzag>(ptr, end, end, out);
+		}
+		template <bool Zigzag, typename X>
+		__attribute__((target("sse4.1"))) static const unsigned char* packed_varint_parse_sse41(const unsigned char* ptr, const unsigned char* end, X* out) noexcept {
+			while (end - ptr >= 16) {
+				if (_mm_movemask_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(ptr))) == 0) {
+					widen_sse41<Zigzag>(ptr, out);
+					ptr += 16;
+					out += 16;
+					continue;
+				}
+				ptr = packed_varint_parse_scalar<Zigzag>(ptr, ptr + 16, end, out);
+				if (ptr == nullptr) return nullptr;
+			}
+			return packed_varint_parse_scalar<Zigzag>(ptr, end, end, out);
+		}
+#endif
 
 	public:
 		/**
 		 * \brief Construct a new decoder using the specified stream for data input.
 		 * \param stream Input stream used for reading data.
 		 */
-		decoder(input_stream& stream) noexcept : m_stream{stream} {}
+		basic_decoder(TStream& stream) noexcept : m_stream{stream} {}
 
 		/**
 		 * \brief Get the underlying stream
 		 * \return The stream used for reading data
 		 */
-		input_stream& stream() const noexcept { return m_stream; }
+		TStream& stream() const noexcept { return m_stream; }
 
 		/**
 		 * \brief Read an unsigned varint value.
@@ -890,12 +3027,18 @@ namespace minipb {
 		 * \return Result code
 		 */
 		result varint(uint64_t& val) noexcept {
+			auto ptr = m_stream.data();
+			if (ptr != nullptr) { // Contiguous memory, decode in place
+				auto end = varint_parse(ptr, ptr + m_stream.bytes_available(), val);
+				if (end == nullptr) return result::invalid_input;
+				return m_stream.skip(end - ptr);
+			}
 			uint8_t buf[10]{};
 			val = 0;
 			auto peek_size = m_stream.peek(buf, sizeof(buf));
 			if (peek_size == 0) { // Peek unsupported or no data
 				for (size_t i = 0; i < 10; i++) {
-					auto res = m_stream.read(&buf[0], 1);
+					auto res = m_stream.read(&buf[i], 1);
 					if (res != result::ok) return res;
 					val |= static_cast<uint64_t>(buf[i] & 0x7f) << (i * 7);
 					if ((buf[i] & 0x80) == 0) return res;
@@ -909,7 +3052,92 @@ namespace minipb {
 				}
 			}
 
-			return result::invalid_input;
+			return result::invalid_input;
+		}
+
+		/**
+		 * \brief Parse a varint from a block of memory.
+		 *
+		 * If at least 10 bytes (the maximum size of a varint) are available the bytes are decoded without any bounds checks,
+		 * only varints close to the end of the block check against end.
+		 * \param ptr Pointer to the first byte of the varint
+		 * \param end Pointer past the last readable byte
+		 * \param val Variable to store the result into
+		 * \return Pointer past the parsed varint or nullptr if the data is truncated or invalid
+		 */
+		static const unsigned char* varint_parse(const unsigned char* ptr, const unsigned char* end, uint64_t& val) noexcept {
+			if (ptr < end && *ptr < 0x80) {
+				val = *ptr;
+				return ptr + 1;
+			}
+			uint64_t res = 0;
+			if (end - ptr >= 10) {
+				for (size_t i = 0; i < 10; i++) {
+					uint64_t b = ptr[i];
+					res |= (b & 0x7f) << (i * 7);
+					if (b < 0x80) {
+						val = res;
+						return ptr + i + 1;
+					}
+				}
+				return nullptr;
+			}
+			for (size_t i = 0; ptr + i < end; i++) {
+				uint64_t b = ptr[i];
+				res |= (b & 0x7f) << (i * 7);
+				if (b < 0x80) {
+					val = res;
+					return ptr + i + 1;
+				}
+			}
+			return nullptr;
+		}
+
+		/**
+		 * \brief Count the varints in a block of packed varints by counting their terminating bytes.
+		 * \param ptr Pointer to the first byte of the block
+		 * \param end Pointer past the last byte of the block
+		 * \return The number of bytes without continuation bit
+		 */
+		static size_t varint_count(const unsigned char* ptr, const unsigned char* end) noexcept {
+#if defined(MINIPB_SIMD_DISPATCH)
+			auto level = active_simd_level();
+			if (level == simd_level::avx2) return varint_count_avx2(ptr, end);
+			if (level == simd_level::sse41) return varint_count_sse41(ptr, end);
+#endif
+			return varint_count_scalar(ptr, end);
+		}
+
+		/**
+		 * \brief Decode a block of packed varints into an array.
+		 *
+		 * Runs of single byte varints are widened using AVX2 or SSE4.1 (see simd_level), everything else is decoded using varint_parse().
+		 * \param ptr Pointer to the first byte of the block
+		 * \param end Pointer past the last byte of the block
+		 * \param out The destination, needs to have room for varint_count() elements
+		 * \tparam Zigzag Decode the values using zig zag encoding
+		 * \tparam X The element type, all values are truncated to it
+		 * \return end or nullptr if the block contains an invalid or truncated varint
+		 */
+		template <bool Zigzag, typename X> static const unsigned char* packed_varint_parse(const unsigned char* ptr, const unsigned char* end, X* out) noexcept {
+#if defined(MINIPB_SIMD_DISPATCH)
+			auto level = active_simd_level();
+			if (level == simd_level::avx2) return packed_varint_parse_avx2<Zigzag>(ptr, end, out);
+			if (level == simd_level::sse41) return packed_varint_parse_sse41<Zigzag>(ptr, end, out);
+#endif
+			return packed_varint_parse_scalar<Zigzag>(ptr, end, end, out);
+		}
+
+		/**
+		 * \brief Convert a decoded varint to its element type.
+		 * \param v The raw varint
+		 * \tparam Zigzag Decode the value using zig zag encoding
+		 * \tparam X The element type, the value is truncated to it
+		 * \return The converted value
+		 */
+		template <bool Zigzag, typename X> static X convert(uint64_t v) noexcept {
+			if (Zigzag) return static_cast<X>((v & 0x01) ? static_cast<int64_t>(~(v >> 1)) : static_cast<int64_t>(v >> 1));
+			return static_cast<X>(v);
 		}
 
 		/**
@@ -924,7 +3152,7 @@ namespace minipb {
 			if (v & 0x01)
 				val = static_cast<int64_t>(~(v >> 1));
 			else
-				val = static_cast<int64_t>(v);
+				val = static_cast<int64_t>(v >> 1);
 			return result::ok;
 		}
 
@@ -1026,10 +3254,34 @@ namespace minipb {
 				if (res != result::ok) return res;
 				return m_stream.skip(val);
 			}
-			case wire_type::group_start:
+			case wire_type::group_start: return skip_group();
 			case wire_type::group_end: return result::invalid_input;
 			case wire_type::fixed32: return m_stream.skip(4);
 			}
+			return result::invalid_input;
+		}
+
+		/**
+		 * \brief Skip the contents of a group including its end tag, after its start tag has been read.
+		 *
+		 * Nested groups are tracked using a counter instead of recursion, so deeply nested input can not exhaust the stack.
+		 * \return Result code
+		 */
+		result skip_group() noexcept {
+			size_t depth = 1;
+			while (depth != 0) {
+				uint64_t id;
+				wire_type t;
+				auto res = field_header(id, t);
+				if (res != result::ok) return res;
+				if (t == wire_type::group_start)
+					depth++;
+				else if (t == wire_type::group_end)
+					depth--;
+				else if ((res = skip_field(t)) != result::ok)
+					return res;
+			}
+			return result::ok;
 		}
 
 		/**
@@ -1039,26 +3291,78 @@ namespace minipb {
 		bool is_eof() const noexcept { return m_stream.bytes_available() == 0; }
 	};
 
+	/// Decoder using virtual dispatch for all stream calls, compatible with every input_stream.
+	using decoder = basic_decoder<input_stream>;
+
+	/**
+	 * \brief Describes the stream used to parse a length delimited submessage of a stream of type TStream.
+	 *
+	 * The default wraps the parent in a subset_input_stream, submessages of a subset_input_stream get a subset of the same root
+	 * stream, so the cost of reading does not grow with the nesting depth. Contiguous streams are specialized to parse submessages
+	 * as a plain array_input_stream over the submessage bytes, which keeps nested parsing devirtualized and limits the set of parser
+	 * types a message needs to support.
+	 * \tparam TStream The type of the parent stream
+	 */
+	template <typename TStream> struct nested_input_stream {
+		/// The type of the stream object constructed for the submessage
+		using type = subset_input_stream;
+		/// The stream type the submessage parser is instantiated with
+		using parser_type = subset_input_stream;
+		/**
+		 * \brief Create a stream covering the next len bytes of parent
+		 * \param parent The parent stream
+		 * \param len The length of the submessage in bytes
+		 * \return The submessage stream
+		 */
+		static type make(TStream& parent, size_t len) noexcept { return type{parent, len}; }
+	};
+
+	/// Submessages of a subset_input_stream are parsed as a subset of its root stream
+	template <> struct nested_input_stream<subset_input_stream> {
+		using type = subset_input_stream;
+		using parser_type = subset_input_stream;
+		static type make(subset_input_stream& parent, size_t len) noexcept { return parent.subset(len); }
+	};
+
+	/// Submessages of an array_input_stream are parsed as array_input_stream
+	template <> struct nested_input_stream<array_input_stream> {
+		using type = array_input_stream;
+		using parser_type = array_input_stream;
+		static type make(array_input_stream& parent, size_t len) noexcept { return parent.subset(len); }
+	};
+
+	/// Submessages of a container_input_stream are parsed as array_input_stream
+	template <> struct nested_input_stream<container_input_stream> {
+		using type = array_input_stream;
+		using parser_type = array_input_stream;
+		static type make(container_input_stream& parent, size_t len) noexcept { return parent.subset(len); }
+	};
+
 	/**
 	 * \brief Class providing an interface for parsing a encoded protobuf message.
+	 * \tparam TStream The stream type used for input. Using a concrete (final) stream type instead of input_stream
+	 * allows the compiler to inline all stream calls.
 	 */
-	class msg_parser final {
-		decoder m_decoder;
+	template <typename TStream> class basic_msg_parser final {
+		basic_decoder<TStream> m_decoder;
 		uint64_t m_field_id{0};
 		wire_type m_wire_type{};
 		bool m_field_read{true};
+		// Number of groups currently being parsed using this parser
+		size_t m_group_depth{0};
 
-		template <typename T, typename X> result repeated_packable_field(T& value, result (msg_parser::*fn)(X&)) noexcept {
+		template <typename T, typename X> result repeated_packable_field(T& value, wire_type element_type, result (basic_msg_parser::*fn)(X&)) noexcept {
 			if (m_wire_type == wire_type::length_blob) {
-				// Packed fields
+				// Packed fields, parsed in place until the stream shrinks to the size following the block
 				uint64_t len{0};
 				auto res = m_decoder.varint(len);
 				if (res != result::ok) return res;
-				subset_input_stream stream{m_decoder.stream(), len};
-				msg_parser d{stream};
-				while (!d.is_eof()) {
+				if (len > m_decoder.stream().bytes_available()) return result::invalid_input;
+				auto remaining = m_decoder.stream().bytes_available() - len;
+				m_wire_type = element_type;
+				while (m_decoder.stream().bytes_available() > remaining) {
 					X v;
-					auto res = (d.*fn)(v);
+					auto res = (this->*fn)(v);
 					if (res != result::ok) return res;
 					try {
 						value.push_back(v);
@@ -1066,6 +3370,8 @@ namespace minipb {
 						return result::general_error;
 					}
 				}
+				// The last element overlapped the end of the block
+				if (m_decoder.stream().bytes_available() != remaining) return result::invalid_input;
 			} else {
 				X v;
 				auto res = (this->*fn)(v);
@@ -1079,16 +3385,97 @@ namespace minipb {
 			return result::ok;
 		}
 
+		template <typename T, typename X> class has_contiguous_storage {
+			template <typename U>
+			static auto test(int) -> decltype(std::declval<U&>().resize(size_t{}), std::is_same<decltype(std::declval<U&>().data()), X*>{});
+			template <typename U> static std::false_type test(...);
+
+		public:
+			static constexpr bool value = decltype(test<T>(0))::value;
+		};
+
+		// Containers with contiguous storage are resized to fit all varints and decoded into directly
+		template <bool Zigzag, typename X, typename T>
+		result append_varints(T& value, const unsigned char* ptr, const unsigned char* end, std::true_type) noexcept {
+			auto size = value.size();
+			try {
+				value.resize(size + basic_decoder<TStream>::varint_count(ptr, end));
+			} catch (...) {
+				return result::general_error;
+			}
+			if (basic_decoder<TStream>::template packed_varint_parse<Zigzag>(ptr, end, value.data() + size) != nullptr) return result::ok;
+			value.resize(size);
+			return result::invalid_input;
+		}
+
+		template <bool Zigzag, typename X, typename T>
+		result append_varints(T& value, const unsigned char* ptr, const unsigned char* end, std::false_type) noexcept {
+			while (ptr < end) {
+				uint64_t v;
+				ptr = basic_decoder<TStream>::varint_parse(ptr, end, v);
+				if (ptr == nullptr) return result::invalid_input;
+				try {
+					value.push_back(basic_decoder<TStream>::template convert<Zigzag, X>(v));
+				} catch (...) {
+					return result::general_error;
+				}
+			}
+			return result::ok;
+		}
+
+		template <typename T, typename X> result repeated_fixed_field(T& value, wire_type element_type, result (basic_msg_parser::*fn)(X&)) noexcept {
+			return repeated_fixed_field(value, element_type, fn, std::integral_constant<bool, has_contiguous_storage<T, X>::value>{});
+		}
+
+		template <typename T, typename X>
+		result repeated_fixed_field(T& value, wire_type element_type, result (basic_msg_parser::*fn)(X&), std::false_type) noexcept {
+			return repeated_packable_field<T, X>(value, element_type, fn);
+		}
+
+		// Packed blocks are read into containers with contiguous storage as a whole
+		template <typename T, typename X>
+		result repeated_fixed_field(T& value, wire_type element_type, result (basic_msg_parser::*fn)(X&), std::true_type) noexcept {
+			if (m_wire_type != wire_type::length_blob) return repeated_packable_field<T, X>(value, element_type, fn);
+			uint64_t len{0};
+			auto res = m_decoder.varint(len);
+			if (res != result::ok) return res;
+			if (len > m_decoder.stream().bytes_available() || len % sizeof(X) != 0) return result::invalid_input;
+			if (len == 0) return result::ok;
+			auto size = value.size();
+			try {
+				value.resize(size + len / sizeof(X));
+			} catch (...) {
+				return result::general_error;
+			}
+			res = m_decoder.stream().read(value.data() + size, len);
+			if (res != result::ok) value.resize(size);
+			return res;
+		}
+
+		template <typename T, typename X, bool Zigzag> result repeated_varint_field(T& value, result (basic_msg_parser::*fn)(X&)) noexcept {
+			if (m_wire_type != wire_type::length_blob || m_decoder.stream().data() == nullptr)
+				return repeated_packable_field<T, X>(value, wire_type::varint, fn);
+			// Packed block in contiguous memory, decoded in bulk
+			uint64_t len{0};
+			auto res = m_decoder.varint(len);
+			if (res != result::ok) return res;
+			if (len > m_decoder.stream().bytes_available()) return result::invalid_input;
+			auto ptr = m_decoder.stream().data();
+			res = append_varints<Zigzag, X>(value, ptr, ptr + len, std::integral_constant<bool, has_contiguous_storage<T, X>::value>{});
+			if (res != result::ok) return res;
+			return m_decoder.stream().skip(len);
+		}
+
 	public:
 		/**
 		 * \brief Construct a new msg_parser using the specified stream for input.
 		 * \param stream The input stream
 		 */
-		msg_parser(input_stream& stream) noexcept : m_decoder{stream} {}
+		basic_msg_parser(TStream& stream) noexcept : m_decoder{stream} {}
 
 		/**
 		 * \brief Advance to the next field
-		 * \return Result code
+		 * \return Result code, result::end_of_group if the end tag of the group currently being parsed was reached.
 		 */
 		result next_field() noexcept {
 			result res = result::ok;
@@ -1096,8 +3483,38 @@ namespace minipb {
 			if (res != result::ok) return res;
 			res = m_decoder.field_header(m_field_id, m_wire_type);
 			m_field_read = false;
+			if (res == result::ok && m_wire_type == wire_type::group_end) {
+				m_field_read = true;
+				return m_group_depth != 0 ? result::end_of_group : result::invalid_input;
+			}
 			return res;
 		}
+		/**
+		 * \brief Advance to the next field if its header matches the expected one.
+		 *
+		 * Compares the next input bytes against the constant encoded header, which is cheaper than decoding it when fields arrive in a
+		 * predictable order. Nothing is consumed if the header does not match, if the current field was not read yet or if the stream
+		 * is not contiguous, next_field() then reads the header as usual.
+		 * \param tag The expected field header
+		 * \return true if the header matched and the expected field is now the current field
+		 */
+		template <uint32_t FieldId, wire_type Type> bool next_field_is(field_tag<FieldId, Type> tag) noexcept {
+			(void)tag;
+			using tag_type = field_tag<FieldId, Type>;
+			if (!m_field_read) return false;
+			auto& stream = m_decoder.stream();
+			if (stream.bytes_available() < tag_type::size) return false;
+			auto ptr = stream.data();
+			if (ptr == nullptr) return false;
+			for (size_t i = 0; i < tag_type::size; i++) {
+				if (ptr[i] != tag_type::byte(i)) return false;
+			}
+			if (stream.skip(tag_type::size) != result::ok) return false;
+			m_field_id = FieldId;
+			m_wire_type = Type;
+			m_field_read = false;
+			return true;
+		}
 		/**
 		 * \brief Get the wire_type of the current field
 		 * \return wire_type of the current field
@@ -1284,7 +3701,7 @@ namespace minipb {
 			uint64_t full_size;
 			auto res = m_decoder.varint(full_size);
 			if (res != result::ok) return res;
-			len = len > full_size ? len : full_size;
+			len = len < full_size ? len : full_size;
 			res = m_decoder.stream().read(value, len);
 			if (res != result::ok) return res;
 			if (full_size > len) return m_decoder.stream().skip(full_size - len);
@@ -1301,7 +3718,14 @@ namespace minipb {
 			uint64_t full_size;
 			auto res = m_decoder.varint(full_size);
 			if (res != result::ok) return res;
+			if (full_size > m_decoder.stream().bytes_available()) return result::invalid_input;
+			auto ptr = m_decoder.stream().data();
 			try {
+				// Copy directly from contiguous memory instead of zero filling first
+				if (ptr != nullptr) {
+					value.assign(reinterpret_cast<const char*>(ptr), full_size);
+					return m_decoder.stream().skip(full_size);
+				}
 				value.resize(full_size);
 			} catch (...) {
 				return result::general_error;
@@ -1309,24 +3733,93 @@ namespace minipb {
 			return m_decoder.stream().read(&value[0], value.size());
 		}
 
+		/**
+		 * \brief Get the current field as a string copied into an arena
+		 * \param value Variable to store the result in
+		 * \param a The arena providing the storage for the string data
+		 * \return Result code
+		 */
+		result string_field(string_view& value, arena& a) noexcept {
+			m_field_read = true;
+			uint64_t full_size;
+			auto res = m_decoder.varint(full_size);
+			if (res != result::ok) return res;
+			if (full_size > m_decoder.stream().bytes_available()) return result::invalid_input;
+			if (full_size == 0) {
+				value = string_view{};
+				return result::ok;
+			}
+			auto mem = static_cast<char*>(a.allocate(full_size, 1));
+			if (mem == nullptr) return result::out_of_memory;
+			res = m_decoder.stream().read(mem, full_size);
+			if (res == result::ok) value = string_view{mem, full_size};
+			return res;
+		}
+
+		/**
+		 * \brief Get the current field as a view into the input data
+		 * \param value Variable to store the result in
+		 * \return Result code
+		 * \note This requires a stream backed by contiguous memory (see input_stream::data()) and returns result::general_error otherwise.
+		 * The view references the stream memory, which needs to outlive it.
+		 */
+		result string_field(string_view& value) noexcept {
+			m_field_read = true;
+			uint64_t full_size;
+			auto res = m_decoder.varint(full_size);
+			if (res != result::ok) return res;
+			if (full_size > m_decoder.stream().bytes_available()) return result::invalid_input;
+			auto ptr = m_decoder.stream().data();
+			if (ptr == nullptr) return result::general_error;
+			value = string_view{reinterpret_cast<const char*>(ptr), full_size};
+			return m_decoder.stream().skip(full_size);
+		}
+
 		/**
 		 * \brief Get the current field as a message
 		 * \param msg The message to parse into.
+		 * \param args Additional arguments passed to the decode function of the message.
 		 * \return Result code
 		 * \note This function is designed to work in conjunction with the code generated by the generator,
 		 * however it can also be used with custom classes that follow the same interface. At the very minimum it
-		 * needs an `result decode(msg_parser&)` function that deserializes the message into the provided parser.
+		 * needs an `result decode(basic_msg_parser<X>&)` function that deserializes the message into the provided parser, where
+		 * X is `nested_input_stream<TStream>::parser_type`. Additional arguments (e.g. an arena) are passed on to `decode()`.
+		 * Messages encoded as group (see message_encoding::group) are decoded using this parser, in which case decode() ends when
+		 * next_field() returns result::end_of_group.
+		 */
+		template <typename T, typename... Args> result message_field(T& msg, Args&... args) noexcept {
+			m_field_read = true;
+			if (m_wire_type == wire_type::group_start) {
+				auto field_id = m_field_id;
+				m_group_depth++;
+				auto res = msg.decode(*this, args...);
+				m_group_depth--;
+				if (res == result::end_of_group) return m_field_id == field_id ? result::ok : result::invalid_input;
+				// The input ended before the end tag
+				return res == result::ok ? result::invalid_input : res;
+			}
+			return delimited_message(msg, args...);
+		}
+
+		/**
+		 * \brief Parse a message prefixed by its length as varint, without a field header.
+		 *
+		 * This is the framing used by streams of length delimited records (see record_reader). The message is decoded using a nested
+		 * parser like message_field() does.
+		 * \param msg The message to parse into.
+		 * \param args Additional arguments passed to the decode function of the message.
+		 * \return Result code
 		 */
-		template <typename T> result message_field(T& msg) noexcept {
+		template <typename T, typename... Args> result delimited_message(T& msg, Args&... args) noexcept {
 			m_field_read = true;
 			uint64_t full_size;
 			auto res = m_decoder.varint(full_size);
 			if (res != result::ok) return res;
 			if (full_size > m_decoder.stream().bytes_available()) return result::invalid_input;
 			auto remaining = m_decoder.stream().bytes_available() - full_size;
-			subset_input_stream stream{m_decoder.stream(), full_size};
-			msg_parser parser{stream};
-			res = msg.decode(parser);
+			auto stream = nested_input_stream<TStream>::make(m_decoder.stream(), full_size);
+			basic_msg_parser<typename nested_input_stream<TStream>::parser_type> parser{stream};
+			res = msg.decode(parser, args...);
 			if (res != result::ok) return res;
 			if (m_decoder.stream().bytes_available() > remaining) res = m_decoder.stream().skip(m_decoder.stream().bytes_available() - remaining);
 			return res;
@@ -1339,7 +3832,7 @@ namespace minipb {
 		 */
 		template <typename T> result repeated_double_field(T& value) noexcept {
 			m_field_read = true;
-			return repeated_packable_field<T, double>(value, &msg_parser::double_field);
+			return repeated_fixed_field<T, double>(value, wire_type::fixed64, &basic_msg_parser::double_field);
 		}
 
 		/**
@@ -1349,7 +3842,7 @@ namespace minipb {
 		 */
 		template <typename T> result repeated_float_field(T& value) noexcept {
 			m_field_read = true;
-			return repeated_packable_field<T, float>(value, &msg_parser::float_field);
+			return repeated_fixed_field<T, float>(value, wire_type::fixed32, &basic_msg_parser::float_field);
 		}
 
 		/**
@@ -1359,7 +3852,7 @@ namespace minipb {
 		 */
 		template <typename T> result repeated_int32_field(T& value) noexcept {
 			m_field_read = true;
-			return repeated_packable_field<T, int32_t>(value, &msg_parser::int32_field);
+			return repeated_varint_field<T, int32_t, false>(value, &basic_msg_parser::int32_field);
 		}
 
 		/**
@@ -1369,7 +3862,7 @@ namespace minipb {
 		 */
 		template <typename T> result repeated_int64_field(T& value) noexcept {
 			m_field_read = true;
-			return repeated_packable_field<T, int64_t>(value, &msg_parser::int64_field);
+			return repeated_varint_field<T, int64_t, false>(value, &basic_msg_parser::int64_field);
 		}
 
 		/**
@@ -1379,7 +3872,7 @@ namespace minipb {
 		 */
 		template <typename T> result repeated_uint32_field(T& value) noexcept {
 			m_field_read = true;
-			return repeated_packable_field<T, uint32_t>(value, &msg_parser::uint32_field);
+			return repeated_varint_field<T, uint32_t, false>(value, &basic_msg_parser::uint32_field);
 		}
 
 		/**
@@ -1389,7 +3882,7 @@ namespace minipb {
 		 */
 		template <typename T> result repeated_uint64_field(T& value) noexcept {
 			m_field_read = true;
-			return repeated_packable_field<T, uint64_t>(value, &msg_parser::uint64_field);
+			return repeated_varint_field<T, uint64_t, false>(value, &basic_msg_parser::uint64_field);
 		}
 
 		/**
@@ -1399,7 +3892,7 @@ namespace minipb {
 		 */
 		template <typename T> result repeated_sint32_field(T& value) noexcept {
 			m_field_read = true;
-			return repeated_packable_field<T, int32_t>(value, &msg_parser::sint32_field);
+			return repeated_varint_field<T, int32_t, true>(value, &basic_msg_parser::sint32_field);
 		}
 
 		/**
@@ -1409,7 +3902,7 @@ namespace minipb {
 		 */
 		template <typename T> result repeated_sint64_field(T& value) noexcept {
 			m_field_read = true;
-			return repeated_packable_field<T, int64_t>(value, &msg_parser::sint64_field);
+			return repeated_varint_field<T, int64_t, true>(value, &basic_msg_parser::sint64_field);
 		}
 
 		/**
@@ -1419,7 +3912,7 @@ namespace minipb {
 		 */
 		template <typename T> result repeated_fixed32_field(T& value) noexcept {
 			m_field_read = true;
-			return repeated_packable_field<T, uint32_t>(value, &msg_parser::fixed32_field);
+			return repeated_fixed_field<T, uint32_t>(value, wire_type::fixed32, &basic_msg_parser::fixed32_field);
 		}
 
 		/**
@@ -1429,7 +3922,7 @@ namespace minipb {
 		 */
 		template <typename T> result repeated_fixed64_field(T& value) noexcept {
 			m_field_read = true;
-			return repeated_packable_field<T, uint64_t>(value, &msg_parser::fixed64_field);
+			return repeated_fixed_field<T, uint64_t>(value, wire_type::fixed64, &basic_msg_parser::fixed64_field);
 		}
 
 		/**
@@ -1439,7 +3932,7 @@ namespace minipb {
 		 */
 		template <typename T> result repeated_sfixed32_field(T& value) noexcept {
 			m_field_read = true;
-			return repeated_packable_field<T, int32_t>(value, &msg_parser::sfixed32_field);
+			return repeated_fixed_field<T, int32_t>(value, wire_type::fixed32, &basic_msg_parser::sfixed32_field);
 		}
 
 		/**
@@ -1449,7 +3942,7 @@ namespace minipb {
 		 */
 		template <typename T> result repeated_sfixed64_field(T& value) noexcept {
 			m_field_read = true;
-			return repeated_packable_field<T, int64_t>(value, &msg_parser::sfixed64_field);
+			return repeated_fixed_field<T, int64_t>(value, wire_type::fixed64, &basic_msg_parser::sfixed64_field);
 		}
 
 		/**
@@ -1459,17 +3952,26 @@ namespace minipb {
 		 */
 		template <typename T> result repeated_bool_field(T& value) noexcept {
 			m_field_read = true;
-			return repeated_packable_field<T, bool>(value, &msg_parser::bool_field);
+			return repeated_varint_field<T, bool, false>(value, &basic_msg_parser::bool_field);
 		}
 
 		/**
 		 * \brief Get the current field as a repeated string
-		 * \param value Variable to store the result in (needs to support push_back)
+		 * \param value Variable to store the result in (needs to support push_back and contain std::string or string_view)
+		 * \param args Additional arguments passed to string_field (e.g. an arena)
 		 * \return Result code
 		 */
-		template <typename T> result repeated_string_field(T& value) noexcept {
-			m_field_read = true;
-			return repeated_packable_field<T, std::string>(value, &msg_parser::string_field);
+		template <typename T, typename... Args> result repeated_string_field(T& value, Args&... args) noexcept {
+			// Strings are never packed, every element has its own field header
+			typename T::value_type v;
+			auto res = string_field(v, args...);
+			if (res != result::ok) return res;
+			try {
+				value.push_back(std::move(v));
+			} catch (...) {
+				return result::general_error;
+			}
+			return result::ok;
 		}
 
 		/**
@@ -1488,4 +3990,431 @@ namespace minipb {
 		bool is_eof() const noexcept { return m_decoder.is_eof(); }
 	};
 
+	/// Message parser using virtual dispatch for all stream calls, compatible with every input_stream.
+	using msg_parser = basic_msg_parser<input_stream>;
+
+	/**
+	 * \brief Storage of a field described by a field_entry, named after the basic_msg_parser function decoding it.
+	 */
+	enum class field_kind : uint8_t {
+		double_field,
+		float_field,
+		int32_field,
+		int64_field,
+		uint32_field,
+		uint64_field,
+		sint32_field,
+		sint64_field,
+		fixed32_field,
+		fixed64_field,
+		sfixed32_field,
+		sfixed64_field,
+		bool_field,
+		/// std::string
+		string_field,
+		/// string_view referencing the input
+		string_view_field,
+		/// std::unique_ptr of the submessage
+		message_field,
+		repeated_double_field,
+		repeated_float_field,
+		repeated_int32_field,
+		repeated_int64_field,
+		repeated_uint32_field,
+		repeated_uint64_field,
+		repeated_sint32_field,
+		repeated_sint64_field,
+		repeated_fixed32_field,
+		repeated_fixed64_field,
+		repeated_sfixed32_field,
+		repeated_sfixed64_field,
+		repeated_bool_field,
+		repeated_string_field,
+		repeated_string_view_field,
+		/// std::vector of std::unique_ptr of the submessage
+		repeated_message_field,
+	};
+
+	struct message_table;
+
+	/**
+	 * \brief Entry of a field table generated with the `table` option, describing how a field is decoded and where it is stored.
+	 */
+	struct field_entry {
+		/// Field number
+		uint32_t number;
+		/// Type of the member
+		field_kind kind;
+		/// Offset of the member inside the message
+		uint32_t offset;
+		/// Table of the submessage type (message fields only)
+		const message_table* table;
+		/// Allocates the submessage stored in the member and returns it, nullptr if out of memory (message fields only)
+		void* (*create)(void* member);
+		/// Index of the presence bit in the has_bits of the message, no_presence for fields without explicit presence
+		uint32_t has_bit;
+
+		/// Value of has_bit for fields without explicit presence
+		static constexpr uint32_t no_presence = UINT32_MAX;
+
+		/**
+		 * \brief Get the submessage of a singular message field, creating it if needed.
+		 * \tparam T The submessage type
+		 * \param member Pointer to the std::unique_ptr<T> member
+		 * \return The submessage or nullptr if out of memory
+		 */
+		template <typename T> static void* create_message(void* member) noexcept {
+			auto& ptr = *static_cast<std::unique_ptr<T>*>(member);
+			if (!ptr) ptr.reset(new (std::nothrow) T{});
+			return ptr.get();
+		}
+		/**
+		 * \brief Append a new submessage to a repeated message field.
+		 * \tparam T The submessage type
+		 * \param member Pointer to the std::vector<std::unique_ptr<T>> member
+		 * \return The new submessage or nullptr if out of memory
+		 */
+		template <typename T> static void* append_message(void* member) noexcept {
+			auto& vec = *static_cast<std::vector<std::unique_ptr<T>>*>(member);
+			std::unique_ptr<T> ptr{new (std::nothrow) T{}};
+			if (!ptr) return nullptr;
+			try {
+				vec.push_back(std::move(ptr));
+			} catch (...) {
+				return nullptr;
+			}
+			return vec.back().get();
+		}
+		/**
+		 * \brief Get the submessage of a singular message field stored inline (generated with the `inline_messages` option).
+		 * \tparam T The submessage type
+		 * \param member Pointer to the T member
+		 * \return The submessage
+		 */
+		template <typename T> static void* inline_message(void* member) noexcept { return static_cast<T*>(member); }
+		/**
+		 * \brief Append a new submessage to a repeated message field stored inline (generated with the `inline_messages` option).
+		 * \tparam T The submessage type
+		 * \param member Pointer to the std::vector<T> member
+		 * \return The new submessage or nullptr if out of memory
+		 */
+		template <typename T> static void* emplace_message(void* member) noexcept {
+			auto& vec = *static_cast<std::vector<T>*>(member);
+			try {
+				vec.emplace_back();
+			} catch (...) {
+				return nullptr;
+			}
+			return &vec.back();
+		}
+	};
+
+	/**
+	 * \brief Field table of a message, generated with the `table` option.
+	 *
+	 * A single generic parse loop decodes every message using its table instead of a switch generated per message, which keeps the
+	 * generated code small for large schemas. Fields are looked up by number, predicting that fields arrive in the order of the table.
+	 */
+	struct message_table {
+		/// Entries of all fields, sorted by field number
+		const field_entry* fields;
+		/// Number of entries
+		size_t count;
+		/// Offset of the has_bits member inside the message (only used if an entry has a presence bit)
+		size_t has_bits;
+
+		/**
+		 * \brief Decode a message described by this table.
+		 * \param p The parser to read from
+		 * \param msg The message to decode into
+		 * \return Result code
+		 */
+		template <typename TStream> result decode(basic_msg_parser<TStream>& p, void* msg) const noexcept {
+			auto base = static_cast<unsigned char*>(msg);
+			// Index of the entry expected next
+			size_t next = 0;
+			auto res = result::ok;
+			while (!p.is_eof()) {
+				res = p.next_field();
+				if (res != result::ok) break;
+				auto entry = find(p.field_id(), next);
+				if (entry == nullptr) {
+					res = p.skip_field();
+				} else {
+					res = decode_field(p, *entry, base + entry->offset);
+					if (entry->has_bit != field_entry::no_presence) set_present(base, entry->has_bit);
+					next = static_cast<size_t>(entry - fields) + 1;
+				}
+				if (res != result::ok) break;
+			}
+			return res;
+		}
+
+	private:
+		// Adapter passing a submessage to basic_msg_parser::message_field()
+		struct table_message {
+			const message_table& table;
+			void* msg;
+
+			template <typename TStream> result decode(basic_msg_parser<TStream>& p) noexcept { return table.decode(p, msg); }
+		};
+
+		const field_entry* find(uint64_t number, size_t next) const noexcept {
+			// Fields in declaration order hit the next entry, repeated elements the previous one
+			if (next < count && fields[next].number == number) return fields + next;
+			if (next != 0 && fields[next - 1].number == number) return fields + next - 1;
+			size_t lo = 0, hi = count;
+			while (lo < hi) {
+				auto mid = lo + (hi - lo) / 2;
+				if (fields[mid].number < number)
+					lo = mid + 1;
+				else
+					hi = mid;
+			}
+			return lo < count && fields[lo].number == number ? fields + lo : nullptr;
+		}
+
+		template <typename T> static T& member(void* ptr) noexcept { return *static_cast<T*>(ptr); }
+
+		// has_bits stores its words at the start of the object, independent of the number of bits
+		void set_present(unsigned char* base, uint32_t bit) const noexcept {
+			static_assert(std::is_standard_layout<minipb::has_bits<1>>::value, "has_bits needs to be standard layout");
+			auto words = reinterpret_cast<uint32_t*>(base + has_bits);
+			words[bit / 32] |= 1u << (bit % 32);
+		}
+
+		template <typename TStream> static result decode_field(basic_msg_parser<TStream>& p, const field_entry& entry, void* ptr) noexcept {
+			switch (entry.kind) {
+			case field_kind::double_field: return p.double_field(member<double>(ptr));
+			case field_kind::float_field: return p.float_field(member<float>(ptr));
+			case field_kind::int32_field: return p.int32_field(member<int32_t>(ptr));
+			case field_kind::int64_field: return p.int64_field(member<int64_t>(ptr));
+			case field_kind::uint32_field: return p.uint32_field(member<uint32_t>(ptr));
+			case field_kind::uint64_field: return p.uint64_field(member<uint64_t>(ptr));
+			case field_kind::sint32_field: return p.sint32_field(member<int32_t>(ptr));
+			case field_kind::sint64_field: return p.sint64_field(member<int64_t>(ptr));
+			case field_kind::fixed32_field: return p.fixed32_field(member<uint32_t>(ptr));
+			case field_kind::fixed64_field: return p.fixed64_field(member<uint64_t>(ptr));
+			case field_kind::sfixed32_field: return p.sfixed32_field(member<int32_t>(ptr));
+			case field_kind::sfixed64_field: return p.sfixed64_field(member<int64_t>(ptr));
+			case field_kind::bool_field: return p.bool_field(member<bool>(ptr));
+			case field_kind::string_field: return p.string_field(member<std::string>(ptr));
+			case field_kind::string_view_field: return p.string_field(member<string_view>(ptr));
+			case field_kind::message_field:
+			case field_kind::repeated_message_field: {
+				auto msg = entry.create(ptr);
+				if (msg == nullptr) return result::out_of_memory;
+				table_message sub{*entry.table, msg};
+				return p.message_field(sub);
+			}
+			case field_kind::repeated_double_field: return p.repeated_double_field(member<std::vector<double>>(ptr));
+			case field_kind::repeated_float_field: return p.repeated_float_field(member<std::vector<float>>(ptr));
+			case field_kind::repeated_int32_field: return p.repeated_int32_field(member<std::vector<int32_t>>(ptr));
+			case field_kind::repeated_int64_field: return p.repeated_int64_field(member<std::vector<int64_t>>(ptr));
+			case field_kind::repeated_uint32_field: return p.repeated_uint32_field(member<std::vector<uint32_t>>(ptr));
+			case field_kind::repeated_uint64_field: return p.repeated_uint64_field(member<std::vector<uint64_t>>(ptr));
+			case field_kind::repeated_sint32_field: return p.repeated_sint32_field(member<std::vector<int32_t>>(ptr));
+			case field_kind::repeated_sint64_field: return p.repeated_sint64_field(member<std::vector<int64_t>>(ptr));
+			case field_kind::repeated_fixed32_field: return p.repeated_fixed32_field(member<std::vector<uint32_t>>(ptr));
+			case field_kind::repeated_fixed64_field: return p.repeated_fixed64_field(member<std::vector<uint64_t>>(ptr));
+			case field_kind::repeated_sfixed32_field: return p.repeated_sfixed32_field(member<std::vector<int32_t>>(ptr));
+			case field_kind::repeated_sfixed64_field: return p.repeated_sfixed64_field(member<std::vector<int64_t>>(ptr));
+			case field_kind::repeated_bool_field: return p.repeated_bool_field(member<std::vector<bool>>(ptr));
+			case field_kind::repeated_string_field: return p.repeated_string_field(member<std::vector<std::string>>(ptr));
+			case field_kind::repeated_string_view_field: return p.repeated_string_field(member<std::vector<string_view>>(ptr));
+			}
+			return p.skip_field();
+		}
+	};
+
+	/**
+	 * \brief Writer for a stream of messages, each prefixed by its length as varint.
+	 *
+	 * Records are encoded into a batch buffer, which is passed to the output stream in a single write() once it exceeds the batch
+	 * size. Call flush() after the last record to write the rest (the destructor does so too, ignoring errors).
+	 */
+	class record_writer {
+		using buffer_stream = container_output_stream<std::vector<uint8_t>>;
+
+		output_stream& m_stream;
+		std::vector<uint8_t> m_buffer{};
+		size_t m_batch_size;
+		size_t m_records{0};
+
+	public:
+		/// Default size of the batch buffer in bytes
+		static constexpr size_t default_batch_size = 64 * 1024;
+
+		/**
+		 * \brief Construct a new record writer.
+		 * \param stream The stream to write the records to, needs to outlive the writer.
+		 * \param batch_size The number of bytes collected before writing them to the stream, 0 writes every record right away.
+		 */
+		explicit record_writer(output_stream& stream, size_t batch_size = default_batch_size) noexcept
+			: m_stream{stream}, m_batch_size{batch_size} {}
+		record_writer(const record_writer&) = delete;
+		record_writer& operator=(const record_writer&) = delete;
+		~record_writer() { flush(); }
+
+		/**
+		 * \brief Get the number of records written so far, including the ones still batched.
+		 * \return The number of records
+		 */
+		size_t records() const noexcept { return m_records; }
+		/**
+		 * \brief Append a message prefixed by its length to a buffer.
+		 * \param buffer The buffer to append to
+		 * \param msg The message to write, see basic_msg_builder::message_field() for the requirements.
+		 * \return Result code. If encoding fails the buffer is left unchanged.
+		 */
+		template <typename T> static result append(std::vector<uint8_t>& buffer, const T& msg) noexcept {
+			auto size = buffer.size();
+			auto res = result::out_of_space;
+			// Encode into an array sized by the estimate, which avoids growing the buffer field by field
+			if (auto estimate = msg.estimate_size()) {
+				try {
+					buffer.resize(size + 10 + estimate);
+				} catch (...) {
+					return result::out_of_memory;
+				}
+				array_output_stream stream{buffer.data() + size, 10 + estimate};
+				basic_msg_builder<array_output_stream> b{stream};
+				res = b.delimited_message(msg);
+				buffer.resize(res == result::ok ? size + stream.bytes_used() : size);
+			}
+			if (res == result::out_of_space) {
+				// The stream appends to the data already in the buffer
+				buffer_stream stream{buffer};
+				basic_msg_builder<buffer_stream> b{stream};
+				res = b.delimited_message(msg);
+				// Drop the partially encoded record
+				if (res != result::ok) buffer.resize(size);
+			}
+			return res;
+		}
+		/**
+		 * \brief Append a message to the stream.
+		 * \param msg The message to write, see basic_msg_builder::message_field() for the requirements.
+		 * \return Result code. If encoding fails the record is dropped from the batch.
+		 */
+		template <typename T> result write(const T& msg) noexcept {
+			auto res = append(m_buffer, msg);
+			if (res != result::ok) return res;
+			m_records++;
+			if (m_buffer.size() >= m_batch_size) res = flush();
+			return res;
+		}
+		/**
+		 * \brief Write all batched records to the stream.
+		 * \return Result code. If writing fails the records stay batched and the next flush() tries again.
+		 */
+		result flush() noexcept {
+			if (m_buffer.empty()) return result::ok;
+			auto res = m_stream.write(m_buffer.data(), m_buffer.size());
+			if (res == result::ok) m_buffer.clear();
+			return res;
+		}
+	};
+
+	/**
+	 * \brief Reader for a stream of messages, each prefixed by its length as varint.
+	 * \tparam TStream The stream type used for input. Records of contiguous streams are decoded in place using the nested stream type
+	 * (e.g. array_input_stream), without copying them.
+	 */
+	template <typename TStream> class basic_record_reader {
+		TStream& m_stream;
+		basic_msg_parser<TStream> m_parser;
+		size_t m_records{0};
+
+		result record_size(size_t& size) noexcept {
+			uint64_t len;
+			auto res = basic_decoder<TStream>{m_stream}.varint(len);
+			if (res != result::ok) return res;
+			if (len > m_stream.bytes_available()) return result::invalid_input;
+			size = static_cast<size_t>(len);
+			return result::ok;
+		}
+
+	public:
+		/**
+		 * \brief Construct a new record reader.
+		 * \param stream The stream containing the records
+		 */
+		explicit basic_record_reader(TStream& stream) noexcept : m_stream{stream}, m_parser{stream} {}
+
+		/**
+		 * \brief Get the number of records read (or skipped) so far.
+		 * \return The number of records
+		 */
+		size_t records() const noexcept { return m_records; }
+		/**
+		 * \brief Check if all records have been read.
+		 * \return true if there is no more data to read
+		 */
+		bool is_eof() const noexcept { return m_stream.bytes_available() == 0; }
+		/**
+		 * \brief Decode the next record.
+		 * \param msg The message to parse into.
+		 * \param args Additional arguments passed to the decode function of the message (e.g. an arena).
+		 * \return Result code
+		 */
+		template <typename T, typename... Args> result read(T& msg, Args&... args) noexcept {
+			auto res = m_parser.delimited_message(msg, args...);
+			if (res == result::ok) m_records++;
+			return res;
+		}
+		/**
+		 * \brief Get the encoded bytes of the next record without copying them.
+		 * \param record View of the record, references the stream memory.
+		 * \return Result code, result::general_error if the stream does not currently provide data(). Nothing is consumed in this case,
+		 * so the record can still be read using read(std::string&).
+		 */
+		result read(string_view& record) noexcept {
+			auto ptr = m_stream.data();
+			if (ptr == nullptr) return result::general_error;
+			// The length prefix is parsed in place, the stream is only advanced once the whole record is known to be available
+			auto end = ptr + m_stream.bytes_available();
+			uint64_t len;
+			auto start = basic_decoder<TStream>::varint_parse(ptr, end, len);
+			if (start == nullptr || len > static_cast<uint64_t>(end - start)) return result::invalid_input;
+			auto size = static_cast<size_t>(len);
+			record = string_view{reinterpret_cast<const char*>(start), size};
+			auto res = m_stream.skip(static_cast<size_t>(start - ptr) + size);
+			if (res == result::ok) m_records++;
+			return res;
+		}
+		/**
+		 * \brief Copy the encoded bytes of the next record.
+		 * \param record String receiving the record
+		 * \return Result code
+		 */
+		result read(std::string& record) noexcept {
+			size_t size;
+			auto res = record_size(size);
+			if (res != result::ok) return res;
+			try {
+				record.resize(size);
+			} catch (...) {
+				return result::out_of_memory;
+			}
+			res = size != 0 ? m_stream.read(&record[0], size) : result::ok;
+			if (res == result::ok) m_records++;
+			return res;
+		}
+		/**
+		 * \brief Skip the next record without decoding it.
+		 * \return Result code
+		 */
+		result skip() noexcept {
+			size_t size;
+			auto res = record_size(size);
+			if (res == result::ok) res = m_stream.skip(size);
+			if (res == result::ok) m_records++;
+			return res;
+		}
+	};
+
+	/// Record reader using virtual dispatch for all stream calls, compatible with every input_stream.
+	using record_reader = basic_record_reader<input_stream>;
+
 } // namespace minipb
\ No newline at end of file
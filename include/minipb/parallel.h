@@ -0,0 +1,358 @@
+#pragma once
+#include <minipb/minipb.h>
+#include <minipb/record_file.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+namespace minipb {
+	/**
+	 * \brief Work stealing thread pool used for parallel decoding.
+	 *
+	 * Every worker has a queue of its own. Tasks are distributed round robin and taken from the front of the queues, a worker runs its
+	 * own tasks in submission order and steals from the other queues once it runs out, so slow tasks do not leave other workers idle.
+	 * Tasks submitted first therefore also start first, which keeps ordered consumers from waiting on the oldest task.
+	 */
+	class thread_pool {
+		struct queue {
+			std::mutex mutex{};
+			std::deque<std::function<void()>> tasks{};
+		};
+
+		std::vector<std::unique_ptr<queue>> m_queues{};
+		std::vector<std::thread> m_threads{};
+		std::mutex m_mutex{};
+		std::condition_variable m_wakeup{};
+		std::condition_variable m_idle{};
+		// Tasks submitted but not finished yet
+		size_t m_pending{0};
+		// Tasks waiting in one of the queues
+		std::atomic<size_t> m_queued{0};
+		std::atomic<size_t> m_next{0};
+		bool m_stop{false};
+
+		bool take(size_t self, std::function<void()>& task) {
+			auto count = m_queues.size();
+			for (size_t i = 0; i < count; i++) {
+				auto& q = *m_queues[(self + i) % count];
+				std::lock_guard<std::mutex> lock{q.mutex};
+				if (q.tasks.empty()) continue;
+				task = std::move(q.tasks.front());
+				q.tasks.pop_front();
+				m_queued--;
+				return true;
+			}
+			return false;
+		}
+
+		void run(size_t self) {
+			std::function<void()> task;
+			while (true) {
+				if (take(self, task)) {
+					task();
+					task = nullptr;
+					std::lock_guard<std::mutex> lock{m_mutex};
+					if (--m_pending == 0) m_idle.notify_all();
+					continue;
+				}
+				std::unique_lock<std::mutex> lock{m_mutex};
+				m_wakeup.wait(lock, [this] { return m_stop || m_queued != 0; });
+				if (m_stop && m_queued == 0) return;
+			}
+		}
+
+	public:
+		/**
+		 * \brief Start the worker threads.
+		 * \param threads The number of threads, 0 uses one thread per hardware thread.
+		 */
+		explicit thread_pool(size_t threads = 0) {
+			if (threads == 0) threads = std::thread::hardware_concurrency();
+			if (threads == 0) threads = 1;
+			for (size_t i = 0; i < threads; i++)
+				m_queues.emplace_back(new queue{});
+			for (size_t i = 0; i < threads; i++)
+				m_threads.emplace_back(&thread_pool::run, this, i);
+		}
+		thread_pool(const thread_pool&) = delete;
+		thread_pool& operator=(const thread_pool&) = delete;
+		/**
+		 * \brief Finish all submitted tasks and stop the worker threads.
+		 */
+		~thread_pool() {
+			{
+				std::lock_guard<std::mutex> lock{m_mutex};
+				m_stop = true;
+			}
+			m_wakeup.notify_all();
+			for (auto& t : m_threads)
+				t.join();
+		}
+
+		/**
+		 * \brief Get the number of worker threads.
+		 * \return The number of threads
+		 */
+		size_t size() const noexcept { return m_threads.size(); }
+		/**
+		 * \brief Queue a task for execution on one of the workers.
+		 * \param task The task to run
+		 */
+		void submit(std::function<void()> task) {
+			auto& q = *m_queues[m_next++ % m_queues.size()];
+			{
+				std::lock_guard<std::mutex> lock{m_mutex};
+				m_pending++;
+			}
+			try {
+				std::lock_guard<std::mutex> lock{q.mutex};
+				q.tasks.push_back(std::move(task));
+				m_queued++;
+			} catch (...) {
+				// The task was never queued, wait() must not wait for it
+				std::lock_guard<std::mutex> lock{m_mutex};
+				if (--m_pending == 0) m_idle.notify_all();
+				throw;
+			}
+			// Taking the lock orders the notification after a worker checked m_queued
+			std::lock_guard<std::mutex> lock{m_mutex};
+			m_wakeup.notify_one();
+		}
+		/**
+		 * \brief Wait until all submitted tasks are finished.
+		 */
+		void wait() {
+			std::unique_lock<std::mutex> lock{m_mutex};
+			m_idle.wait(lock, [this] { return m_pending == 0; });
+		}
+	};
+
+	/**
+	 * \brief Decodes chunks of length delimited records on a thread_pool and delivers the messages through a callback.
+	 * \tparam T The message type, needs to be default constructible and provide `decode(basic_msg_parser<array_input_stream>&)`.
+	 */
+	template <typename T> class parallel_decoder {
+		// Memory holding the records of one chunk
+		struct span {
+			const void* data;
+			size_t size;
+		};
+		struct chunk {
+			span records;
+			std::vector<T> messages;
+			result res;
+			bool done;
+		};
+
+		thread_pool& m_pool;
+		bool m_ordered;
+
+		static result decode_chunk(span records, std::vector<T>* out, const std::function<void(T&)>* callback) noexcept {
+			array_input_stream stream{records.data, records.size};
+			basic_record_reader<array_input_stream> reader{stream};
+			while (!reader.is_eof()) {
+				T msg{};
+				auto res = reader.read(msg);
+				if (res != result::ok) return res;
+				if (out == nullptr) {
+					(*callback)(msg);
+					continue;
+				}
+				try {
+					out->push_back(std::move(msg));
+				} catch (...) {
+					return result::out_of_memory;
+				}
+			}
+			return result::ok;
+		}
+
+		// Waits for the chunks still in flight when run_ordered() is left, they reference its local state
+		struct drain_guard {
+			std::atomic<bool>& failed;
+			std::mutex& mutex;
+			std::condition_variable& done;
+			std::deque<std::unique_ptr<chunk>>& window;
+
+			~drain_guard() {
+				if (window.empty()) return;
+				// Skip decoding the chunks not started yet
+				failed = true;
+				for (auto& c : window) {
+					std::unique_lock<std::mutex> lock{mutex};
+					done.wait(lock, [&c] { return c->done; });
+				}
+			}
+		};
+
+		template <typename TSource> result run_ordered(TSource& next, const std::function<void(T&)>& callback) {
+			std::atomic<bool> failed{false};
+			std::mutex mutex;
+			std::condition_variable done;
+			// Chunks in flight, bounded so decoding does not run arbitrarily far ahead of the callback
+			std::deque<std::unique_ptr<chunk>> window;
+			// Declared after the state it references, so it runs first on every exit, including exceptions thrown by the callback
+			drain_guard guard{failed, mutex, done, window};
+			auto window_size = 4 * m_pool.size();
+			auto res = result::ok;
+			span records{nullptr, 0};
+			bool more = true;
+			while (res == result::ok && (more || !window.empty())) {
+				while (more && window.size() < window_size && (more = next(records))) {
+					try {
+						std::unique_ptr<chunk> owned{new chunk{records, {}, result::ok, false}};
+						window.push_back(std::move(owned));
+					} catch (...) {
+						return result::out_of_memory;
+					}
+					auto c = window.back().get();
+					auto task = [c, &failed, &mutex, &done] {
+						// Only set once delivery stopped, so the chunk reported first always carries the real error
+						auto r = failed ? result::ok : decode_chunk(c->records, &c->messages, nullptr);
+						std::lock_guard<std::mutex> lock{mutex};
+						c->res = r;
+						c->done = true;
+						done.notify_all();
+					};
+					try {
+						m_pool.submit(task);
+					} catch (...) {
+						// Never runs, so it must not be waited for
+						window.pop_back();
+						return result::out_of_memory;
+					}
+				}
+				if (window.empty()) break;
+				auto c = window.front().get();
+				{
+					std::unique_lock<std::mutex> lock{mutex};
+					done.wait(lock, [c] { return c->done; });
+				}
+				res = c->res;
+				// Includes the messages decoded before an error, so every record in front of it is delivered
+				for (auto& msg : c->messages)
+					callback(msg);
+				window.pop_front();
+			}
+			return res;
+		}
+
+		template <typename TSource> result run_unordered(TSource& next, const std::function<void(T&)>& callback) {
+			std::atomic<bool> failed{false};
+			std::mutex mutex;
+			std::condition_variable done;
+			size_t running = 0;
+			auto res = result::ok;
+			span records{nullptr, 0};
+			while (!failed && next(records)) {
+				{
+					std::unique_lock<std::mutex> lock{mutex};
+					// Limit the number of queued chunks
+					done.wait(lock, [&] { return running < 4 * m_pool.size(); });
+					running++;
+				}
+				try {
+					m_pool.submit([records, &callback, &failed, &mutex, &done, &running, &res] {
+						auto r = failed ? result::ok : decode_chunk(records, nullptr, &callback);
+						std::lock_guard<std::mutex> lock{mutex};
+						if (r != result::ok && res == result::ok) {
+							res = r;
+							failed = true;
+						}
+						running--;
+						done.notify_all();
+					});
+				} catch (...) {
+					// Wait for the chunks already submitted below, they reference the local state
+					std::lock_guard<std::mutex> lock{mutex};
+					running--;
+					if (res == result::ok) res = result::out_of_memory;
+					failed = true;
+				}
+			}
+			std::unique_lock<std::mutex> lock{mutex};
+			done.wait(lock, [&] { return running == 0; });
+			return res;
+		}
+
+		template <typename TSource, typename F> result run(TSource&& next, F&& cb) {
+			std::function<void(T&)> callback;
+			try {
+				callback = std::forward<F>(cb);
+			} catch (...) {
+				return result::out_of_memory;
+			}
+			// Only exceptions thrown by the callback leave this function, run_ordered() waits for all tasks before passing them on
+			return m_ordered ? run_ordered(next, callback) : run_unordered(next, callback);
+		}
+
+	public:
+		/**
+		 * \brief Construct a new decoder.
+		 * \param pool The pool decoding the chunks, needs to outlive the decoder.
+		 * \param ordered Deliver the messages in the order of the input on the calling thread. Otherwise the callback is called from
+		 * the worker threads concurrently, as soon as a message is decoded.
+		 * \note In ordered mode an exception thrown by the callback stops decoding and is passed on to the caller of decode(), after all
+		 * running tasks finished. In unordered mode the callback runs inside noexcept code on the workers and must not throw, an exception
+		 * calls std::terminate.
+		 */
+		explicit parallel_decoder(thread_pool& pool, bool ordered = true) noexcept : m_pool{pool}, m_ordered{ordered} {}
+
+		/**
+		 * \brief Decode all records of a record file, using one task per block.
+		 * \param file The file to decode
+		 * \param callback Function called as `void(T& msg)` for every decoded message
+		 * \return Result code, the first error stops decoding
+		 */
+		template <typename F> result decode(const record_file_reader& file, F&& callback) {
+			if (file.status() != result::ok) return file.status();
+			size_t block = 0;
+			return run(
+				[&file, &block](span& records) {
+					if (block == file.block_count()) return false;
+					auto stream = file.block(block++);
+					records = span{stream.data(), stream.bytes_available()};
+					return true;
+				},
+				std::forward<F>(callback));
+		}
+		/**
+		 * \brief Decode all records of a stream of length delimited records in memory (e.g. written by record_writer).
+		 *
+		 * The calling thread splits the input into chunks by skipping over the records, which is cheap compared to decoding them.
+		 * \param data The records
+		 * \param size The size of the records in bytes
+		 * \param callback Function called as `void(T& msg)` for every decoded message
+		 * \param chunk_size Approximate number of bytes decoded by each task
+		 * \return Result code, the first error stops decoding
+		 */
+		template <typename F> result decode(const void* data, size_t size, F&& callback, size_t chunk_size = 256 * 1024) {
+			array_input_stream input{data, size};
+			basic_record_reader<array_input_stream> scanner{input};
+			auto res = result::ok;
+			auto run_res = run(
+				[&](span& records) {
+					if (res != result::ok || scanner.is_eof()) return false;
+					auto start = input.data();
+					auto begin = input.bytes_available();
+					auto end = begin;
+					while (!scanner.is_eof() && begin - end < chunk_size) {
+						res = scanner.skip();
+						if (res != result::ok) break;
+						end = input.bytes_available();
+					}
+					// The records in front of a broken one still form a chunk, the next call stops because of res
+					if (end == begin) return false;
+					records = span{start, begin - end};
+					return true;
+				},
+				std::forward<F>(callback));
+			return run_res != result::ok ? run_res : res;
+		}
+	};
+} // namespace minipb
@@ -0,0 +1,343 @@
+#pragma once
+#include <minipb/minipb.h>
+
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+namespace minipb {
+	/**
+	 * \brief Input stream reading a file mapped into memory (POSIX only).
+	 *
+	 * Decoding can start right away, pages are loaded lazily by the kernel as the parser touches them. The stream exposes the mapping
+	 * using data(), so all contiguous fast paths (in place varint decoding, string_view fields, bulk packed fields) apply. Use array()
+	 * to parse it devirtualized with basic_msg_parser<array_input_stream>.
+	 */
+	class mmap_input_stream final : public input_stream {
+	public:
+		/// Hints passed to the kernel for the mapping, can be combined
+		enum hint : unsigned {
+			/// No hints
+			none = 0,
+			/// The file is read front to back (MADV_SEQUENTIAL), allowing aggressive read-ahead
+			sequential = 1 << 0,
+			/// Start reading the whole file in the background right away (MADV_WILLNEED)
+			willneed = 1 << 1,
+			/// Back the mapping with transparent huge pages if the filesystem supports it (MADV_HUGEPAGE), reducing TLB misses
+			huge_pages = 1 << 2,
+		};
+
+	private:
+		struct mapping {
+			unsigned char* data;
+			size_t size;
+			result status;
+		};
+
+		unsigned char* m_map;
+		size_t m_size;
+		result m_status;
+		array_input_stream m_array;
+
+		static mapping map(int fd, unsigned hints) noexcept {
+			struct stat st;
+			if (fd < 0 || fstat(fd, &st) != 0) return {nullptr, 0, result::general_error};
+			// Pipes, character devices and procfs files have no (meaningful) size and can not be mapped
+			if (!S_ISREG(st.st_mode)) return {nullptr, 0, result::general_error};
+			// Mapping an empty file fails, it is a valid empty stream though
+			if (st.st_size == 0) return {nullptr, 0, result::ok};
+			auto size = static_cast<size_t>(st.st_size);
+			auto data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+			if (data == MAP_FAILED) return {nullptr, 0, result::out_of_memory};
+			// Hints are best effort, failing to apply them does not affect correctness
+			if (hints & sequential) madvise(data, size, MADV_SEQUENTIAL);
+			if (hints & willneed) madvise(data, size, MADV_WILLNEED);
+#ifdef MADV_HUGEPAGE
+			if (hints & huge_pages) madvise(data, size, MADV_HUGEPAGE);
+#endif
+			return {static_cast<unsigned char*>(data), size, result::ok};
+		}
+
+		static mapping map(const char* path, unsigned hints) noexcept {
+			auto fd = ::open(path, O_RDONLY | O_CLOEXEC);
+			auto res = map(fd, hints);
+			// The mapping stays valid after closing the file
+			if (fd >= 0) ::close(fd);
+			return res;
+		}
+
+		explicit mmap_input_stream(const mapping& m) noexcept : m_map{m.data}, m_size{m.size}, m_status{m.status}, m_array{m.data, m.size} {}
+
+	public:
+		/**
+		 * \brief Map the file at the specified path.
+		 * \param path The path of the file
+		 * \param hints A combination of hint values
+		 */
+		explicit mmap_input_stream(const char* path, unsigned hints = sequential) noexcept : mmap_input_stream(map(path, hints)) {}
+		/**
+		 * \brief Map an open file. The file descriptor is not needed after construction and stays owned by the caller.
+		 * \param fd A file descriptor opened for reading
+		 * \param hints A combination of hint values
+		 */
+		explicit mmap_input_stream(int fd, unsigned hints = sequential) noexcept : mmap_input_stream(map(fd, hints)) {}
+		mmap_input_stream(const mmap_input_stream&) = delete;
+		mmap_input_stream& operator=(const mmap_input_stream&) = delete;
+		~mmap_input_stream() {
+			if (m_map != nullptr) munmap(m_map, m_size);
+		}
+
+		/**
+		 * \brief Check if the file was mapped successfully.
+		 * \return result::ok, result::general_error if the file could not be opened or is not a regular file or result::out_of_memory if mapping it
+		 * failed.
+		 */
+		result status() const noexcept { return m_status; }
+		/**
+		 * \brief Get the size of the mapped file.
+		 * \return The size in bytes
+		 */
+		size_t size() const noexcept { return m_size; }
+		/**
+		 * \brief Get the number of bytes used so far.
+		 * \return The number of bytes used.
+		 */
+		size_t bytes_used() const noexcept { return m_array.bytes_used(); }
+		size_t bytes_available() const noexcept override { return m_array.bytes_available(); }
+		result read(void* data, size_t data_size) noexcept override { return m_array.read(data, data_size); }
+		result skip(size_t data_size) noexcept override { return m_array.skip(data_size); }
+		size_t peek(void* data, size_t data_size) noexcept override { return m_array.peek(data, data_size); }
+		const unsigned char* data() const noexcept override { return m_array.data(); }
+		/**
+		 * \brief Get a stream covering the next len bytes without consuming them.
+		 * \param len The maximum number of bytes the new stream covers. Clamped to the bytes available.
+		 * \return A new stream starting at the current position.
+		 */
+		array_input_stream subset(size_t len) const noexcept { return m_array.subset(len); }
+		/**
+		 * \brief Get a stream covering the rest of the file, which can be parsed using basic_msg_parser<array_input_stream>.
+		 * \return A new stream starting at the current position.
+		 */
+		array_input_stream array() const noexcept { return m_array.subset(m_array.bytes_available()); }
+		/**
+		 * \brief Reset the stream by putting the iterator at the start of the file.
+		 */
+		void reset() noexcept { m_array.reset(); }
+	};
+
+	/**
+	 * \brief Source for buffered_input_stream reading from a file descriptor (pipe, socket, file, ...).
+	 *
+	 * The file descriptor stays owned by the caller.
+	 */
+	struct fd_reader {
+		/// The file descriptor to read from
+		int fd;
+
+		size_t operator()(void* data, size_t size) noexcept {
+			while (true) {
+				auto n = ::read(fd, data, size);
+				if (n >= 0) return static_cast<size_t>(n);
+				if (errno != EINTR) return 0;
+			}
+		}
+	};
+
+	/**
+	 * \brief Write a list of buffers to a file descriptor using writev(), retrying until everything is written.
+	 * \param fd The file descriptor to write to
+	 * \param iov The buffers to write. Gets modified while writing.
+	 * \param count The number of buffers
+	 * \return result::ok or result::general_error if writing failed
+	 */
+	inline result writev_all(int fd, struct iovec* iov, int count) noexcept {
+		while (count != 0) {
+			auto n = ::writev(fd, iov, count);
+			if (n < 0) {
+				if (errno == EINTR) continue;
+				return result::general_error;
+			}
+			auto written = static_cast<size_t>(n);
+			// Drop the buffers written completely and adjust the one written partially
+			while (count != 0 && written >= iov->iov_len) {
+				written -= iov->iov_len;
+				iov++;
+				count--;
+			}
+			if (count != 0) {
+				iov->iov_base = static_cast<unsigned char*>(iov->iov_base) + written;
+				iov->iov_len -= written;
+			}
+		}
+		return result::ok;
+	}
+
+	/**
+	 * \brief Write all segments of a stream providing for_each_segment() (e.g. segmented_output_stream) to a file descriptor.
+	 *
+	 * The segments are passed to writev() in batches, without copying them.
+	 * \param fd The file descriptor to write to
+	 * \param stream The stream to write
+	 * \return result::ok or result::general_error if writing failed
+	 */
+	template <typename TStream> result write_segments(int fd, const TStream& stream) noexcept {
+		constexpr int batch_size = 64;
+		struct iovec iov[batch_size];
+		int count = 0;
+		auto res = result::ok;
+		stream.for_each_segment([&](const unsigned char* data, size_t size) {
+			if (res != result::ok) return;
+			iov[count].iov_base = const_cast<unsigned char*>(data);
+			iov[count].iov_len = size;
+			if (++count == batch_size) {
+				res = writev_all(fd, iov, count);
+				count = 0;
+			}
+		});
+		if (res == result::ok && count != 0) res = writev_all(fd, iov, count);
+		return res;
+	}
+
+	/**
+	 * \brief Output stream writing to a file descriptor through a fixed size buffer (POSIX only).
+	 *
+	 * Writes are collected in the buffer and written to the file descriptor in full blocks, data larger than the buffer is written
+	 * together with the buffered bytes using a single writev(). write_at() patches the buffer if the position is still buffered and
+	 * uses pwrite() otherwise, so messages of any size can be serialized with bounded memory. Patching flushed data requires a seekable
+	 * file not opened with O_APPEND, for pipes and sockets it fails with result::invalid_position.
+	 * A failed write puts the stream into an error state: the buffered bytes are kept, position() does not change and all further
+	 * operations return the error. The file descriptor stays owned by the caller, call flush() before using it.
+	 */
+	class fd_output_stream final : public output_stream {
+		int m_fd;
+		unsigned char* m_buffer;
+		size_t m_capacity;
+		size_t m_used{0};
+		// Bytes written to the file descriptor so far
+		size_t m_flushed{0};
+		// File offset of position 0, negative if the file is not seekable
+		off_t m_offset;
+		// Sticky error of a failed write, the file contents are unknown afterwards
+		result m_error{result::ok};
+
+		result write_all(struct iovec* iov, int count, size_t total) noexcept {
+			auto res = writev_all(m_fd, iov, count);
+			if (res == result::ok)
+				m_flushed += total;
+			else
+				m_error = res;
+			return res;
+		}
+
+	public:
+		/// Default size of the buffer in bytes
+		static constexpr size_t default_buffer_size = 64 * 1024;
+
+		/**
+		 * \brief Construct a new stream writing to fd.
+		 * \param fd A file descriptor opened for writing
+		 * \param buffer_size The size of the buffer in bytes
+		 */
+		explicit fd_output_stream(int fd, size_t buffer_size = default_buffer_size) noexcept
+			: m_fd{fd}, m_buffer{nullptr}, m_capacity{buffer_size}, m_offset{::lseek(fd, 0, SEEK_CUR)} {
+			if (m_capacity == 0) m_capacity = 1;
+			m_buffer = new (std::nothrow) unsigned char[m_capacity];
+		}
+		fd_output_stream(const fd_output_stream&) = delete;
+		fd_output_stream& operator=(const fd_output_stream&) = delete;
+		/**
+		 * \brief Flush the remaining data and destroy the stream. Call flush() beforehand to check for errors.
+		 */
+		~fd_output_stream() {
+			flush();
+			delete[] m_buffer;
+		}
+
+		/**
+		 * \brief Check if the buffer was allocated successfully and no write failed.
+		 * \return result::ok, result::out_of_memory or result::general_error if writing to the file descriptor failed
+		 */
+		result status() const noexcept {
+			if (m_buffer == nullptr) return result::out_of_memory;
+			return m_error;
+		}
+		/**
+		 * \brief Write all buffered data to the file descriptor.
+		 * \return result::ok or result::general_error if writing failed (now or before)
+		 */
+		result flush() noexcept {
+			if (m_error != result::ok) return m_error;
+			if (m_used == 0) return result::ok;
+			struct iovec iov = {m_buffer, m_used};
+			auto res = write_all(&iov, 1, iov.iov_len);
+			if (res == result::ok) m_used = 0;
+			return res;
+		}
+		size_t position() const noexcept override { return m_flushed + m_used; }
+		result write(const void* data, size_t data_size) noexcept override {
+			if (m_buffer == nullptr) return result::out_of_memory;
+			if (m_error != result::ok) return m_error;
+			auto ptr = static_cast<const unsigned char*>(data);
+			if (data_size > m_capacity - m_used) {
+				// Large blocks are written together with the buffer contents
+				if (m_used + data_size >= 2 * m_capacity) {
+					struct iovec iov[2] = {{m_buffer, m_used}, {const_cast<unsigned char*>(ptr), data_size}};
+					auto res = write_all(iov, 2, iov[0].iov_len + data_size);
+					if (res == result::ok) m_used = 0;
+					return res;
+				}
+				// Otherwise fill up the buffer and flush it as a full block
+				auto n = m_capacity - m_used;
+				memcpy(m_buffer + m_used, ptr, n);
+				auto used = m_used;
+				m_used = m_capacity;
+				auto res = flush();
+				if (res != result::ok) {
+					// The caller sees the whole write failing, keep position() where it was
+					m_used = used;
+					return res;
+				}
+				ptr += n;
+				data_size -= n;
+			}
+			memcpy(m_buffer + m_used, ptr, data_size);
+			m_used += data_size;
+			return result::ok;
+		}
+		result write_at(size_t pos, const void* data, size_t data_size) noexcept override {
+			if (m_error != result::ok) return m_error;
+			if (pos + data_size > position()) return result::invalid_position;
+			auto ptr = static_cast<const unsigned char*>(data);
+			if (pos < m_flushed) {
+				if (m_offset < 0) return result::invalid_position;
+				auto n = m_flushed - pos < data_size ? m_flushed - pos : data_size;
+				while (n != 0) {
+					auto res = ::pwrite(m_fd, ptr, n, m_offset + static_cast<off_t>(pos));
+					if (res < 0) {
+						if (errno == EINTR) continue;
+						m_error = result::general_error;
+						return m_error;
+					}
+					auto written = static_cast<size_t>(res);
+					ptr += written;
+					pos += written;
+					n -= written;
+					data_size -= written;
+				}
+			}
+			// Patches of flushed data are done here, pos may be before the buffer
+			if (data_size != 0) memcpy(m_buffer + (pos - m_flushed), ptr, data_size);
+			return result::ok;
+		}
+	};
+
+	/// Submessages of a mmap_input_stream are parsed as array_input_stream
+	template <> struct nested_input_stream<mmap_input_stream> {
+		using type = array_input_stream;
+		using parser_type = array_input_stream;
+		static type make(mmap_input_stream& parent, size_t len) noexcept { return parent.subset(len); }
+	};
+} // namespace minipb
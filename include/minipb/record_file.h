@@ -0,0 +1,281 @@
+#pragma once
+#include <minipb/minipb.h>
+
+namespace minipb {
+	/**
+	 * \brief Layout of record files written by record_file_writer.
+	 *
+	 * All integers are stored as fixed32/fixed64 values (host byte order, like all fixed values written by minipb).
+	 *
+	 *     file header:  fixed32 magic, fixed32 version
+	 *     block:        fixed32 payload size, fixed32 record count, payload (records prefixed by their length as varint)
+	 *     ...
+	 *     index:        per block: fixed64 offset of the block header, fixed32 record count
+	 *     trailer:      fixed64 offset of the index, fixed64 block count, fixed32 magic
+	 *
+	 * Records never span blocks, so every block can be decoded on its own using basic_record_reader.
+	 */
+	namespace record_file {
+		/// Magic value at the start and end of a record file ("MPRF")
+		constexpr uint32_t magic = 0x4652504d;
+		/// Format version
+		constexpr uint32_t version = 1;
+		/// Size of the file header
+		constexpr size_t header_size = 8;
+		/// Size of a block header
+		constexpr size_t block_header_size = 8;
+		/// Size of an index entry
+		constexpr size_t index_entry_size = 12;
+		/// Size of the trailer
+		constexpr size_t trailer_size = 20;
+		/// Default payload size at which a block is completed
+		constexpr size_t default_block_size = 1024 * 1024;
+	} // namespace record_file
+
+	/**
+	 * \brief Writer for record files, which store messages in independent blocks followed by an index of all blocks.
+	 *
+	 * The output only needs to support write(), blocks are collected in memory and written once they reach the block size.
+	 * finish() needs to be called after the last record to write the index, otherwise the file can not be read.
+	 */
+	class record_file_writer {
+		output_stream& m_stream;
+		size_t m_block_size;
+		std::vector<uint8_t> m_block{};
+		uint32_t m_block_records{0};
+		std::vector<uint8_t> m_index{};
+		uint64_t m_blocks{0};
+		uint64_t m_records{0};
+		// Bytes written to the stream so far
+		uint64_t m_position{0};
+
+		result write_header() noexcept {
+			if (m_position != 0) return result::ok;
+			encoder e{m_stream};
+			auto res = e.fixed32(record_file::magic);
+			if (res == result::ok) res = e.fixed32(record_file::version);
+			if (res == result::ok) m_position = record_file::header_size;
+			return res;
+		}
+
+		result write_block() noexcept {
+			if (m_block_records == 0) return result::ok;
+			// The payload size is stored as fixed32
+			if (m_block.size() > UINT32_MAX) return result::general_error;
+			container_output_stream<std::vector<uint8_t>> index{m_index};
+			encoder entry{index};
+			auto res = entry.fixed64(m_position);
+			if (res == result::ok) res = entry.fixed32(m_block_records);
+			encoder e{m_stream};
+			if (res == result::ok) res = e.fixed32(static_cast<uint32_t>(m_block.size()));
+			if (res == result::ok) res = e.fixed32(m_block_records);
+			if (res == result::ok) res = e.fixed(m_block.data(), m_block.size());
+			if (res != result::ok) return res;
+			m_position += record_file::block_header_size + m_block.size();
+			m_blocks++;
+			m_block.clear();
+			m_block_records = 0;
+			return result::ok;
+		}
+
+	public:
+		/**
+		 * \brief Construct a new writer.
+		 * \param stream The stream to write the file to, needs to outlive the writer.
+		 * \param block_size The payload size at which a block is completed. Larger records get a block of their own.
+		 */
+		explicit record_file_writer(output_stream& stream, size_t block_size = record_file::default_block_size) noexcept
+			: m_stream{stream}, m_block_size{block_size} {}
+		record_file_writer(const record_file_writer&) = delete;
+		record_file_writer& operator=(const record_file_writer&) = delete;
+
+		/**
+		 * \brief Get the number of records written so far.
+		 * \return The number of records
+		 */
+		uint64_t records() const noexcept { return m_records; }
+		/**
+		 * \brief Append a message to the file.
+		 * \param msg The message to write, see basic_msg_builder::message_field() for the requirements.
+		 * \return Result code
+		 */
+		template <typename T> result write(const T& msg) noexcept {
+			auto res = write_header();
+			if (res != result::ok) return res;
+			auto size = m_block.size();
+			res = record_writer::append(m_block, msg);
+			if (res != result::ok) return res;
+			// Complete the current block first if the record does not fit anymore
+			if (size != 0 && m_block.size() > m_block_size) {
+				std::vector<uint8_t> record;
+				try {
+					record.assign(m_block.begin() + size, m_block.end());
+				} catch (...) {
+					m_block.resize(size);
+					return result::out_of_memory;
+				}
+				m_block.resize(size);
+				res = write_block();
+				if (res != result::ok) return res;
+				m_block.swap(record);
+			}
+			m_block_records++;
+			m_records++;
+			if (m_block.size() >= m_block_size || m_block_records == UINT32_MAX) return write_block();
+			return result::ok;
+		}
+		/**
+		 * \brief Write the last block, the index and the trailer.
+		 * \return Result code
+		 */
+		result finish() noexcept {
+			auto res = write_header();
+			if (res == result::ok) res = write_block();
+			if (res != result::ok) return res;
+			encoder e{m_stream};
+			if (!m_index.empty()) res = e.fixed(m_index.data(), m_index.size());
+			if (res == result::ok) res = e.fixed64(m_position);
+			if (res == result::ok) res = e.fixed64(m_blocks);
+			if (res == result::ok) res = e.fixed32(record_file::magic);
+			return res;
+		}
+	};
+
+	/**
+	 * \brief Reader for record files written by record_file_writer.
+	 *
+	 * The file needs to be available as contiguous memory, e.g. using mmap_input_stream from minipb/posix.h. Blocks are located using
+	 * the index, so any block can be read directly and the file can be split into independent ranges for parallel processing.
+	 * The number of records is known without decoding anything.
+	 */
+	class record_file_reader {
+		const unsigned char* m_data{nullptr};
+		size_t m_size{0};
+		const unsigned char* m_index{nullptr};
+		size_t m_blocks{0};
+		uint64_t m_records{0};
+		result m_status{result::ok};
+
+		template <typename T> static T load(const unsigned char* ptr) noexcept {
+			T val;
+			memcpy(&val, ptr, sizeof(val));
+			return val;
+		}
+
+		result open() noexcept {
+			if (m_size < record_file::header_size + record_file::trailer_size) return result::invalid_input;
+			if (load<uint32_t>(m_data) != record_file::magic || load<uint32_t>(m_data + 4) != record_file::version) return result::invalid_input;
+			auto trailer = m_data + m_size - record_file::trailer_size;
+			if (load<uint32_t>(trailer + 16) != record_file::magic) return result::invalid_input;
+			auto index_offset = load<uint64_t>(trailer);
+			auto blocks = load<uint64_t>(trailer + 8);
+			auto index_end = m_size - record_file::trailer_size;
+			if (index_offset < record_file::header_size || index_offset > index_end) return result::invalid_input;
+			if (blocks != (index_end - index_offset) / record_file::index_entry_size ||
+				(index_end - index_offset) % record_file::index_entry_size != 0)
+				return result::invalid_input;
+			m_index = m_data + index_offset;
+			m_blocks = static_cast<size_t>(blocks);
+			// Blocks follow each other without gaps, which also guarantees every block lies inside the file
+			uint64_t expected = record_file::header_size;
+			uint64_t records = 0;
+			for (size_t i = 0; i < m_blocks; i++) {
+				auto offset = block_offset(i);
+				if (offset != expected || index_offset - offset < record_file::block_header_size) return result::invalid_input;
+				auto payload = load<uint32_t>(m_data + offset);
+				if (payload > index_offset - offset - record_file::block_header_size) return result::invalid_input;
+				if (load<uint32_t>(m_data + offset + 4) != block_records(i)) return result::invalid_input;
+				expected = offset + record_file::block_header_size + payload;
+				records += block_records(i);
+			}
+			if (expected != index_offset) return result::invalid_input;
+			m_records = records;
+			return result::ok;
+		}
+
+		uint64_t block_offset(size_t i) const noexcept { return load<uint64_t>(m_index + i * record_file::index_entry_size); }
+
+	public:
+		/**
+		 * \brief Range of blocks [first, last).
+		 */
+		struct range {
+			/// Index of the first block
+			size_t first;
+			/// Index after the last block
+			size_t last;
+		};
+
+		/**
+		 * \brief Open a record file in memory and validate its index.
+		 * \param data The contents of the file, needs to outlive the reader.
+		 * \param size The size of the file in bytes
+		 */
+		record_file_reader(const void* data, size_t size) noexcept : m_data{static_cast<const unsigned char*>(data)}, m_size{size} {
+			m_status = open();
+			if (m_status != result::ok) {
+				m_index = nullptr;
+				m_blocks = 0;
+			}
+		}
+
+		/**
+		 * \brief Check if the file was opened successfully.
+		 * \return result::ok or result::invalid_input if the file is not a valid record file
+		 */
+		result status() const noexcept { return m_status; }
+		/**
+		 * \brief Get the number of blocks in the file.
+		 * \return The number of blocks
+		 */
+		size_t block_count() const noexcept { return m_blocks; }
+		/**
+		 * \brief Get the number of records in the file, without decoding any of them.
+		 * \return The number of records
+		 */
+		uint64_t record_count() const noexcept { return m_records; }
+		/**
+		 * \brief Get the number of records in a block.
+		 * \param i The index of the block
+		 * \return The number of records
+		 */
+		uint32_t block_records(size_t i) const noexcept { return load<uint32_t>(m_index + i * record_file::index_entry_size + 8); }
+		/**
+		 * \brief Get the records of a block, which can be read using basic_record_reader<array_input_stream>.
+		 * \param i The index of the block
+		 * \return A stream covering the payload of the block
+		 */
+		array_input_stream block(size_t i) const noexcept {
+			auto header = m_data + block_offset(i);
+			return array_input_stream{header + record_file::block_header_size, load<uint32_t>(header)};
+		}
+		/**
+		 * \brief Split the file into parts of roughly equal size.
+		 *
+		 * Every block belongs to exactly one part, parts can be empty if there are less blocks than parts.
+		 * \param part The index of the part to return
+		 * \param parts The total number of parts
+		 * \return The range of blocks belonging to the part
+		 */
+		range split(size_t part, size_t parts) const noexcept {
+			if (parts == 0 || part >= parts || m_blocks == 0) return range{m_blocks, m_blocks};
+			// A block belongs to the part its start offset falls into
+			auto begin = record_file::header_size;
+			auto total = static_cast<uint64_t>(m_index - m_data) - begin;
+			auto find = [&](size_t p) -> size_t {
+				if (p >= parts) return m_blocks;
+				auto target = begin + total / parts * p + total % parts * p / parts;
+				size_t lo = 0, hi = m_blocks;
+				while (lo < hi) {
+					auto mid = lo + (hi - lo) / 2;
+					if (block_offset(mid) < target)
+						lo = mid + 1;
+					else
+						hi = mid;
+				}
+				return lo;
+			};
+			return range{find(part), find(part + 1)};
+		}
+	};
+} // namespace minipb
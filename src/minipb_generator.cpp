@@ -1,5 +1,7 @@
 #include <algorithm>
+#include <functional>
 #include <iostream>
+#include <set>
 #include <sstream>
 
 #include <google/protobuf/compiler/code_generator.h>
@@ -13,6 +15,17 @@
 using namespace google::protobuf;
 using namespace std::literals;
 
+struct GeneratorOptions {
+	// Emit string and bytes fields as ::minipb::string_view referencing the decoded buffer
+	bool string_view{false};
+	// Allocate submessages, strings and repeated fields from a ::minipb::arena passed to decode
+	bool arena{false};
+	// Decode using a generated field table and the generic parse loop of ::minipb::message_table instead of a switch per message
+	bool table{false};
+	// Store submessages inside their parent: repeated ones as std::vector<T>, singular ones as T unless the schema is recursive
+	bool inline_messages{false};
+};
+
 class DummyCodeGenerator : public compiler::CodeGenerator {
 public:
 	DummyCodeGenerator();
@@ -22,49 +35,198 @@ public:
 		const std::string& parameter,
 		compiler::GeneratorContext* context,
 		std::string* error) const;
-
-	bool GenerateHeader(const FileDescriptor* file, compiler::GeneratorContext* context, std::string* error) const;
-	bool GenerateImpl(const FileDescriptor* file, compiler::GeneratorContext* context, std::string* error) const;
-
-	void EmitStructure(const std::map<std::string, std::string>& global_args, const Descriptor* d, io::Printer& printer) const;
-	void EmitEstimateSize(const std::map<std::string, std::string>& message_args, const Descriptor* m, io::Printer& printer) const;
-	void EmitEncode(const std::map<std::string, std::string>& message_args, const Descriptor* m, io::Printer& printer) const;
-	void EmitDecode(const std::map<std::string, std::string>& message_args, const Descriptor* m, io::Printer& printer) const;
+	virtual uint64_t GetSupportedFeatures() const { return FEATURE_PROTO3_OPTIONAL; }
+
+	bool ParseOptions(const std::string& parameter, GeneratorOptions& options, std::string* error) const;
+	bool GenerateHeader(const FileDescriptor* file, const GeneratorOptions& options, compiler::GeneratorContext* context, std::string* error) const;
+	bool GenerateImpl(const FileDescriptor* file, const GeneratorOptions& options, compiler::GeneratorContext* context, std::string* error) const;
+
+	void EmitStructure(const std::map<std::string, std::string>& global_args, const GeneratorOptions& options, const Descriptor* d,
+					   io::Printer& printer) const;
+	void EmitEstimateSize(const std::map<std::string, std::string>& message_args, const GeneratorOptions& options, const Descriptor* m,
+						  io::Printer& printer) const;
+	void EmitByteSize(const std::map<std::string, std::string>& message_args, const GeneratorOptions& options, const Descriptor* m,
+					  io::Printer& printer) const;
+	void EmitEncode(const std::map<std::string, std::string>& message_args, const GeneratorOptions& options, const Descriptor* m, bool reverse,
+					io::Printer& printer) const;
+	void EmitEncodeBody(const std::map<std::string, std::string>& message_args, const GeneratorOptions& options, const Descriptor* m, bool reverse,
+						io::Printer& printer) const;
+	void EmitDecode(const std::map<std::string, std::string>& message_args, const GeneratorOptions& options, const Descriptor* m, io::Printer& printer) const;
+	void EmitTable(const std::map<std::string, std::string>& message_args, const GeneratorOptions& options, const Descriptor* m, io::Printer& printer) const;
 };
 
 DummyCodeGenerator::DummyCodeGenerator() {}
 
 DummyCodeGenerator::~DummyCodeGenerator() {}
 
-static size_t varint_size(size_t v) {
-	if (v < (1 << 8)) return 1;
-	if (v < (1 << 15)) return 2;
-	if (v < (1 << 22)) return 3;
-	if (v < (1 << 29)) return 4;
-	if (v < (1l << 36)) return 5;
-	if (v < (1l << 43)) return 7;
-	if (v < (1l << 50)) return 8;
-	if (v < (1l << 57)) return 9;
-	return 10;
+static size_t varint_size(uint64_t v) {
+	size_t size = 1;
+	for (; v >= 0x80; v >>= 7)
+		size++;
+	return size;
 }
 
 static size_t header_size(size_t field_id) {
 	return varint_size(field_id << 3);
 }
 
+// Stream types the generated encode/decode templates are explicitly instantiated for
+static const char* const input_stream_types[] = {"::minipb::input_stream", "::minipb::array_input_stream", "::minipb::container_input_stream",
+												 "::minipb::subset_input_stream"};
+static const char* const output_stream_types[] = {"::minipb::output_stream", "::minipb::array_output_stream", "::minipb::container_output_stream<std::string>",
+												  "::minipb::container_output_stream<std::vector<uint8_t>>"};
+
+// Wire type the encoder emits for a field
+static const char* field_wire_type(const FieldDescriptor* fd) {
+	if (fd->is_packed()) return "length_blob";
+	switch (fd->type()) {
+	case FieldDescriptor::TYPE_DOUBLE:
+	case FieldDescriptor::TYPE_FIXED64:
+	case FieldDescriptor::TYPE_SFIXED64: return "fixed64";
+	case FieldDescriptor::TYPE_FLOAT:
+	case FieldDescriptor::TYPE_FIXED32:
+	case FieldDescriptor::TYPE_SFIXED32: return "fixed32";
+	case FieldDescriptor::TYPE_STRING:
+	case FieldDescriptor::TYPE_BYTES:
+	case FieldDescriptor::TYPE_MESSAGE: return "length_blob";
+	case FieldDescriptor::TYPE_GROUP: throw std::logic_error("unsupported");
+	default: return "varint";
+	}
+}
+
+// Checks if a message contains another one through singular submessages, directly or indirectly
+static bool contains_message(const Descriptor* m, const Descriptor* other) {
+	std::vector<const Descriptor*> pending{m};
+	std::set<const Descriptor*> visited;
+	while (!pending.empty()) {
+		auto cur = pending.back();
+		pending.pop_back();
+		if (cur == other) return true;
+		if (!visited.insert(cur).second) continue;
+		for (int f = 0; f < cur->field_count(); f++) {
+			auto fd = cur->field(f);
+			if (fd->type() == FieldDescriptor::TYPE_MESSAGE && !fd->is_repeated()) pending.push_back(fd->message_type());
+		}
+	}
+	return false;
+}
+
+// Submessages stored by value with the inline_messages option. Repeated ones always are, since std::vector allows an incomplete element
+// type. Singular ones need the complete type, so they stay behind a pointer if their type contains the parent (the type would be
+// infinitely large) or is defined in another file.
+static bool inline_message(const GeneratorOptions& options, const FieldDescriptor* fd) {
+	if (!options.inline_messages || fd->type() != FieldDescriptor::TYPE_MESSAGE) return false;
+	if (fd->is_repeated()) return true;
+	return fd->message_type()->file() == fd->containing_type()->file() && !contains_message(fd->message_type(), fd->containing_type());
+}
+
+// proto3 `optional` fields are wrapped in a synthetic oneof, proto2 optional fields (which have the keyword as well) are not
+static bool proto3_optional(const FieldDescriptor* fd) {
+	return fd->has_optional_keyword() && fd->containing_oneof() != nullptr && fd->real_containing_oneof() == nullptr;
+}
+
+// proto3 optional fields are tracked in the has_bits of their message, as are inline submessages. Submessages behind a pointer are
+// absent if it is null. Other fields with presence (proto2 optional and required fields) have no bit, they are always encoded.
+static bool has_presence_bit(const GeneratorOptions& options, const FieldDescriptor* fd) {
+	if (fd->is_repeated()) return false;
+	if (fd->type() == FieldDescriptor::TYPE_MESSAGE) return inline_message(options, fd);
+	return proto3_optional(fd);
+}
+
+// Index of the presence bit of a field in declaration order, -1 if the field has none
+static int presence_bit(const GeneratorOptions& options, const FieldDescriptor* fd) {
+	if (!has_presence_bit(options, fd)) return -1;
+	auto m = fd->containing_type();
+	int bit = 0;
+	for (int f = 0; m->field(f) != fd; f++)
+		if (has_presence_bit(options, m->field(f))) bit++;
+	return bit;
+}
+
+// Number of presence bits of a message
+static int presence_count(const GeneratorOptions& options, const Descriptor* m) {
+	int count = 0;
+	for (int f = 0; f < m->field_count(); f++)
+		if (has_presence_bit(options, m->field(f))) count++;
+	return count;
+}
+
+// Condition under which a field is encoded, empty if it is always encoded. Fields with a presence bit are encoded if it is set,
+// scalars and strings without presence (proto3 implicit presence) only if they differ from their default value and packed fields only
+// if they are not empty. proto2 scalars are always encoded, a default value can be meaningful (and required) there.
+static std::string encode_condition(const GeneratorOptions& options, const FieldDescriptor* fd) {
+	if (fd->is_packed()) return "!this->" + fd->name() + ".empty()";
+	if (has_presence_bit(options, fd)) return "this->m_has_bits.test(" + std::to_string(presence_bit(options, fd)) + ")";
+	if (fd->is_repeated() || fd->type() == FieldDescriptor::TYPE_MESSAGE || fd->has_presence()) return "";
+	return "!::minipb::is_default(this->" + fd->name() + ")";
+}
+
+// Messages of a file in the order they are defined, inline submessages need to be complete before their parent
+static std::vector<const Descriptor*> definition_order(const GeneratorOptions& options, const FileDescriptor* file) {
+	std::vector<const Descriptor*> order;
+	std::set<const Descriptor*> defined;
+	std::function<void(const Descriptor*)> define = [&](const Descriptor* m) {
+		if (!defined.insert(m).second) return;
+		for (int f = 0; f < m->field_count(); f++) {
+			auto fd = m->field(f);
+			if (inline_message(options, fd) && !fd->is_repeated()) define(fd->message_type());
+		}
+		order.push_back(m);
+	};
+	for (int i = 0; i < file->message_type_count(); i++)
+		define(file->message_type(i));
+	return order;
+}
+
+// Additional parameters of the generated decode function
+static std::string decode_params(const GeneratorOptions& options) {
+	return options.arena ? ", ::minipb::arena& a" : "";
+}
+
 static std::map<std::string, std::string> combine(std::map<std::string, std::string> a, std::initializer_list<std::pair<std::string, std::string>> b) {
 	for (auto& e : b)
 		a.emplace(e);
 	return a;
 }
 
-bool DummyCodeGenerator::Generate(const FileDescriptor* file, const std::string&, compiler::GeneratorContext* context, std::string* error) const {
-	if (!GenerateHeader(file, context, error)) return false;
-	if (!GenerateImpl(file, context, error)) return false;
+bool DummyCodeGenerator::Generate(const FileDescriptor* file, const std::string& parameter, compiler::GeneratorContext* context, std::string* error) const {
+	GeneratorOptions options;
+	if (!ParseOptions(parameter, options, error)) return false;
+	if (!GenerateHeader(file, options, context, error)) return false;
+	if (!GenerateImpl(file, options, context, error)) return false;
+	return true;
+}
+
+bool DummyCodeGenerator::ParseOptions(const std::string& parameter, GeneratorOptions& options, std::string* error) const {
+	std::vector<std::pair<std::string, std::string>> params;
+	compiler::ParseGeneratorParameter(parameter, &params);
+	for (auto& e : params) {
+		if (e.first == "string_view")
+			options.string_view = true;
+		else if (e.first == "arena")
+			options.arena = true;
+		else if (e.first == "table")
+			options.table = true;
+		else if (e.first == "inline_messages")
+			options.inline_messages = true;
+		else {
+			*error = "Unknown generator option: " + e.first;
+			return false;
+		}
+	}
+	if (options.table && options.arena) {
+		*error = "The table option can not be combined with arena";
+		return false;
+	}
+	if (options.inline_messages && options.arena) {
+		*error = "The inline_messages option can not be combined with arena";
+		return false;
+	}
 	return true;
 }
 
-void DummyCodeGenerator::EmitStructure(const std::map<std::string, std::string>& global_args, const Descriptor* m, io::Printer& printer) const {
+void DummyCodeGenerator::EmitStructure(const std::map<std::string, std::string>& global_args, const GeneratorOptions& options, const Descriptor* m,
+									   io::Printer& printer) const {
 	// clang-format off
     auto message_args = combine(global_args,
     {
@@ -75,9 +237,14 @@ void DummyCodeGenerator::EmitStructure(const std::map<std::string, std::string>&
 
 	printer.Print(message_args, "struct $MSG_NAME$ {\n");
 	printer.Indent();
-	printer.Print(message_args, R"(size_t estimate_size() const noexcept;
-::minipb::result encode(::minipb::msg_builder& b) const noexcept;
-::minipb::result decode(::minipb::msg_parser& p) noexcept;
+	printer.Print(combine(message_args, {{"DECODE_PARAMS", decode_params(options)}}), R"(size_t estimate_size() const noexcept;
+size_t byte_size() const noexcept;
+size_t cached_size() const noexcept { return m_cached_size.get(); }
+template <typename TStream> ::minipb::result encode(::minipb::basic_msg_builder<TStream>& b) const noexcept;
+::minipb::result encode(::minipb::unchecked_msg_builder& b) const noexcept;
+uint8_t* encode_unchecked(uint8_t* out) const noexcept;
+::minipb::result encode_reverse(::minipb::reverse_msg_builder& b) const noexcept;
+template <typename TStream> ::minipb::result decode(::minipb::basic_msg_parser<TStream>& p$DECODE_PARAMS$) noexcept;
 
 )");
 
@@ -93,8 +260,15 @@ void DummyCodeGenerator::EmitStructure(const std::map<std::string, std::string>&
 		case FieldDescriptor::CPPTYPE_FLOAT: cpp_typename = "float"; break;
 		case FieldDescriptor::CPPTYPE_BOOL: cpp_typename = "bool"; break;
 		case FieldDescriptor::CPPTYPE_ENUM: throw std::logic_error("Not implemented"); break;
-		case FieldDescriptor::CPPTYPE_STRING: cpp_typename = "std::string"; break;
-		case FieldDescriptor::CPPTYPE_MESSAGE: cpp_typename = "std::unique_ptr<" + fd->message_type()->name() + ">"; break;
+		case FieldDescriptor::CPPTYPE_STRING: cpp_typename = options.string_view || options.arena ? "::minipb::string_view" : "std::string"; break;
+		case FieldDescriptor::CPPTYPE_MESSAGE:
+			if (options.arena)
+				cpp_typename = fd->message_type()->name() + "*";
+			else if (inline_message(options, fd))
+				cpp_typename = fd->message_type()->name();
+			else
+				cpp_typename = "std::unique_ptr<" + fd->message_type()->name() + ">";
+			break;
 		}
 		// clang-format off
         auto field_args = combine(message_args, {
@@ -104,16 +278,33 @@ void DummyCodeGenerator::EmitStructure(const std::map<std::string, std::string>&
             {"CAMELCASE_NAME", fd->camelcase_name()},
         });
 		// clang-format on
-		if (fd->is_repeated())
+		if (fd->is_repeated() && options.arena)
+			printer.Print(field_args, "::minipb::arena_vector<$CPP_TYPE$> $NAME${};\n");
+		else if (fd->is_repeated())
 			printer.Print(field_args, "std::vector<$CPP_TYPE$> $NAME${};\n");
 		else
 			printer.Print(field_args, "$CPP_TYPE$ $NAME${};\n");
 	}
+	if (presence_count(options, m) != 0) {
+		printer.Print("\n");
+		for (int f = 0; f < m->field_count(); f++) {
+			auto fd = m->field(f);
+			if (!has_presence_bit(options, fd)) continue;
+			auto bit_args = combine(message_args, {{"NAME", fd->name()}, {"BIT", std::to_string(presence_bit(options, fd))}});
+			printer.Print(bit_args, "bool has_$NAME$() const noexcept { return m_has_bits.test($BIT$); }\n");
+			printer.Print(bit_args, "void set_has_$NAME$(bool value = true) noexcept { m_has_bits.set($BIT$, value); }\n");
+		}
+		printer.Print("\n// Presence of the optional fields, set by decode() and checked by encode()\n");
+		printer.Print(("::minipb::has_bits<" + std::to_string(presence_count(options, m)) + "> m_has_bits{};\n").c_str());
+	}
+	if (options.table) printer.Print("\n// Field table used by decode()\nstatic const ::minipb::message_table minipb_table;\n");
+	printer.Print("\n// Size calculated by the last call to byte_size()\nmutable ::minipb::cached_size m_cached_size{};\n");
 	printer.Outdent();
 	printer.Print(message_args, "};\n\n");
 }
 
-void DummyCodeGenerator::EmitEstimateSize(const std::map<std::string, std::string>& message_args, const Descriptor* m, io::Printer& printer) const {
+void DummyCodeGenerator::EmitEstimateSize(const std::map<std::string, std::string>& message_args, const GeneratorOptions& options, const Descriptor* m,
+										  io::Printer& printer) const {
 	printer.Print(message_args, "size_t $MSG_NAME$::estimate_size() const noexcept {\n");
 	printer.Indent();
 	printer.Print("size_t size {0};\n");
@@ -129,7 +320,19 @@ void DummyCodeGenerator::EmitEstimateSize(const std::map<std::string, std::strin
             {"HSIZE", std::to_string(hsize)},
         });
 		// clang-format on
-		if (fd->is_repeated()) {
+		if (fd->is_packed()) {
+			// A single header and length prefix for all elements
+			switch (fd->type()) {
+			case FieldDescriptor::TYPE_DOUBLE:
+			case FieldDescriptor::TYPE_FIXED64:
+			case FieldDescriptor::TYPE_SFIXED64: field_args["ELEM"] = "8"; break;
+			case FieldDescriptor::TYPE_FLOAT:
+			case FieldDescriptor::TYPE_FIXED32:
+			case FieldDescriptor::TYPE_SFIXED32: field_args["ELEM"] = "4"; break;
+			default: field_args["ELEM"] = "10"; break;
+			}
+			printer.Print(field_args, "if(!this->$FIELD_NAME$.empty()) size += $HSIZE$ + 10 + $ELEM$ * this->$FIELD_NAME$.size();\n");
+		} else if (fd->is_repeated()) {
 			switch (fd->type()) {
 			// Fixed 8 bytes
 			case FieldDescriptor::TYPE_DOUBLE:
@@ -162,12 +365,26 @@ void DummyCodeGenerator::EmitEstimateSize(const std::map<std::string, std::strin
 				break;
 			// Sub message
 			case FieldDescriptor::TYPE_MESSAGE:
-				printer.Print(field_args, "for(auto& e : this->$FIELD_NAME$) { if(e) size += e->estimate_size() + 10 + $HSIZE$; }\n");
+				if (inline_message(options, fd))
+					printer.Print(field_args, "for(auto& e : this->$FIELD_NAME$) size += e.estimate_size() + 10 + $HSIZE$;\n");
+				else
+					printer.Print(field_args, "for(auto& e : this->$FIELD_NAME$) { if(e) size += e->estimate_size() + 10 + $HSIZE$; }\n");
 				break;
 			// Unsupported
 			case FieldDescriptor::TYPE_GROUP:
 				throw std::logic_error("unsupported");
 			}
+		} else if (has_presence_bit(options, fd)) {
+			// Absent optional fields are not encoded
+			std::string wire = field_wire_type(fd);
+			field_args["SIZE"] = std::to_string((wire == "fixed64" ? 8 : wire == "fixed32" ? 4 : 10) + hsize);
+			field_args["BIT"] = std::to_string(presence_bit(options, fd));
+			if (fd->type() == FieldDescriptor::TYPE_MESSAGE)
+				printer.Print(field_args, "if(this->m_has_bits.test($BIT$)) size += this->$FIELD_NAME$.estimate_size() + 10 + $HSIZE$;\n");
+			else if (wire == "length_blob")
+				printer.Print(field_args, "if(this->m_has_bits.test($BIT$)) size += $SIZE$ + this->$FIELD_NAME$.size();\n");
+			else
+				printer.Print(field_args, "if(this->m_has_bits.test($BIT$)) size += $SIZE$;\n");
 		} else {
 			switch (fd->type()) {
 			// Fixed 8 bytes
@@ -217,9 +434,11 @@ void DummyCodeGenerator::EmitEstimateSize(const std::map<std::string, std::strin
 	printer.Print("}\n\n");
 }
 
-void DummyCodeGenerator::EmitEncode(const std::map<std::string, std::string>& message_args, const Descriptor* m, io::Printer& printer) const {
-	printer.Print(message_args, "::minipb::result $MSG_NAME$::encode(::minipb::msg_builder& b) const noexcept {\n");
+void DummyCodeGenerator::EmitByteSize(const std::map<std::string, std::string>& message_args, const GeneratorOptions& options, const Descriptor* m,
+									  io::Printer& printer) const {
+	printer.Print(message_args, "size_t $MSG_NAME$::byte_size() const noexcept {\n");
 	printer.Indent();
+	printer.Print("size_t size {0};\n");
 	for (int f = 0; f < m->field_count(); f++) {
 		auto fd = m->field(f);
 		auto hsize = header_size(fd->number());
@@ -228,10 +447,137 @@ void DummyCodeGenerator::EmitEncode(const std::map<std::string, std::string>& me
         {
             {"FIELD_NAME", "this->" + fd->name()},
             {"HSIZE", std::to_string(hsize)},
-            {"FIELD_NUM", std::to_string(fd->number())},
+        });
+		// clang-format on
+		// The sizes need to match exactly what encode() and the msg_builder emit for each field
+		size_t fixed_size{0};
+		std::string varint_size{};
+		switch (fd->type()) {
+		case FieldDescriptor::TYPE_DOUBLE:
+		case FieldDescriptor::TYPE_FIXED64:
+		case FieldDescriptor::TYPE_SFIXED64: fixed_size = 8; break;
+		case FieldDescriptor::TYPE_FLOAT:
+		case FieldDescriptor::TYPE_FIXED32:
+		case FieldDescriptor::TYPE_SFIXED32: fixed_size = 4; break;
+		case FieldDescriptor::TYPE_BOOL: fixed_size = 1; break;
+		case FieldDescriptor::TYPE_INT32: varint_size = "::minipb::encoder::varint_size(static_cast<uint32_t>($VALUE$))"; break;
+		case FieldDescriptor::TYPE_INT64:
+		case FieldDescriptor::TYPE_UINT64:
+		case FieldDescriptor::TYPE_UINT32:
+		case FieldDescriptor::TYPE_ENUM: varint_size = "::minipb::encoder::varint_size($VALUE$)"; break;
+		case FieldDescriptor::TYPE_SINT32:
+		case FieldDescriptor::TYPE_SINT64: varint_size = "::minipb::encoder::varint_signed_size($VALUE$)"; break;
+		case FieldDescriptor::TYPE_STRING:
+		case FieldDescriptor::TYPE_BYTES:
+		case FieldDescriptor::TYPE_MESSAGE: break;
+		// Unsupported
+		case FieldDescriptor::TYPE_GROUP: throw std::logic_error("unsupported");
+		}
+		// Fields skipped by encode() take no space
+		auto condition = encode_condition(options, fd);
+		if (!condition.empty()) printer.Print("if($COND$) ", "COND", condition);
+		if (fd->is_packed()) {
+			if (fixed_size != 0) {
+				field_args["ESIZE"] = std::to_string(fixed_size);
+				printer.Print(field_args, "size += $HSIZE$ + ::minipb::encoder::varint_size($ESIZE$ * $FIELD_NAME$.size()) + $ESIZE$ * $FIELD_NAME$.size();\n");
+			} else {
+				bool is_signed = fd->type() == FieldDescriptor::TYPE_SINT32 || fd->type() == FieldDescriptor::TYPE_SINT64;
+				field_args["FN"] = is_signed ? "packed_varint_signed_size" : "packed_varint_size";
+				printer.Print(field_args, "{ auto s = ::minipb::encoder::$FN$($FIELD_NAME$); size += $HSIZE$ + ::minipb::encoder::varint_size(s) + s; }\n");
+			}
+		} else if (fd->is_repeated()) {
+			switch (fd->type()) {
+			case FieldDescriptor::TYPE_STRING:
+			case FieldDescriptor::TYPE_BYTES:
+				printer.Print(field_args, "for(auto& e : $FIELD_NAME$) size += $HSIZE$ + ::minipb::encoder::varint_size(e.size()) + e.size();\n");
+				break;
+			case FieldDescriptor::TYPE_MESSAGE:
+				if (inline_message(options, fd))
+					printer.Print(field_args, "for(auto& e : $FIELD_NAME$) { auto s = e.byte_size(); size += $HSIZE$ + ::minipb::encoder::varint_size(s) + s; }\n");
+				else
+					printer.Print(field_args,
+								  "for(auto& e : $FIELD_NAME$) { if(e) { auto s = e->byte_size(); size += $HSIZE$ + ::minipb::encoder::varint_size(s) + s; } }\n");
+				break;
+			default:
+				if (fixed_size != 0) {
+					field_args["ESIZE"] = std::to_string(fixed_size + hsize);
+					printer.Print(field_args, "size += $ESIZE$ * $FIELD_NAME$.size();\n");
+				} else {
+					printer.Print(combine(field_args, {{"VALUE", "e"}}), ("for(auto e : $FIELD_NAME$) size += $HSIZE$ + " + varint_size + ";\n").c_str());
+				}
+				break;
+			}
+		} else {
+			switch (fd->type()) {
+			case FieldDescriptor::TYPE_STRING:
+			case FieldDescriptor::TYPE_BYTES:
+				printer.Print(field_args, "size += $HSIZE$ + ::minipb::encoder::varint_size($FIELD_NAME$.size()) + $FIELD_NAME$.size();\n");
+				break;
+			case FieldDescriptor::TYPE_MESSAGE:
+				if (inline_message(options, fd))
+					printer.Print(field_args, "{ auto s = $FIELD_NAME$.byte_size(); size += $HSIZE$ + ::minipb::encoder::varint_size(s) + s; }\n");
+				else
+					printer.Print(field_args, "if($FIELD_NAME$) { auto s = $FIELD_NAME$->byte_size(); size += $HSIZE$ + ::minipb::encoder::varint_size(s) + s; }\n");
+				break;
+			default:
+				if (fixed_size != 0)
+					printer.Print(field_args, ("size += " + std::to_string(hsize + fixed_size) + ";\n").c_str());
+				else
+					printer.Print(combine(field_args, {{"VALUE", "this->" + fd->name()}}), ("size += $HSIZE$ + " + varint_size + ";\n").c_str());
+				break;
+			}
+		}
+	}
+	printer.Print("m_cached_size.set(size);\n");
+	printer.Print("return size;\n");
+	printer.Outdent();
+	printer.Print("}\n\n");
+}
+
+void DummyCodeGenerator::EmitEncode(const std::map<std::string, std::string>& message_args, const GeneratorOptions& options, const Descriptor* m,
+									bool reverse, io::Printer& printer) const {
+	if (reverse) {
+		printer.Print(message_args, "::minipb::result $MSG_NAME$::encode_reverse(::minipb::reverse_msg_builder& b) const noexcept {\n");
+		EmitEncodeBody(message_args, options, m, true, printer);
+		return;
+	}
+	printer.Print(message_args, "template <typename TStream> ::minipb::result $MSG_NAME$::encode(::minipb::basic_msg_builder<TStream>& b) const noexcept {\n");
+	EmitEncodeBody(message_args, options, m, false, printer);
+	for (auto stream : output_stream_types)
+		printer.Print(combine(message_args, {{"STREAM", stream}}),
+					  "template ::minipb::result $MSG_NAME$::encode(::minipb::basic_msg_builder<$STREAM$>& b) const noexcept;\n");
+	printer.Print("\n");
+	// Same fields written through a raw pointer, the caller provides estimate_size() bytes (see ::minipb::encode_unchecked())
+	printer.Print(message_args, "::minipb::result $MSG_NAME$::encode(::minipb::unchecked_msg_builder& b) const noexcept {\n");
+	EmitEncodeBody(message_args, options, m, false, printer);
+	printer.Print(message_args, "uint8_t* $MSG_NAME$::encode_unchecked(uint8_t* out) const noexcept {\n");
+	printer.Indent();
+	printer.Print("::minipb::unchecked_msg_builder b{out};\n");
+	printer.Print("this->encode(b);\n");
+	printer.Print("return b.data();\n");
+	printer.Outdent();
+	printer.Print("}\n\n");
+}
+
+void DummyCodeGenerator::EmitEncodeBody(const std::map<std::string, std::string>& message_args, const GeneratorOptions& options, const Descriptor* m,
+										bool reverse, io::Printer& printer) const {
+	printer.Indent();
+	for (int i = 0; i < m->field_count(); i++) {
+		// The reverse builder expects the fields (and repeated elements) last to first
+		auto fd = m->field(reverse ? m->field_count() - 1 - i : i);
+		auto hsize = header_size(fd->number());
+		// clang-format off
+        auto field_args = combine(message_args,
+        {
+            {"FIELD_NAME", "this->" + fd->name()},
+            {"HSIZE", std::to_string(hsize)},
+            // The forward builder writes headers of constant field numbers as constant bytes
+            {"FIELD_NUM", reverse ? std::to_string(fd->number()) : "::minipb::field_number<" + std::to_string(fd->number()) + ">{}"},
             {"TYPE", fd->type_name()},
         });
 		// clang-format on
+		auto condition = encode_condition(options, fd);
+		if (!condition.empty()) printer.Print("if($COND$) ", "COND", condition);
         switch (fd->type()) {
 		case FieldDescriptor::TYPE_DOUBLE:
 		case FieldDescriptor::TYPE_FIXED64:
@@ -269,7 +615,10 @@ void DummyCodeGenerator::EmitEncode(const std::map<std::string, std::string>& me
         default: break;
         }
 
-		if (fd->is_repeated()) {
+		if (fd->is_repeated() && reverse) {
+			printer.Print(field_args, "for(size_t i = $FIELD_NAME$.size(); i-- > 0;) ");
+			field_args["FIELD_NAME"] += "[i]";
+		} else if (fd->is_repeated()) {
 			switch (fd->type()) {
 			case FieldDescriptor::TYPE_MESSAGE:
 			case FieldDescriptor::TYPE_STRING:
@@ -300,7 +649,10 @@ void DummyCodeGenerator::EmitEncode(const std::map<std::string, std::string>& me
 			printer.Print(field_args, "b.$TYPE$_field($FIELD_NUM$, $FIELD_NAME$);\n");
 			break;
 		case FieldDescriptor::TYPE_MESSAGE:
-			printer.Print(field_args, "{ if($FIELD_NAME$) b.$TYPE$_field($FIELD_NUM$, *$FIELD_NAME$); }\n");
+			if (inline_message(options, fd))
+				printer.Print(field_args, "b.$TYPE$_field($FIELD_NUM$, $FIELD_NAME$);\n");
+			else
+				printer.Print(field_args, "{ if($FIELD_NAME$) b.$TYPE$_field($FIELD_NUM$, *$FIELD_NAME$); }\n");
 			break;
 		case FieldDescriptor::TYPE_BYTES:
 			printer.Print(field_args, "b.string_field($FIELD_NUM$, $FIELD_NAME$);\n");
@@ -315,13 +667,38 @@ void DummyCodeGenerator::EmitEncode(const std::map<std::string, std::string>& me
 	printer.Print("}\n\n");
 }
 
-void DummyCodeGenerator::EmitDecode(const std::map<std::string, std::string>& message_args, const Descriptor* m, io::Printer& printer) const {
-    printer.Print(message_args, "::minipb::result $MSG_NAME$::decode(::minipb::msg_parser& p) noexcept {\n");
+void DummyCodeGenerator::EmitDecode(const std::map<std::string, std::string>& message_args, const GeneratorOptions& options, const Descriptor* m,
+									io::Printer& printer) const {
+	auto decode_args = combine(message_args, {{"DECODE_PARAMS", decode_params(options)}});
+	printer.Print(decode_args, "template <typename TStream> ::minipb::result $MSG_NAME$::decode(::minipb::basic_msg_parser<TStream>& p$DECODE_PARAMS$) noexcept {\n");
 	printer.Indent();
-    printer.Print("minipb::result res = p.next_field();\nwhile (res == minipb::result::ok) {\n");
+	if (options.table) {
+		printer.Print("return minipb_table.decode(p, this);\n");
+		printer.Outdent();
+		printer.Print("}\n\n");
+		for (auto stream : input_stream_types)
+			printer.Print(combine(decode_args, {{"STREAM", stream}}),
+						  "template ::minipb::result $MSG_NAME$::decode(::minipb::basic_msg_parser<$STREAM$>& p$DECODE_PARAMS$) noexcept;\n");
+		printer.Print("\n");
+		return;
+	}
+	if (options.arena) {
+		// Repeated fields grow inside the arena
+		for (int f = 0; f < m->field_count(); f++) {
+			if (m->field(f)->is_repeated()) printer.Print("this->$NAME$.set_arena(a);\n", "NAME", m->field(f)->name());
+		}
+	}
+    printer.Print("minipb::result res = minipb::result::ok;\nwhile (!p.is_eof()) {\n");
     printer.Indent();
+    printer.Print("res = p.next_field();\nif (res != minipb::result::ok) break;\n");
     printer.Print("switch (p.field_id()) {\n");
     printer.Indent();
+	// Fields usually arrive in declaration order (and elements of unpacked repeated fields one after another), so after each field the
+	// next input bytes are compared against the constant header of the expected next field, which is entered directly on a match
+	auto repeats = [](const FieldDescriptor* fd) { return fd->is_repeated() && !fd->is_packed(); };
+	std::vector<bool> targeted(m->field_count());
+	for (int f = 0; f < m->field_count(); f++)
+		targeted[f] = f != 0 || repeats(m->field(f));
 	for (int f = 0; f < m->field_count(); f++) {
 		auto fd = m->field(f);
 		auto hsize = header_size(fd->number());
@@ -336,6 +713,10 @@ void DummyCodeGenerator::EmitDecode(const std::map<std::string, std::string>& me
 		// clang-format on
         if(fd->type() == FieldDescriptor::TYPE_BYTES) field_args["TYPE"] = "string";
         if(fd->is_repeated()) field_args["TYPE"] = "repeated_" + field_args["TYPE"];
+        // Strings are copied into the arena unless they reference the input
+        bool arena_string = options.arena && !options.string_view
+                            && (fd->type() == FieldDescriptor::TYPE_STRING || fd->type() == FieldDescriptor::TYPE_BYTES);
+        field_args["EXTRA_ARGS"] = arena_string ? ", a" : "";
 		switch (fd->type()) {
 		case FieldDescriptor::TYPE_DOUBLE:
 		case FieldDescriptor::TYPE_FIXED64:
@@ -353,38 +734,126 @@ void DummyCodeGenerator::EmitDecode(const std::map<std::string, std::string>& me
 		case FieldDescriptor::TYPE_SINT64:
 		case FieldDescriptor::TYPE_STRING:
 		case FieldDescriptor::TYPE_BYTES:
-            printer.Print(field_args, "case $FIELD_NUM$: res = p.$TYPE$_field($FIELD_NAME$); break;\n");
+            printer.Print(field_args, "case $FIELD_NUM$:\n");
+            if (targeted[f]) printer.Print(field_args, "field_$FIELD_NUM$:\n");
+            printer.Indent();
+            printer.Print(field_args, "res = p.$TYPE$_field($FIELD_NAME$$EXTRA_ARGS$);\n");
 			break;
 		case FieldDescriptor::TYPE_MESSAGE: {
-			printer.Print(field_args, "case $FIELD_NUM$: {\n");
+			printer.Print(field_args, "case $FIELD_NUM$:\n");
+            if (targeted[f]) printer.Print(field_args, "field_$FIELD_NUM$:\n");
+            printer.Indent();
+            printer.Print("{\n");
             printer.Indent();
             auto name = JoinStrings(Split(fd->message_type()->full_name(), "."), "::");
-            if(fd->is_repeated()) {
+            if(options.arena && fd->is_repeated()) {
+                printer.Print(field_args, ("auto e = a.create<" + name + ">();\n").c_str());
+                printer.Print("if(!e) return ::minipb::result::out_of_memory;\n");
+                printer.Print("res = p.message_field(*e, a);\n");
+                printer.Print(field_args, "try { $FIELD_NAME$.push_back(e); } catch (...) { return ::minipb::result::out_of_memory; }\n");
+            } else if(options.arena) {
+                printer.Print(field_args, ("if(!$FIELD_NAME$) $FIELD_NAME$ = a.create<" + name + ">();\n").c_str());
+                printer.Print(field_args, "if(!$FIELD_NAME$) return ::minipb::result::out_of_memory;\n");
+                printer.Print(field_args, "res = p.$TYPE$_field(*$FIELD_NAME$, a);\n");
+            } else if(inline_message(options, fd) && fd->is_repeated()) {
+                // Decoded in place, the vector is the only allocation
+                printer.Print(field_args, "try { $FIELD_NAME$.emplace_back(); } catch (...) { return ::minipb::result::out_of_memory; }\n");
+                printer.Print(field_args, "res = p.message_field($FIELD_NAME$.back());\n");
+            } else if(inline_message(options, fd)) {
+                printer.Print(field_args, "res = p.$TYPE$_field($FIELD_NAME$);\n");
+            } else if(fd->is_repeated()) {
                 printer.Print(field_args, ("auto e = std::make_unique<" + name + ">();\n").c_str());
-                printer.Print("p.message_field(*e);\n");
+                printer.Print("res = p.message_field(*e);\n");
                 printer.Print(field_args, "$FIELD_NAME$.push_back(std::move(e));\n");
             } else {
                 printer.Print(field_args, ("if(!$FIELD_NAME$) $FIELD_NAME$ = std::make_unique<" + name + ">();\n").c_str());
-                printer.Print(field_args, "p.$TYPE$_field(*$FIELD_NAME$);\n");
+                printer.Print(field_args, "res = p.$TYPE$_field(*$FIELD_NAME$);\n");
             }
             printer.Outdent();
-            printer.Print("} break;\n");
+            printer.Print("}\n");
         } break;
 		// Unsupported
 		case FieldDescriptor::TYPE_GROUP:
 			throw std::logic_error("unsupported");
 		}
+		if (has_presence_bit(options, fd)) printer.Print("this->m_has_bits.set($BIT$);\n", "BIT", std::to_string(presence_bit(options, fd)));
+		std::vector<const FieldDescriptor*> expected;
+		if (repeats(fd)) expected.push_back(fd);
+		if (f + 1 < m->field_count()) expected.push_back(m->field(f + 1));
+		for (auto next : expected) {
+			printer.Print("if (res == minipb::result::ok && p.next_field_is(::minipb::field_tag<$NUM$, ::minipb::wire_type::$WIRE$>{})) goto field_$NUM$;\n",
+						  "NUM", std::to_string(next->number()), "WIRE", field_wire_type(next));
+		}
+		printer.Print("break;\n");
+		printer.Outdent();
 	}
     printer.Print("default: res = p.skip_field(); break;\n");
     printer.Outdent();
-	printer.Print("}\nif (p.is_eof()) break;\nres = p.next_field();\n");
+	printer.Print("}\nif (res != minipb::result::ok) break;\n");
     printer.Outdent();
     printer.Print("}\nreturn res;\n");
 	printer.Outdent();
 	printer.Print("}\n\n");
+	for (auto stream : input_stream_types)
+		printer.Print(combine(decode_args, {{"STREAM", stream}}),
+					  "template ::minipb::result $MSG_NAME$::decode(::minipb::basic_msg_parser<$STREAM$>& p$DECODE_PARAMS$) noexcept;\n");
+	printer.Print("\n");
+}
+
+void DummyCodeGenerator::EmitTable(const std::map<std::string, std::string>& message_args, const GeneratorOptions& options, const Descriptor* m,
+								   io::Printer& printer) const {
+	// The generic parser looks fields up by number
+	std::vector<const FieldDescriptor*> fields;
+	for (int f = 0; f < m->field_count(); f++)
+		fields.push_back(m->field(f));
+	std::sort(fields.begin(), fields.end(), [](const FieldDescriptor* a, const FieldDescriptor* b) { return a->number() < b->number(); });
+	if (!fields.empty()) {
+		printer.Print(message_args, "static constexpr ::minipb::field_entry $MSG_NAME$_fields[] = {\n");
+		printer.Indent();
+	}
+	for (auto fd : fields) {
+		std::string kind = fd->type_name();
+		std::string table = "nullptr", create = "nullptr";
+		switch (fd->type()) {
+		case FieldDescriptor::TYPE_BYTES: kind = "string"; break;
+		case FieldDescriptor::TYPE_ENUM:
+		case FieldDescriptor::TYPE_GROUP: throw std::logic_error("unsupported");
+		case FieldDescriptor::TYPE_MESSAGE: {
+			auto name = JoinStrings(Split(fd->message_type()->full_name(), "."), "::");
+			table = "&" + name + "::minipb_table";
+			if (inline_message(options, fd))
+				create = std::string{"&::minipb::field_entry::"} + (fd->is_repeated() ? "emplace_message<" : "inline_message<") + name + ">";
+			else
+				create = std::string{"&::minipb::field_entry::"} + (fd->is_repeated() ? "append_message<" : "create_message<") + name + ">";
+		} break;
+		default: break;
+		}
+		if (kind == "string" && options.string_view) kind = "string_view";
+		if (fd->is_repeated()) kind = "repeated_" + kind;
+		// clang-format off
+        printer.Print(combine(message_args, {
+            {"FIELD_NUM", std::to_string(fd->number())},
+            {"KIND", kind},
+            {"NAME", fd->name()},
+            {"TABLE", table},
+            {"CREATE", create},
+            {"HAS_BIT", has_presence_bit(options, fd) ? std::to_string(presence_bit(options, fd)) : "::minipb::field_entry::no_presence"},
+        }), "{$FIELD_NUM$, ::minipb::field_kind::$KIND$_field, offsetof($MSG_NAME$, $NAME$), $TABLE$, $CREATE$, $HAS_BIT$},\n");
+		// clang-format on
+	}
+	if (fields.empty()) {
+		printer.Print(message_args, "const ::minipb::message_table $MSG_NAME$::minipb_table{nullptr, 0, 0};\n\n");
+		return;
+	}
+	printer.Outdent();
+	printer.Print("};\n");
+	auto has_bits = presence_count(options, m) != 0 ? "offsetof(" + m->name() + ", m_has_bits)" : "0";
+	printer.Print(combine(message_args, {{"COUNT", std::to_string(fields.size())}, {"HAS_BITS", has_bits}}),
+				  "const ::minipb::message_table $MSG_NAME$::minipb_table{$MSG_NAME$_fields, $COUNT$, $HAS_BITS$};\n\n");
 }
 
-bool DummyCodeGenerator::GenerateHeader(const FileDescriptor* file, compiler::GeneratorContext* context, std::string* error) const {
+bool DummyCodeGenerator::GenerateHeader(const FileDescriptor* file, const GeneratorOptions& options, compiler::GeneratorContext* context,
+										std::string* error) const {
 	std::unique_ptr<io::ZeroCopyOutputStream> output(context->Open(file->name() + ".h"));
 	io::Printer printer(output.get(), '$');
 	compiler::Version ver;
@@ -409,11 +878,21 @@ bool DummyCodeGenerator::GenerateHeader(const FileDescriptor* file, compiler::Ge
 #include <memory>
 #include <string>
 #include <vector>
-
+#include <minipb/cached_size.h>
+)");
+	// string_view, arena and has_bits members need the complete type
+	bool presence = false;
+	for (int i = 0; i < file->message_type_count(); i++)
+		presence = presence || presence_count(options, file->message_type(i)) != 0;
+	if (options.string_view || options.arena || presence) printer.Print("#include <minipb/minipb.h>\n");
+	printer.Print(R"(
 namespace minipb {
     enum class result;
-    class msg_builder;
-    class msg_parser;
+    template <typename TStream> class basic_msg_builder;
+    template <typename TStream> class basic_msg_parser;
+    class unchecked_msg_builder;
+    class reverse_msg_builder;
+    struct message_table;
 }
 
 )");
@@ -428,11 +907,8 @@ namespace minipb {
 	}
 	printer.Print("\n");
 
-	for (int i = 0; i < file->message_type_count(); i++)
-	{
-		const Descriptor* m = file->message_type(i);
-		EmitStructure(global_args, m, printer);
-	}
+	for (auto m : definition_order(options, file))
+		EmitStructure(global_args, options, m, printer);
 
 	if (!ns.empty()) {
 		printer.Outdent();
@@ -448,7 +924,8 @@ namespace minipb {
 	return true;
 }
 
-bool DummyCodeGenerator::GenerateImpl(const FileDescriptor* file, compiler::GeneratorContext* context, std::string* error) const {
+bool DummyCodeGenerator::GenerateImpl(const FileDescriptor* file, const GeneratorOptions& options, compiler::GeneratorContext* context,
+									  std::string* error) const {
 	std::unique_ptr<io::ZeroCopyOutputStream> output(context->Open(file->name() + ".cpp"));
 	io::Printer printer(output.get(), '$');
 	compiler::Version ver;
@@ -485,11 +962,8 @@ bool DummyCodeGenerator::GenerateImpl(const FileDescriptor* file, compiler::Gene
 	}
 	printer.Print("\n");
 
-	for (int i = 0; i < file->message_type_count(); i++)
-	{
-		const Descriptor* m = file->message_type(i);
-		EmitStructure(global_args, m, printer);
-	}
+	for (auto m : definition_order(options, file))
+		EmitStructure(global_args, options, m, printer);
 
 	for (int i = 0; i < file->message_type_count(); i++)
 	{
@@ -502,9 +976,12 @@ bool DummyCodeGenerator::GenerateImpl(const FileDescriptor* file, compiler::Gene
         });
 		// clang-format on
 
-		EmitEstimateSize(message_args, m, printer);
-		EmitEncode(message_args, m, printer);
-        EmitDecode(message_args, m, printer);
+		EmitEstimateSize(message_args, options, m, printer);
+		EmitByteSize(message_args, options, m, printer);
+		EmitEncode(message_args, options, m, false, printer);
+		EmitEncode(message_args, options, m, true, printer);
+        if (options.table) EmitTable(message_args, options, m, printer);
+        EmitDecode(message_args, options, m, printer);
 	}
 
 	if (!ns.empty()) {
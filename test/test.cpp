@@ -1,6 +1,18 @@
+#include <algorithm>
+#include <cstdio>
 #include <gtest/gtest.h>
+#include <list>
 #include <minipb/minipb.h>
+#include <minipb/parallel.h>
+#include <minipb/posix.h>
+#include <minipb/record_file.h>
 #include <sample.proto.h>
+#include <sample_arena.proto.h>
+#include <sample_inline.proto.h>
+#include <sample_inline_table.proto.h>
+#include <sample_proto2.proto.h>
+#include <sample_table.proto.h>
+#include <sample_view.proto.h>
 
 TEST(MinipbTest, ArrayOutputStream) {
 	char buf[16];
@@ -230,4 +242,1559 @@ TEST(MinipbTest, Parser) {
 	ASSERT_EQ(msg.field2->field1[0], 12345);
 	ASSERT_EQ(msg.field2->field2, 6789);
 	ASSERT_FLOAT_EQ(msg.field3, 1.0f);
-}
\ No newline at end of file
+}
+
+TEST(MinipbTest, FieldTag) {
+	using tag1 = minipb::field_tag<1, minipb::wire_type::length_blob>;
+	using tag300 = minipb::field_tag<300, minipb::wire_type::varint>;
+	ASSERT_EQ(tag1::size, 1);
+	ASSERT_EQ(tag1::byte(0), 0x0a);
+	ASSERT_EQ(tag300::size, 2);
+	ASSERT_EQ(tag300::byte(0), 0xe0);
+	ASSERT_EQ(tag300::byte(1), 0x12);
+
+	// Constant headers produce the same bytes as runtime ones
+	std::string a, b;
+	{
+		minipb::container_output_stream<std::string> stream{a};
+		minipb::msg_builder builder{stream};
+		builder.int32_field(300, 5);
+		builder.string_field(1, "x");
+	}
+	{
+		minipb::container_output_stream<std::string> stream{b};
+		minipb::msg_builder builder{stream};
+		builder.int32_field(minipb::field_number<300>{}, 5);
+		builder.string_field(minipb::field_number<1>{}, "x");
+	}
+	ASSERT_EQ(a, b);
+
+	minipb::container_input_stream stream{b};
+	minipb::msg_parser p{stream};
+	ASSERT_FALSE(p.next_field_is(tag1{}));
+	ASSERT_TRUE(p.next_field_is(tag300{}));
+	ASSERT_EQ(p.field_id(), 300);
+	int32_t i;
+	ASSERT_EQ(p.int32_field(i), minipb::result::ok);
+	ASSERT_EQ(i, 5);
+	ASSERT_TRUE(p.next_field_is(tag1{}));
+	std::string s;
+	ASSERT_EQ(p.string_field(s), minipb::result::ok);
+	ASSERT_EQ(s, "x");
+	ASSERT_FALSE(p.next_field_is(tag1{}));
+
+	// Fields out of declaration order miss the prediction and fall back to the switch
+	uint8_t reordered[] = {0x1d, 0x00, 0x00, 0x80, 0x3f, 0x12, 0x02, 0x10, 0x07, 0x0a, 0x01, 0x41};
+	minipb::array_input_stream in{reordered};
+	minipb::msg_parser parser{in};
+	test::message_b msg{};
+	ASSERT_EQ(msg.decode(parser), minipb::result::ok);
+	ASSERT_EQ(msg.field1, "A");
+	ASSERT_TRUE(msg.field2);
+	ASSERT_EQ(msg.field2->field2, 7);
+	ASSERT_FLOAT_EQ(msg.field3, 1.0f);
+}
+
+TEST(MinipbTest, TypedStreams) {
+	std::string buf;
+	{
+		minipb::container_output_stream<std::string> stream{buf};
+		minipb::basic_msg_builder<minipb::container_output_stream<std::string>> b{stream};
+		test::test_all msg{};
+		msg.a = 1.5;
+		msg.o = "Hello world";
+		msg.q = std::make_unique<test::test_all>();
+		msg.q->c = 42;
+		msg.r_o = {"a", "bc"};
+		msg.rp_a = {1.0, 2.0, 3.0};
+		msg.rp_c = {1, 300, 70000};
+		ASSERT_EQ(msg.encode(b), minipb::result::ok);
+	}
+	{
+		minipb::array_input_stream stream{buf.data(), buf.size()};
+		minipb::basic_msg_parser<minipb::array_input_stream> p{stream};
+		test::test_all msg{};
+		ASSERT_EQ(msg.decode(p), minipb::result::ok);
+		ASSERT_DOUBLE_EQ(msg.a, 1.5);
+		ASSERT_EQ(msg.o, "Hello world");
+		ASSERT_TRUE(msg.q);
+		ASSERT_EQ(msg.q->c, 42);
+		ASSERT_EQ(msg.r_o, (std::vector<std::string>{"a", "bc"}));
+		ASSERT_EQ(msg.rp_a, (std::vector<double>{1.0, 2.0, 3.0}));
+		ASSERT_EQ(msg.rp_c, (std::vector<int32_t>{1, 300, 70000}));
+		ASSERT_EQ(stream.bytes_available(), 0);
+	}
+}
+
+class single_byte_input_stream final : public minipb::input_stream {
+	minipb::array_input_stream m_array;
+
+public:
+	single_byte_input_stream(const void* data, size_t len) : m_array{data, len} {}
+	minipb::result read(void* data, size_t data_size) noexcept override { return m_array.read(data, data_size); }
+	minipb::result skip(size_t data_size) noexcept override { return m_array.skip(data_size); }
+	size_t bytes_available() const noexcept override { return m_array.bytes_available(); }
+};
+
+template <typename T>
+void decoder_test() {
+	const uint8_t buf[] = {0x01, 0x7f, 0x80, 0x01, 0xac, 0x02, 0x80, 0x80, 0x04, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x01, 0x96, 0x01, 0x96};
+	T stream{buf, sizeof(buf)};
+	minipb::basic_decoder<T> dec{stream};
+	uint64_t val{};
+	ASSERT_EQ(dec.varint(val), minipb::result::ok);
+	ASSERT_EQ(val, 1);
+	ASSERT_EQ(dec.varint(val), minipb::result::ok);
+	ASSERT_EQ(val, 127);
+	ASSERT_EQ(dec.varint(val), minipb::result::ok);
+	ASSERT_EQ(val, 128);
+	ASSERT_EQ(dec.varint(val), minipb::result::ok);
+	ASSERT_EQ(val, 300);
+	ASSERT_EQ(dec.varint(val), minipb::result::ok);
+	ASSERT_EQ(val, 0x10000);
+	ASSERT_EQ(dec.varint(val), minipb::result::ok);
+	ASSERT_EQ(val, UINT64_MAX);
+	// Last complete varint directly before the end of the buffer
+	ASSERT_EQ(dec.varint(val), minipb::result::ok);
+	ASSERT_EQ(val, 150);
+	ASSERT_EQ(stream.bytes_available(), 1);
+	// Truncated varint
+	ASSERT_NE(dec.varint(val), minipb::result::ok);
+}
+
+TEST(MinipbTest, Decoder) {
+	decoder_test<minipb::array_input_stream>();
+	decoder_test<single_byte_input_stream>();
+}
+
+TEST(MinipbTest, StringView) {
+	std::string buf;
+	const std::string payload(100000, 'x');
+	{
+		minipb::container_output_stream<std::string> stream{buf};
+		minipb::msg_builder b{stream};
+		test::view::view_message msg{};
+		msg.name = minipb::string_view{"Hello world", 11};
+		msg.payload = payload;
+		msg.tags = {minipb::string_view{"a", 1}, minipb::string_view{"bc", 2}};
+		msg.child = std::make_unique<test::view::view_message>();
+		msg.child->name = minipb::string_view{"child", 5};
+		ASSERT_EQ(msg.encode(b), minipb::result::ok);
+	}
+	{
+		minipb::container_input_stream stream{buf};
+		minipb::basic_msg_parser<minipb::container_input_stream> p{stream};
+		test::view::view_message msg{};
+		ASSERT_EQ(msg.decode(p), minipb::result::ok);
+		ASSERT_EQ(msg.name.str(), "Hello world");
+		ASSERT_EQ(msg.payload.size(), payload.size());
+		// The payload references the input buffer instead of a copy
+		ASSERT_GE(msg.payload.data(), buf.data());
+		ASSERT_LE(msg.payload.data() + msg.payload.size(), buf.data() + buf.size());
+		ASSERT_EQ(msg.payload, minipb::string_view{payload});
+		ASSERT_EQ(msg.tags.size(), 2);
+		ASSERT_EQ(msg.tags[1].str(), "bc");
+		ASSERT_TRUE(msg.child);
+		ASSERT_EQ(msg.child->name.str(), "child");
+	}
+	{
+		single_byte_input_stream stream{buf.data(), buf.size()};
+		minipb::msg_parser p{stream};
+		test::view::view_message msg{};
+		ASSERT_EQ(msg.decode(p), minipb::result::general_error);
+	}
+}
+
+TEST(MinipbTest, Arena) {
+	std::string buf;
+	{
+		minipb::arena a;
+		test::arena::arena_message msg{};
+		msg.name = minipb::string_view{"Hello world", 11};
+		msg.tags.set_arena(a);
+		msg.tags.push_back(minipb::string_view{"tag", 3});
+		msg.child = a.create<test::arena::arena_message>();
+		msg.child->name = minipb::string_view{"child", 5};
+		msg.children.set_arena(a);
+		msg.values.set_arena(a);
+		msg.weights.set_arena(a);
+		for (int i = 0; i < 100; i++) {
+			auto e = a.create<test::arena::arena_message>();
+			e->values.set_arena(a);
+			e->values.push_back(i);
+			msg.children.push_back(e);
+			msg.values.push_back(i * 1000);
+			msg.weights.push_back(i / 2.0);
+		}
+		minipb::container_output_stream<std::string> stream{buf};
+		minipb::msg_builder b{stream};
+		ASSERT_EQ(msg.encode(b), minipb::result::ok);
+	}
+	// Decode repeatedly into the same arena, using a non contiguous stream so strings need to be copied
+	minipb::arena a{256};
+	for (int round = 0; round < 3; round++) {
+		a.reset();
+		single_byte_input_stream stream{buf.data(), buf.size()};
+		minipb::msg_parser p{stream};
+		test::arena::arena_message msg{};
+		ASSERT_EQ(msg.decode(p, a), minipb::result::ok);
+		ASSERT_EQ(msg.name.str(), "Hello world");
+		ASSERT_EQ(msg.tags.size(), 1);
+		ASSERT_EQ(msg.tags[0].str(), "tag");
+		ASSERT_TRUE(msg.child);
+		ASSERT_EQ(msg.child->name.str(), "child");
+		ASSERT_EQ(msg.children.size(), 100);
+		ASSERT_EQ(msg.values.size(), 100);
+		ASSERT_EQ(msg.weights.size(), 100);
+		for (int i = 0; i < 100; i++) {
+			ASSERT_TRUE(msg.children[i]);
+			ASSERT_EQ(msg.children[i]->values.size(), 1);
+			ASSERT_EQ(msg.children[i]->values[0], i);
+			ASSERT_EQ(msg.values[i], i * 1000);
+			ASSERT_DOUBLE_EQ(msg.weights[i], i / 2.0);
+		}
+	}
+}
+
+static void fill_test_all(test::test_all& msg, int depth) {
+	msg.a = 1.5;
+	msg.b = -2.5f;
+	msg.c = -12;
+	msg.d = -1234567890123;
+	msg.e = 300;
+	msg.f = UINT64_MAX;
+	msg.g = -5;
+	msg.h = INT64_MIN;
+	msg.i = 7;
+	msg.j = 8;
+	msg.k = -9;
+	msg.l = -10;
+	msg.m = true;
+	msg.o = std::string(200, 'o');
+	msg.p = "bytes";
+	msg.r_a = {1.0, 2.0};
+	msg.r_c = {-1, 1, 150};
+	msg.r_g = {-1, 1, -150};
+	msg.r_m = {true, false};
+	msg.r_o = {"x", std::string(130, 'y')};
+	msg.rp_c = {-1, 1, 150, 70000};
+	msg.rp_d = {-1, 1, INT64_MAX};
+	msg.rp_f = {0, 127, 128};
+	msg.rp_g = {-1, 1, -150};
+	msg.rp_h = {INT64_MIN, 0};
+	msg.rp_m = {true, false, true};
+	msg.rp_b = {1.0f};
+	msg.rp_j = {1, 2, 3};
+	if (depth > 0) {
+		msg.q = std::make_unique<test::test_all>();
+		fill_test_all(*msg.q, depth - 1);
+		for (int i = 0; i < 3; i++) {
+			msg.r_q.push_back(std::make_unique<test::test_all>());
+			fill_test_all(*msg.r_q.back(), depth - 1);
+		}
+	}
+}
+
+struct custom_message {
+	size_t estimate_size() const noexcept { return 0; }
+	template <typename TStream> minipb::result encode(minipb::basic_msg_builder<TStream>& b) const noexcept { return b.int32_field(1, 5); }
+};
+
+TEST(MinipbTest, ByteSize) {
+	test::test_all msg{};
+	fill_test_all(msg, 3);
+	std::string buf;
+	minipb::container_output_stream<std::string> stream{buf};
+	minipb::msg_builder b{stream};
+	ASSERT_EQ(msg.encode(b), minipb::result::ok);
+	ASSERT_EQ(buf.size(), msg.byte_size());
+	ASSERT_LE(buf.size(), msg.estimate_size());
+
+	minipb::array_input_stream in{buf.data(), buf.size()};
+	minipb::basic_msg_parser<minipb::array_input_stream> p{in};
+	test::test_all res{};
+	ASSERT_EQ(res.decode(p), minipb::result::ok);
+	ASSERT_EQ(res.h, INT64_MIN);
+	ASSERT_EQ(res.rp_c, msg.rp_c);
+	ASSERT_EQ(res.rp_g, msg.rp_g);
+	ASSERT_EQ(res.rp_h, msg.rp_h);
+	ASSERT_EQ(res.rp_m, msg.rp_m);
+	ASSERT_EQ(res.r_o, msg.r_o);
+	ASSERT_TRUE(res.q && res.q->q && res.q->q->q);
+	ASSERT_EQ(res.r_q.size(), 3);
+	ASSERT_EQ(res.q->q->q->o, msg.o);
+	ASSERT_EQ(res.byte_size(), msg.byte_size());
+
+	// Encoding the same const message concurrently updates the cached sizes without data races
+	const test::test_all& shared = msg;
+	std::string concurrent[4];
+	std::vector<std::thread> threads;
+	for (auto& out : concurrent)
+		threads.emplace_back([&shared, &out] {
+			for (int i = 0; i < 20; i++) {
+				out.clear();
+				minipb::container_output_stream<std::string> thread_stream{out};
+				minipb::msg_builder thread_builder{thread_stream};
+				shared.encode(thread_builder);
+			}
+		});
+	for (auto& t : threads)
+		t.join();
+	for (auto& out : concurrent)
+		ASSERT_EQ(out, buf);
+	// Copies keep the cached size
+	test::message_a sized{};
+	sized.field2 = 300;
+	ASSERT_EQ(sized.byte_size(), 3);
+	test::message_a copy = sized;
+	ASSERT_EQ(copy.cached_size(), 3);
+
+	// Submessages get a minimal length prefix
+	std::string small;
+	minipb::container_output_stream<std::string> small_stream{small};
+	minipb::msg_builder small_builder{small_stream};
+	test::message_b mb{};
+	mb.field2 = std::make_unique<test::message_a>();
+	mb.field2->field2 = 1;
+	ASSERT_EQ(mb.encode(small_builder), minipb::result::ok);
+	ASSERT_EQ(small, std::string("\x12\x02\x10\x01"));
+	ASSERT_EQ(small.size(), mb.byte_size());
+
+	// Messages without byte_size() still work using estimate_size()
+	std::string custom;
+	minipb::container_output_stream<std::string> custom_stream{custom};
+	minipb::msg_builder custom_builder{custom_stream};
+	ASSERT_EQ(custom_builder.message_field(1, custom_message{}), minipb::result::ok);
+	ASSERT_EQ(custom.substr(0, 1), "\x0a");
+}
+
+TEST(MinipbTest, ReverseBuilder) {
+	test::test_all msg{};
+	fill_test_all(msg, 3);
+	std::string forward;
+	minipb::container_output_stream<std::string> stream{forward};
+	minipb::msg_builder b{stream};
+	ASSERT_EQ(msg.encode(b), minipb::result::ok);
+
+	// Starting with a tiny buffer forces it to grow several times
+	minipb::reverse_msg_builder rb{16};
+	ASSERT_EQ(msg.encode_reverse(rb), minipb::result::ok);
+	ASSERT_EQ(rb.size(), forward.size());
+	ASSERT_EQ(memcmp(rb.data(), forward.data(), forward.size()), 0);
+
+	// Submessages get a minimal length prefix
+	rb.reset();
+	test::message_b mb{};
+	mb.field2 = std::make_unique<test::message_a>();
+	mb.field2->field2 = 1;
+	ASSERT_EQ(mb.encode_reverse(rb), minipb::result::ok);
+	ASSERT_EQ(rb.size(), mb.byte_size());
+	ASSERT_EQ(std::string(reinterpret_cast<const char*>(rb.data()), rb.size()), std::string("\x12\x02\x10\x01"));
+}
+
+TEST(MinipbTest, EncodeUnchecked) {
+	test::test_all msg{};
+	fill_test_all(msg, 3);
+	std::string forward;
+	minipb::container_output_stream<std::string> stream{forward};
+	minipb::msg_builder b{stream};
+	ASSERT_EQ(msg.encode(b), minipb::result::ok);
+
+	// Writing through the raw pointer produces the same bytes
+	std::vector<uint8_t> raw(msg.estimate_size());
+	ASSERT_EQ(static_cast<size_t>(msg.encode_unchecked(raw.data()) - raw.data()), forward.size());
+	ASSERT_EQ(memcmp(raw.data(), forward.data(), forward.size()), 0);
+
+	// Streams providing contiguous memory reserve the size once, the container keeps its previous contents
+	std::string container = "xy";
+	minipb::container_output_stream<std::string> container_stream{container};
+	ASSERT_EQ(minipb::encode_unchecked(container_stream, msg), minipb::result::ok);
+	ASSERT_EQ(container, "xy" + forward);
+
+	std::vector<uint8_t> array(msg.estimate_size());
+	minipb::array_output_stream array_stream{array.data(), array.size()};
+	ASSERT_EQ(minipb::encode_unchecked(array_stream, msg), minipb::result::ok);
+	ASSERT_EQ(array_stream.bytes_used(), forward.size());
+	ASSERT_EQ(memcmp(array.data(), forward.data(), forward.size()), 0);
+
+	// Less space than the estimate falls back to the checked builder
+	minipb::array_output_stream exact_stream{array.data(), forward.size()};
+	ASSERT_EQ(minipb::encode_unchecked(exact_stream, msg), minipb::result::ok);
+	ASSERT_EQ(memcmp(array.data(), forward.data(), forward.size()), 0);
+	minipb::array_output_stream small_stream{array.data(), forward.size() - 1};
+	ASSERT_EQ(minipb::encode_unchecked(small_stream, msg), minipb::result::out_of_space);
+
+	// The estimate of packed fields includes their length prefix, single elements fit into exactly estimate_size() bytes
+	for (int i = 0; i < 3; i++) {
+		test::test_packed packed{};
+		if (i == 0) packed.a = {1.0};
+		if (i == 1) packed.b = {-1};
+		if (i == 2) packed.c = {7};
+		std::vector<uint8_t> packed_raw(packed.estimate_size());
+		ASSERT_LE(static_cast<size_t>(packed.encode_unchecked(packed_raw.data()) - packed_raw.data()), packed_raw.size());
+		minipb::array_output_stream packed_stream{packed_raw.data(), packed_raw.size()};
+		ASSERT_EQ(minipb::encode_unchecked(packed_stream, packed), minipb::result::ok);
+		ASSERT_EQ(packed_stream.bytes_used(), packed.byte_size());
+	}
+
+	// Messages larger than a block are split by the regular builder, using the generic stream interface
+	minipb::block_pool pool{64};
+	minipb::segmented_output_stream segmented{pool};
+	minipb::output_stream& generic = segmented;
+	test::message_a small{};
+	small.field2 = 7;
+	ASSERT_EQ(minipb::encode_unchecked(generic, small), minipb::result::ok);
+	ASSERT_EQ(minipb::encode_unchecked(generic, msg), minipb::result::ok);
+	std::string flat;
+	ASSERT_EQ(segmented.flatten(flat), minipb::result::ok);
+	std::string expected;
+	minipb::container_output_stream<std::string> expected_stream{expected};
+	minipb::msg_builder expected_builder{expected_stream};
+	ASSERT_EQ(small.encode(expected_builder), minipb::result::ok);
+	ASSERT_EQ(flat, expected + forward);
+}
+
+// Encode forward and reverse, checking the sizes
+template <typename T> static std::string encode_checked(const T& msg) {
+	std::string buf;
+	minipb::container_output_stream<std::string> stream{buf};
+	minipb::msg_builder b{stream};
+	EXPECT_EQ(msg.encode(b), minipb::result::ok);
+	EXPECT_EQ(buf.size(), msg.byte_size());
+	EXPECT_LE(buf.size(), msg.estimate_size());
+	minipb::reverse_msg_builder rb{};
+	EXPECT_EQ(msg.encode_reverse(rb), minipb::result::ok);
+	EXPECT_EQ(std::string(reinterpret_cast<const char*>(rb.data()), rb.size()), buf);
+	return buf;
+}
+
+TEST(MinipbTest, Presence) {
+	// Defaults and absent optional fields are not encoded
+	test::test_presence msg{};
+	msg.a = 5;
+	msg.b = "x";
+	ASSERT_EQ(encode_checked(msg), "");
+	ASSERT_EQ(msg.estimate_size(), 11u);
+	test::test_all all{};
+	ASSERT_EQ(encode_checked(all), "");
+
+	// Present optional fields are encoded even with their default value, -0.0 is not the default
+	msg = test::test_presence{};
+	msg.set_has_a();
+	msg.set_has_c();
+	msg.e = 3;
+	ASSERT_EQ(encode_checked(msg), std::string("\x08\x00\x19\x00\x00\x00\x00\x00\x00\x00\x00\x28\x03", 13));
+	msg.set_has_c(false);
+	msg.e = 0;
+	ASSERT_EQ(encode_checked(msg), std::string("\x08\x00", 2));
+	all.a = -0.0;
+	ASSERT_EQ(encode_checked(all).size(), 9u);
+
+	// Decoding sets the bits of the fields read, using the generated switch and the field table
+	msg = test::test_presence{};
+	msg.set_has_b();
+	msg.set_has_d();
+	msg.d = true;
+	auto buf = encode_checked(msg);
+	ASSERT_EQ(buf, std::string("\x12\x00\x20\x01", 4));
+	test::test_presence res{};
+	minipb::array_input_stream in{buf.data(), buf.size()};
+	minipb::basic_msg_parser<minipb::array_input_stream> p{in};
+	ASSERT_EQ(res.decode(p), minipb::result::ok);
+	ASSERT_FALSE(res.has_a());
+	ASSERT_TRUE(res.has_b());
+	ASSERT_FALSE(res.has_c());
+	ASSERT_TRUE(res.has_d());
+	ASSERT_TRUE(res.d);
+	ASSERT_EQ(encode_checked(res), buf);
+
+	test::table::table_presence table{};
+	minipb::array_input_stream table_in{buf.data(), 2};
+	minipb::basic_msg_parser<minipb::array_input_stream> table_parser{table_in};
+	ASSERT_EQ(table.decode(table_parser), minipb::result::ok);
+	ASSERT_FALSE(table.has_a());
+	ASSERT_TRUE(table.has_b());
+
+	// proto2 optional and required fields have no presence bits, they are always encoded
+	test::legacy::legacy_message legacy{};
+	legacy.a = 5;
+	legacy.d = {1, 2};
+	buf = encode_checked(legacy);
+	ASSERT_EQ(buf, std::string("\x08\x05\x10\x00\x1a\x00\x20\x01\x20\x02\x29\x00\x00\x00\x00\x00\x00\x00\x00", 19));
+	ASSERT_EQ(legacy.byte_size(), buf.size());
+	ASSERT_GE(legacy.estimate_size(), buf.size());
+	test::legacy::legacy_message legacy_res{};
+	minipb::array_input_stream legacy_in{buf.data(), buf.size()};
+	minipb::basic_msg_parser<minipb::array_input_stream> legacy_parser{legacy_in};
+	ASSERT_EQ(legacy_res.decode(legacy_parser), minipb::result::ok);
+	ASSERT_EQ(legacy_res.a, 5);
+	ASSERT_EQ(legacy_res.d, legacy.d);
+}
+
+TEST(MinipbTest, InlineMessages) {
+	// Submessages are stored by value, only the recursive singular field keeps a pointer
+	static_assert(std::is_same<decltype(test::flat::flat_node::item), test::flat::flat_item>::value, "singular submessage is inline");
+	static_assert(std::is_same<decltype(test::flat::flat_node::items), std::vector<test::flat::flat_item>>::value, "elements are inline");
+	static_assert(std::is_same<decltype(test::flat::flat_node::next), std::unique_ptr<test::flat::flat_node>>::value, "recursion needs a pointer");
+	static_assert(std::is_same<decltype(test::flat::flat_node::children), std::vector<test::flat::flat_node>>::value, "elements are inline");
+
+	test::flat::flat_node msg{};
+	msg.id = 1;
+	for (int i = 0; i < 100; i++) {
+		msg.items.emplace_back();
+		msg.items.back().name = "item" + std::to_string(i);
+		msg.items.back().point.x = i;
+		msg.items.back().set_has_point();
+	}
+	msg.next = std::make_unique<test::flat::flat_node>();
+	msg.next->children.resize(2);
+	msg.next->children[1].id = 3;
+
+	// Inline submessages are only encoded if marked present, like optional fields
+	msg.item.name = "absent";
+	auto buf = encode_checked(msg);
+	ASSERT_EQ(buf.find("absent"), std::string::npos);
+	msg.set_has_item();
+	buf = encode_checked(msg);
+	ASSERT_NE(buf.find("absent"), std::string::npos);
+	std::vector<uint8_t> raw(msg.estimate_size());
+	ASSERT_EQ(static_cast<size_t>(msg.encode_unchecked(raw.data()) - raw.data()), buf.size());
+	ASSERT_EQ(memcmp(raw.data(), buf.data(), buf.size()), 0);
+
+	// Decoding constructs the elements in place and marks the singular submessages present
+	auto check = [&](const test::flat::flat_node& res) {
+		ASSERT_EQ(res.id, 1);
+		ASSERT_TRUE(res.has_item());
+		ASSERT_EQ(res.item.name, "absent");
+		ASSERT_FALSE(res.item.has_point());
+		ASSERT_EQ(res.items.size(), 100);
+		ASSERT_EQ(res.items[42].name, "item42");
+		ASSERT_TRUE(res.items[42].has_point());
+		ASSERT_EQ(res.items[42].point.x, 42);
+		ASSERT_TRUE(res.next);
+		ASSERT_EQ(res.next->children.size(), 2);
+		ASSERT_EQ(res.next->children[1].id, 3);
+		ASSERT_EQ(encode_checked(res), buf);
+	};
+	{
+		minipb::array_input_stream in{buf.data(), buf.size()};
+		minipb::basic_msg_parser<minipb::array_input_stream> p{in};
+		test::flat::flat_node res{};
+		ASSERT_EQ(res.decode(p), minipb::result::ok);
+		check(res);
+	}
+	{
+		single_byte_input_stream in{buf.data(), buf.size()};
+		minipb::msg_parser p{in};
+		test::flat::flat_node res{};
+		ASSERT_EQ(res.decode(p), minipb::result::ok);
+		check(res);
+	}
+
+	// The field table decodes into the same storage
+	test::flat_table::flat_table_node table{};
+	table.set_has_item();
+	table.item.value = 1.5;
+	table.items.resize(3);
+	table.items[2].name = "x";
+	table.next = std::make_unique<test::flat_table::flat_table_node>();
+	table.next->id = 7;
+	auto table_buf = encode_checked(table);
+	minipb::array_input_stream table_in{table_buf.data(), table_buf.size()};
+	minipb::basic_msg_parser<minipb::array_input_stream> table_parser{table_in};
+	test::flat_table::flat_table_node table_res{};
+	ASSERT_EQ(table_res.decode(table_parser), minipb::result::ok);
+	ASSERT_TRUE(table_res.has_item());
+	ASSERT_EQ(table_res.item.value, 1.5);
+	ASSERT_EQ(table_res.items.size(), 3);
+	ASSERT_EQ(table_res.items[2].name, "x");
+	ASSERT_TRUE(table_res.next && table_res.next->id == 7);
+	ASSERT_FALSE(table_res.next->has_item());
+	ASSERT_EQ(encode_checked(table_res), table_buf);
+}
+
+TEST(MinipbTest, TableParser) {
+	test::test_all msg{};
+	fill_test_all(msg, 3);
+	std::string buf;
+	minipb::container_output_stream<std::string> stream{buf};
+	minipb::msg_builder b{stream};
+	ASSERT_EQ(msg.encode(b), minipb::result::ok);
+	auto known = buf.size();
+	// Unknown and sparse fields
+	ASSERT_EQ(b.int32_field(99, 5), minipb::result::ok);
+	auto unknown = buf.size();
+	ASSERT_EQ(b.message_field(100000, test::table::table_empty{}), minipb::result::ok);
+
+	// The generic parser produces the same message as the generated switch, for every stream type
+	auto check = [&](test::table::table_all& res) {
+		ASSERT_EQ(res.a, msg.a);
+		ASSERT_EQ(res.h, INT64_MIN);
+		ASSERT_EQ(res.o, msg.o);
+		ASSERT_EQ(res.r_a, msg.r_a);
+		ASSERT_EQ(res.r_m, msg.r_m);
+		ASSERT_EQ(res.r_o, msg.r_o);
+		ASSERT_EQ(res.rp_c, msg.rp_c);
+		ASSERT_EQ(res.rp_h, msg.rp_h);
+		ASSERT_EQ(res.rp_m, msg.rp_m);
+		ASSERT_TRUE(res.q && res.q->q && res.q->q->q);
+		ASSERT_EQ(res.q->q->q->o, msg.o);
+		ASSERT_EQ(res.r_q.size(), 3);
+		ASSERT_EQ(res.r_q[2]->r_q.size(), 3);
+		ASSERT_TRUE(res.sparse);
+		std::string again;
+		minipb::container_output_stream<std::string> again_stream{again};
+		minipb::msg_builder again_builder{again_stream};
+		ASSERT_EQ(res.encode(again_builder), minipb::result::ok);
+		// Everything but the unknown field is encoded again
+		ASSERT_EQ(again, buf.substr(0, known) + buf.substr(unknown));
+	};
+	{
+		minipb::array_input_stream in{buf.data(), buf.size()};
+		minipb::basic_msg_parser<minipb::array_input_stream> p{in};
+		test::table::table_all res{};
+		ASSERT_EQ(res.decode(p), minipb::result::ok);
+		check(res);
+	}
+	{
+		single_byte_input_stream in{buf.data(), buf.size()};
+		minipb::msg_parser p{in};
+		test::table::table_all res{};
+		ASSERT_EQ(res.decode(p), minipb::result::ok);
+		check(res);
+	}
+
+	// Empty messages decode to defaults
+	minipb::array_input_stream empty{"", 0};
+	minipb::basic_msg_parser<minipb::array_input_stream> empty_parser{empty};
+	test::table::table_all empty_table{};
+	ASSERT_EQ(empty_table.decode(empty_parser), minipb::result::ok);
+	test::test_all empty_switch{};
+	ASSERT_EQ(empty_switch.decode(empty_parser), minipb::result::ok);
+
+	// Errors inside submessages are reported
+	auto bad = buf;
+	bad.resize(bad.size() - 1);
+	minipb::array_input_stream in{bad.data(), bad.size()};
+	minipb::basic_msg_parser<minipb::array_input_stream> p{in};
+	test::table::table_all res{};
+	ASSERT_NE(res.decode(p), minipb::result::ok);
+}
+
+// Limits the instruction set used for packed varints for the lifetime of the object
+struct scoped_simd_level {
+	explicit scoped_simd_level(minipb::simd_level level) { minipb::set_simd_level(level); }
+	~scoped_simd_level() { minipb::set_simd_level(minipb::supported_simd_level()); }
+	scoped_simd_level(const scoped_simd_level&) = delete;
+	scoped_simd_level& operator=(const scoped_simd_level&) = delete;
+};
+
+const minipb::simd_level all_simd_levels[] = {minipb::simd_level::scalar, minipb::simd_level::sse41, minipb::simd_level::avx2};
+
+void packed_varint_decode_test() {
+	// Long runs of single byte values (widened in bulk) mixed with multi byte and negative values
+	test::test_all msg{};
+	for (int i = 0; i < 10000; i++) {
+		msg.rp_c.push_back(i % 97 == 0 ? -i : i % 100);
+		msg.rp_f.push_back(i % 50 == 0 ? UINT64_MAX - i : static_cast<uint64_t>(i % 128));
+		msg.rp_h.push_back(i % 2 == 0 ? i % 60 : -(i % 60));
+		msg.rp_m.push_back(i % 3 == 0);
+	}
+	std::string buf;
+	minipb::container_output_stream<std::string> stream{buf};
+	minipb::msg_builder b{stream};
+	ASSERT_EQ(msg.encode(b), minipb::result::ok);
+
+	minipb::array_input_stream in{buf.data(), buf.size()};
+	minipb::basic_msg_parser<minipb::array_input_stream> p{in};
+	test::test_all res{};
+	ASSERT_EQ(res.decode(p), minipb::result::ok);
+	ASSERT_EQ(res.rp_c, msg.rp_c);
+	ASSERT_EQ(res.rp_f, msg.rp_f);
+	ASSERT_EQ(res.rp_h, msg.rp_h);
+	ASSERT_EQ(res.rp_m, msg.rp_m);
+
+	// Non contiguous streams take the element by element path
+	single_byte_input_stream slow{buf.data(), buf.size()};
+	minipb::msg_parser slow_parser{slow};
+	test::test_all slow_res{};
+	ASSERT_EQ(slow_res.decode(slow_parser), minipb::result::ok);
+	ASSERT_EQ(slow_res.rp_c, msg.rp_c);
+	ASSERT_EQ(slow_res.rp_h, msg.rp_h);
+
+	// The last varint of the block is truncated
+	const std::string truncated{"\xa2\x03\x02\x01\x80", 5};
+	minipb::array_input_stream bad{truncated.data(), truncated.size()};
+	minipb::basic_msg_parser<minipb::array_input_stream> bad_parser{bad};
+	test::test_all bad_res{};
+	ASSERT_EQ(bad_res.decode(bad_parser), minipb::result::invalid_input);
+	ASSERT_TRUE(bad_res.rp_c.empty());
+
+	// A full block of single byte values followed by a truncated varint
+	std::string block{"\xa2\x03\x21", 3};
+	block.append(32, '\x01');
+	block.push_back('\x80');
+	minipb::array_input_stream block_in{block.data(), block.size()};
+	minipb::basic_msg_parser<minipb::array_input_stream> block_parser{block_in};
+	test::test_all block_res{};
+	ASSERT_EQ(block_res.decode(block_parser), minipb::result::invalid_input);
+}
+
+TEST(MinipbTest, PackedVarint) {
+	// Levels not supported by the CPU fall back to the best supported one
+	for (auto level : all_simd_levels) {
+		scoped_simd_level scope{level};
+		SCOPED_TRACE(static_cast<int>(minipb::active_simd_level()));
+		ASSERT_LE(static_cast<int>(minipb::active_simd_level()), static_cast<int>(level));
+		ASSERT_NO_FATAL_FAILURE(packed_varint_decode_test());
+	}
+}
+
+TEST(MinipbTest, PackedFixed) {
+	test::test_all msg{};
+	for (int i = 0; i < 1000; i++) {
+		msg.rp_a.push_back(i * 0.5);
+		msg.rp_b.push_back(static_cast<float>(i) * -0.25f);
+		msg.rp_i.push_back(static_cast<uint32_t>(i) * 0x01010101u);
+		msg.rp_l.push_back(-static_cast<int64_t>(i) * 0x0101010101);
+	}
+	std::string buf;
+	minipb::container_output_stream<std::string> stream{buf};
+	minipb::msg_builder b{stream};
+	ASSERT_EQ(msg.encode(b), minipb::result::ok);
+	ASSERT_EQ(buf.size(), msg.byte_size());
+	minipb::reverse_msg_builder rb;
+	ASSERT_EQ(msg.encode_reverse(rb), minipb::result::ok);
+	ASSERT_EQ(std::string(reinterpret_cast<const char*>(rb.data()), rb.size()), buf);
+
+	// Containers without contiguous storage are encoded element by element with the same result
+	std::string list_buf;
+	minipb::container_output_stream<std::string> list_stream{list_buf};
+	minipb::msg_builder list_builder{list_stream};
+	std::list<float> list{msg.rp_b.begin(), msg.rp_b.end()};
+	ASSERT_EQ(list_builder.packed_fixed32_field(51, list), minipb::result::ok);
+	ASSERT_NE(buf.find(list_buf), std::string::npos);
+
+	minipb::array_input_stream in{buf.data(), buf.size()};
+	minipb::basic_msg_parser<minipb::array_input_stream> p{in};
+	test::test_all res{};
+	ASSERT_EQ(res.decode(p), minipb::result::ok);
+	ASSERT_EQ(res.rp_a, msg.rp_a);
+	ASSERT_EQ(res.rp_b, msg.rp_b);
+	ASSERT_EQ(res.rp_i, msg.rp_i);
+	ASSERT_EQ(res.rp_l, msg.rp_l);
+
+	// Block sizes need to be a multiple of the element size
+	const std::string bad_size{"\x9a\x03\x03\x00\x00\x00", 6};
+	minipb::array_input_stream bad{bad_size.data(), bad_size.size()};
+	minipb::basic_msg_parser<minipb::array_input_stream> bad_parser{bad};
+	test::test_all bad_res{};
+	ASSERT_EQ(bad_res.decode(bad_parser), minipb::result::invalid_input);
+}
+
+template <typename T> void packed_varint_encode_test(const std::vector<T>& values) {
+	// Bulk encoding of contiguous values matches encoding element by element (std::list) and the reverse builder
+	std::string bulk, single;
+	minipb::container_output_stream<std::string> bulk_stream{bulk}, single_stream{single};
+	minipb::msg_builder bulk_builder{bulk_stream}, single_builder{single_stream};
+	std::list<T> list{values.begin(), values.end()};
+	ASSERT_EQ(bulk_builder.packed_varint_field(1, values), minipb::result::ok);
+	ASSERT_EQ(bulk_builder.packed_varint_signed_field(2, values), minipb::result::ok);
+	ASSERT_EQ(single_builder.packed_varint_field(1, list), minipb::result::ok);
+	ASSERT_EQ(single_builder.packed_varint_signed_field(2, list), minipb::result::ok);
+	ASSERT_EQ(bulk, single);
+
+	minipb::reverse_msg_builder rb;
+	ASSERT_EQ(rb.packed_varint_signed_field(2, values), minipb::result::ok);
+	ASSERT_EQ(rb.packed_varint_field(1, values), minipb::result::ok);
+	ASSERT_EQ(std::string(reinterpret_cast<const char*>(rb.data()), rb.size()), bulk);
+}
+
+TEST(MinipbTest, PackedVarintEncode) {
+	std::vector<int32_t> i32;
+	std::vector<int64_t> i64;
+	std::vector<uint32_t> u32;
+	std::vector<uint64_t> u64;
+	for (int i = 0; i < 1003; i++) {
+		i32.push_back(i % 37 == 0 ? -i * 1000 : i % 60 - 30);
+		i64.push_back(i % 41 == 0 ? INT64_MIN + i : i % 60 - 30);
+		u32.push_back(i % 43 == 0 ? UINT32_MAX - i : i % 128);
+		u64.push_back(i % 47 == 0 ? UINT64_MAX - i : i % 64);
+	}
+	for (auto level : all_simd_levels) {
+		scoped_simd_level scope{level};
+		SCOPED_TRACE(static_cast<int>(minipb::active_simd_level()));
+		ASSERT_NO_FATAL_FAILURE(packed_varint_encode_test(i32));
+		ASSERT_NO_FATAL_FAILURE(packed_varint_encode_test(i64));
+		ASSERT_NO_FATAL_FAILURE(packed_varint_encode_test(u32));
+		ASSERT_NO_FATAL_FAILURE(packed_varint_encode_test(u64));
+	}
+}
+
+TEST(MinipbTest, SubsetInputStream) {
+	// Nested subsets refer to the root stream directly and stay consistent with each other
+	const std::string buf{"0123456789"};
+	minipb::array_input_stream root{buf.data(), buf.size()};
+	minipb::subset_input_stream outer{root, 8};
+	char c;
+	ASSERT_EQ(outer.read(&c, 1), minipb::result::ok);
+	auto inner = outer.subset(4);
+	ASSERT_EQ(inner.bytes_available(), 4);
+	ASSERT_EQ(inner.skip(3), minipb::result::ok);
+	ASSERT_EQ(inner.bytes_available(), 1);
+	ASSERT_EQ(outer.bytes_available(), 4);
+	ASSERT_EQ(inner.skip(2), minipb::result::out_of_space);
+	ASSERT_EQ(outer.subset(100).bytes_available(), 4);
+	ASSERT_EQ(inner.read(&c, 1), minipb::result::ok);
+	ASSERT_EQ(c, '4');
+	ASSERT_EQ(inner.bytes_available(), 0);
+	ASSERT_EQ(outer.bytes_available(), 3);
+
+	// Deeply nested messages through the virtual stream interface
+	test::my_message msg{};
+	auto cur = &msg;
+	for (int i = 0; i < 200; i++) {
+		cur->field1 = std::to_string(i);
+		cur->field2 = std::make_unique<test::my_message>();
+		cur = cur->field2.get();
+	}
+	cur->field3 = {1.0f, 2.0f};
+	std::string encoded;
+	minipb::container_output_stream<std::string> stream{encoded};
+	minipb::msg_builder b{stream};
+	ASSERT_EQ(msg.encode(b), minipb::result::ok);
+
+	single_byte_input_stream in{encoded.data(), encoded.size()};
+	minipb::msg_parser p{in};
+	test::my_message res{};
+	ASSERT_EQ(res.decode(p), minipb::result::ok);
+	cur = &res;
+	for (int i = 0; i < 200; i++) {
+		ASSERT_EQ(cur->field1, std::to_string(i));
+		ASSERT_TRUE(cur->field2);
+		cur = cur->field2.get();
+	}
+	ASSERT_EQ(cur->field3, std::vector<float>({1.0f, 2.0f}));
+
+	// Streams only knowing an upper bound of their size (like a socket) end every submessage at its length, given the total size
+	class unbounded_input_stream final : public minipb::input_stream {
+		minipb::array_input_stream m_array;
+
+	public:
+		unbounded_input_stream(const void* data, size_t len) : m_array{data, len} {}
+		minipb::result read(void* data, size_t data_size) noexcept override { return m_array.read(data, data_size); }
+		minipb::result skip(size_t data_size) noexcept override { return m_array.skip(data_size); }
+		size_t bytes_available() const noexcept override { return SIZE_MAX; }
+	};
+	std::string records;
+	{
+		minipb::container_output_stream<std::string> records_stream{records};
+		minipb::record_writer w{records_stream};
+		ASSERT_EQ(w.write(msg), minipb::result::ok);
+		ASSERT_EQ(w.write(msg), minipb::result::ok);
+	}
+	unbounded_input_stream unbounded{records.data(), records.size()};
+	minipb::subset_input_stream bounded{unbounded, records.size()};
+	minipb::record_reader r{bounded};
+	for (int i = 0; i < 2; i++) {
+		test::my_message record{};
+		ASSERT_EQ(r.read(record), minipb::result::ok);
+		ASSERT_EQ(record.field1, "0");
+		ASSERT_TRUE(record.field2 && record.field2->field2);
+		ASSERT_EQ(record.field2->field2->field1, "2");
+	}
+	ASSERT_TRUE(r.is_eof());
+}
+
+TEST(MinipbTest, MmapInputStream) {
+	test::my_message msg{};
+	msg.field1 = "mapped";
+	msg.field3 = {1.0f, 2.0f, 3.0f};
+	msg.field2 = std::make_unique<test::my_message>();
+	msg.field2->field1 = "nested";
+	std::string encoded;
+	minipb::container_output_stream<std::string> out{encoded};
+	minipb::msg_builder b{out};
+	ASSERT_EQ(msg.encode(b), minipb::result::ok);
+
+	char path[] = "/tmp/minipb-test-XXXXXX";
+	auto fd = mkstemp(path);
+	ASSERT_GE(fd, 0);
+	ASSERT_EQ(write(fd, encoded.data(), encoded.size()), static_cast<ssize_t>(encoded.size()));
+
+	minipb::mmap_input_stream in{path, minipb::mmap_input_stream::sequential | minipb::mmap_input_stream::willneed};
+	ASSERT_EQ(in.status(), minipb::result::ok);
+	ASSERT_EQ(in.size(), encoded.size());
+	ASSERT_NE(in.data(), nullptr);
+	minipb::msg_parser p{in};
+	test::my_message res{};
+	ASSERT_EQ(res.decode(p), minipb::result::ok);
+	ASSERT_EQ(res.field1, "mapped");
+	ASSERT_EQ(res.field3, msg.field3);
+	ASSERT_TRUE(res.field2);
+	ASSERT_EQ(res.field2->field1, "nested");
+	ASSERT_EQ(in.bytes_available(), 0);
+
+	// Devirtualized parsing of the same mapping, using the file descriptor
+	minipb::mmap_input_stream in_fd{fd, minipb::mmap_input_stream::none};
+	close(fd);
+	auto array = in_fd.array();
+	minipb::basic_msg_parser<minipb::array_input_stream> ap{array};
+	test::my_message res2{};
+	ASSERT_EQ(res2.decode(ap), minipb::result::ok);
+	ASSERT_EQ(res2.field1, "mapped");
+	ASSERT_EQ(in_fd.bytes_available(), encoded.size());
+
+	// Empty files are valid empty streams
+	ASSERT_EQ(truncate(path, 0), 0);
+	minipb::mmap_input_stream empty{path};
+	ASSERT_EQ(empty.status(), minipb::result::ok);
+	ASSERT_EQ(empty.bytes_available(), 0);
+	remove(path);
+
+	minipb::mmap_input_stream missing{path};
+	ASSERT_EQ(missing.status(), minipb::result::general_error);
+	ASSERT_EQ(missing.bytes_available(), 0);
+
+	// Pipes report a size of 0 but are not empty files
+	int fds[2];
+	ASSERT_EQ(pipe(fds), 0);
+	minipb::mmap_input_stream piped{fds[0]};
+	ASSERT_EQ(piped.status(), minipb::result::general_error);
+	close(fds[0]);
+	close(fds[1]);
+}
+
+TEST(MinipbTest, BufferedInputStream) {
+	test::my_message msg{};
+	msg.field1 = std::string(100, 'x');
+	msg.field3 = std::vector<float>(300, 1.5f);
+	msg.field2 = std::make_unique<test::my_message>();
+	msg.field2->field1 = "nested";
+	std::string encoded;
+	minipb::container_output_stream<std::string> out{encoded};
+	minipb::msg_builder b{out};
+	ASSERT_EQ(msg.encode(b), minipb::result::ok);
+
+	// Source handing out at most 7 bytes per call, counting the calls
+	struct chunked_source {
+		const std::string& data;
+		size_t pos;
+		size_t calls;
+		size_t operator()(void* buf, size_t size) {
+			calls++;
+			size = std::min<size_t>({size, 7, data.size() - pos});
+			memcpy(buf, data.data() + pos, size);
+			pos += size;
+			return size;
+		}
+	};
+	for (size_t buffer_size : {0, 16, 100, 64 * 1024}) {
+		chunked_source src{encoded, 0, 0};
+		minipb::buffered_input_stream in{src, encoded.size(), buffer_size};
+		ASSERT_EQ(in.status(), minipb::result::ok);
+		minipb::msg_parser p{in};
+		test::my_message res{};
+		ASSERT_EQ(res.decode(p), minipb::result::ok);
+		ASSERT_EQ(res.field1, msg.field1);
+		ASSERT_EQ(res.field3, msg.field3);
+		ASSERT_TRUE(res.field2);
+		ASSERT_EQ(res.field2->field1, "nested");
+		ASSERT_EQ(in.bytes_available(), 0);
+		ASSERT_EQ(src.pos, encoded.size());
+		// Every call to the source reads as much as possible
+		ASSERT_LE(src.calls, encoded.size() / 7 + 4);
+	}
+
+	// The whole message fits into the buffer, exposing it using data()
+	{
+		chunked_source src{encoded, 0, 0};
+		minipb::buffered_input_stream in{src, encoded.size()};
+		ASSERT_EQ(in.data(), nullptr);
+		ASSERT_EQ(in.prefetch(), minipb::result::ok);
+		ASSERT_NE(in.data(), nullptr);
+		ASSERT_EQ(memcmp(in.data(), encoded.data(), encoded.size()), 0);
+	}
+
+	// Source ending early
+	{
+		chunked_source src{encoded, 0, 0};
+		minipb::buffered_input_stream in{src, encoded.size() + 10, 16};
+		minipb::msg_parser p{in};
+		test::my_message res{};
+		ASSERT_NE(res.decode(p), minipb::result::ok);
+	}
+
+	// Pipe
+	int fds[2];
+	ASSERT_EQ(pipe(fds), 0);
+	ASSERT_EQ(write(fds[1], encoded.data(), encoded.size()), static_cast<ssize_t>(encoded.size()));
+	close(fds[1]);
+	minipb::fd_reader reader{fds[0]};
+	minipb::buffered_input_stream in{reader, encoded.size(), 64};
+	minipb::msg_parser p{in};
+	test::my_message res{};
+	ASSERT_EQ(res.decode(p), minipb::result::ok);
+	ASSERT_EQ(res.field3, msg.field3);
+	close(fds[0]);
+}
+
+TEST(MinipbTest, FdOutputStream) {
+	test::my_message msg{};
+	msg.field1 = std::string(300, 'x');
+	msg.field3 = std::vector<float>(50, 2.5f);
+	msg.field2 = std::make_unique<test::my_message>();
+	msg.field2->field1 = "nested";
+	std::string expected;
+	minipb::container_output_stream<std::string> ref{expected};
+	minipb::msg_builder rb{ref};
+	ASSERT_EQ(msg.encode(rb), minipb::result::ok);
+
+	auto read_file = [](int fd) {
+		std::string res(static_cast<size_t>(lseek(fd, 0, SEEK_END)), '\0');
+		EXPECT_EQ(pread(fd, &res[0], res.size(), 0), static_cast<ssize_t>(res.size()));
+		return res;
+	};
+	for (size_t buffer_size : {1, 16, 100, 64 * 1024}) {
+		FILE* file = tmpfile();
+		ASSERT_NE(file, nullptr);
+		minipb::fd_output_stream out{fileno(file), buffer_size};
+		ASSERT_EQ(out.status(), minipb::result::ok);
+		minipb::msg_builder b{out};
+		ASSERT_EQ(msg.encode(b), minipb::result::ok);
+		ASSERT_EQ(out.position(), expected.size());
+		ASSERT_EQ(out.flush(), minipb::result::ok);
+		ASSERT_EQ(read_file(fileno(file)), expected);
+		fclose(file);
+	}
+
+	// Patching flushed, buffered and partially flushed data
+	FILE* file = tmpfile();
+	ASSERT_NE(file, nullptr);
+	{
+		minipb::fd_output_stream out{fileno(file), 16};
+		std::string data(40, 'a');
+		ASSERT_EQ(out.write(data.data(), data.size()), minipb::result::ok);
+		ASSERT_EQ(out.write_at(0, "bb", 2), minipb::result::ok);
+		ASSERT_EQ(out.write(data.data(), 10), minipb::result::ok);
+		ASSERT_EQ(out.write_at(36, "dddddd", 6), minipb::result::ok);
+		ASSERT_EQ(out.write_at(48, "cc", 2), minipb::result::ok);
+		ASSERT_EQ(out.write_at(49, "ee", 2), minipb::result::invalid_position);
+	}
+	ASSERT_EQ(read_file(fileno(file)), "bb" + std::string(34, 'a') + "dddddd" + std::string(6, 'a') + "cc");
+	fclose(file);
+
+	// Flushed data of a pipe can not be patched
+	int fds[2];
+	ASSERT_EQ(pipe(fds), 0);
+	{
+		minipb::fd_output_stream out{fds[1], 4};
+		ASSERT_EQ(out.write("12345678", 8), minipb::result::ok);
+		ASSERT_EQ(out.write_at(0, "x", 1), minipb::result::invalid_position);
+	}
+	close(fds[1]);
+	char buf[16];
+	ASSERT_EQ(read(fds[0], buf, sizeof(buf)), 8);
+	close(fds[0]);
+
+	// A failed write keeps the position and is reported by every later call
+	auto readonly = open("/dev/null", O_RDONLY);
+	ASSERT_GE(readonly, 0);
+	{
+		minipb::fd_output_stream out{readonly, 8};
+		ASSERT_EQ(out.write("12345", 5), minipb::result::ok);
+		ASSERT_EQ(out.write("6789", 4), minipb::result::general_error);
+		ASSERT_EQ(out.position(), 5);
+		ASSERT_EQ(out.status(), minipb::result::general_error);
+		ASSERT_EQ(out.flush(), minipb::result::general_error);
+		ASSERT_EQ(out.write_at(0, "x", 1), minipb::result::general_error);
+		ASSERT_EQ(out.write(std::string(20, 'z').data(), 20), minipb::result::general_error);
+		ASSERT_EQ(out.position(), 5);
+	}
+
+	// So does a failed patch of flushed data
+	file = tmpfile();
+	ASSERT_NE(file, nullptr);
+	{
+		minipb::fd_output_stream out{fileno(file), 4};
+		ASSERT_EQ(out.write("12345678", 8), minipb::result::ok);
+		ASSERT_EQ(out.flush(), minipb::result::ok);
+		// pwrite() fails with EBADF once the descriptor refers to a read only file
+		ASSERT_EQ(dup2(readonly, fileno(file)), fileno(file));
+		ASSERT_EQ(out.write_at(0, "x", 1), minipb::result::general_error);
+		ASSERT_EQ(out.status(), minipb::result::general_error);
+		ASSERT_EQ(out.write("9", 1), minipb::result::general_error);
+	}
+	fclose(file);
+	close(readonly);
+}
+
+TEST(MinipbTest, SegmentedOutputStream) {
+	test::my_message msg{};
+	msg.field1 = std::string(300, 'x');
+	msg.field3 = std::vector<float>(50, 2.5f);
+	msg.field2 = std::make_unique<test::my_message>();
+	msg.field2->field1 = "nested";
+	std::string expected;
+	minipb::container_output_stream<std::string> ref{expected};
+	minipb::msg_builder rb{ref};
+	ASSERT_EQ(msg.encode(rb), minipb::result::ok);
+
+	minipb::block_pool pool{16};
+	{
+		minipb::segmented_output_stream out{pool};
+		minipb::msg_builder b{out};
+		ASSERT_EQ(msg.encode(b), minipb::result::ok);
+		ASSERT_EQ(out.bytes_used(), expected.size());
+		std::string flat;
+		ASSERT_EQ(out.flatten(flat), minipb::result::ok);
+		ASSERT_EQ(flat, expected);
+		size_t segments = 0, total = 0;
+		out.for_each_segment([&](const unsigned char*, size_t size) {
+			segments++;
+			total += size;
+		});
+		ASSERT_EQ(segments, (expected.size() + 15) / 16);
+		ASSERT_EQ(total, expected.size());
+
+		// Patching across block boundaries
+		ASSERT_EQ(out.write_at(14, "abcd", 4), minipb::result::ok);
+		ASSERT_EQ(out.write_at(out.bytes_used() - 3, "xyz", 3), minipb::result::ok);
+		ASSERT_EQ(out.write_at(out.bytes_used() - 1, "xy", 2), minipb::result::invalid_position);
+		std::vector<uint8_t> vec;
+		ASSERT_EQ(out.flatten(vec), minipb::result::ok);
+		auto patched = expected;
+		patched.replace(14, 4, "abcd");
+		patched.replace(patched.size() - 3, 3, "xyz");
+		ASSERT_EQ(std::string(vec.begin(), vec.end()), patched);
+
+		FILE* file = tmpfile();
+		ASSERT_NE(file, nullptr);
+		ASSERT_EQ(minipb::write_segments(fileno(file), out), minipb::result::ok);
+		std::string written(patched.size(), '\0');
+		ASSERT_EQ(pread(fileno(file), &written[0], written.size(), 0), static_cast<ssize_t>(written.size()));
+		ASSERT_EQ(written, patched);
+		fclose(file);
+	}
+
+	// Blocks get reused by the next stream
+	auto blocks = pool.free_blocks();
+	ASSERT_EQ(blocks, (expected.size() + 15) / 16);
+	minipb::segmented_output_stream out{pool};
+	minipb::msg_builder b{out};
+	ASSERT_EQ(msg.encode(b), minipb::result::ok);
+	ASSERT_EQ(pool.free_blocks(), 0);
+	out.reset();
+	ASSERT_EQ(pool.free_blocks(), blocks);
+	ASSERT_EQ(out.bytes_used(), 0);
+	std::string empty{"x"};
+	ASSERT_EQ(out.flatten(empty), minipb::result::ok);
+	ASSERT_TRUE(empty.empty());
+}
+
+TEST(MinipbTest, GatherOutputStream) {
+	test::my_message msg{};
+	msg.field1 = std::string(4096, 'x');
+	msg.field3 = {1.0f, 2.0f};
+	msg.field2 = std::make_unique<test::my_message>();
+	msg.field2->field1 = "small";
+	std::string expected;
+	minipb::container_output_stream<std::string> ref{expected};
+	minipb::msg_builder rb{ref};
+	ASSERT_EQ(msg.encode(rb), minipb::result::ok);
+
+	minipb::gather_output_stream out{1024};
+	minipb::msg_builder b{out};
+	ASSERT_EQ(msg.encode(b), minipb::result::ok);
+	ASSERT_EQ(out.bytes_used(), expected.size());
+	// Only the envelope gets copied, the large field is referenced
+	ASSERT_LT(out.bytes_copied(), 64);
+	ASSERT_EQ(out.segment_count(), 3);
+	bool referenced = false;
+	out.for_each_segment([&](const unsigned char* data, size_t size) {
+		if (reinterpret_cast<const char*>(data) == msg.field1.data() && size == msg.field1.size()) referenced = true;
+	});
+	ASSERT_TRUE(referenced);
+	std::string flat(out.bytes_used(), '\0');
+	out.copy_to(&flat[0]);
+	ASSERT_EQ(flat, expected);
+
+	// Copied data can be patched, referenced data can not
+	ASSERT_EQ(out.write_at(0, "\x0b", 1), minipb::result::ok);
+	ASSERT_EQ(out.write_at(10, "x", 1), minipb::result::invalid_position);
+	ASSERT_EQ(out.write_at(out.bytes_used() - 2, "ab", 2), minipb::result::ok);
+
+	FILE* file = tmpfile();
+	ASSERT_NE(file, nullptr);
+	ASSERT_EQ(minipb::write_segments(fileno(file), out), minipb::result::ok);
+	std::string written(expected.size(), '\0');
+	ASSERT_EQ(pread(fileno(file), &written[0], written.size(), 0), static_cast<ssize_t>(written.size()));
+	expected[0] = '\x0b';
+	expected.replace(expected.size() - 2, 2, "ab");
+	ASSERT_EQ(written, expected);
+	fclose(file);
+
+	out.reset();
+	ASSERT_EQ(out.bytes_used(), 0);
+	ASSERT_EQ(out.segment_count(), 0);
+}
+
+// Output stream that can not seek, like a pipe or socket
+class forward_only_output_stream final : public minipb::output_stream {
+	std::string& m_data;
+
+public:
+	forward_only_output_stream(std::string& data) : m_data{data} {}
+	size_t position() const noexcept override { return m_data.size(); }
+	minipb::result write(const void* data, size_t data_size) noexcept override {
+		m_data.append(static_cast<const char*>(data), data_size);
+		return minipb::result::ok;
+	}
+	minipb::result write_at(size_t, const void*, size_t) noexcept override { return minipb::result::invalid_position; }
+};
+
+TEST(MinipbTest, GroupEncoding) {
+	test::my_message msg{};
+	auto cur = &msg;
+	for (int i = 0; i < 5; i++) {
+		cur->field1 = std::to_string(i);
+		cur->field3 = {1.0f, static_cast<float>(i)};
+		cur->field2 = std::make_unique<test::my_message>();
+		cur = cur->field2.get();
+	}
+	std::string encoded;
+	forward_only_output_stream out{encoded};
+	minipb::msg_builder b{out, minipb::message_encoding::group};
+	ASSERT_EQ(msg.encode(b), minipb::result::ok);
+	// field2 of the outermost message: start tag (2 << 3 | 3) right after field1 and field3
+	ASSERT_NE(encoded.find('\x13'), std::string::npos);
+
+	auto check = [&](const test::my_message& res) {
+		auto c = &res;
+		for (int i = 0; i < 5; i++) {
+			ASSERT_EQ(c->field1, std::to_string(i));
+			ASSERT_EQ(c->field3, std::vector<float>({1.0f, static_cast<float>(i)}));
+			ASSERT_TRUE(c->field2);
+			c = c->field2.get();
+		}
+		ASSERT_FALSE(c->field2);
+	};
+	{
+		single_byte_input_stream in{encoded.data(), encoded.size()};
+		minipb::msg_parser p{in};
+		test::my_message res{};
+		ASSERT_EQ(res.decode(p), minipb::result::ok);
+		check(res);
+	}
+	{
+		minipb::array_input_stream in{encoded.data(), encoded.size()};
+		minipb::basic_msg_parser<minipb::array_input_stream> p{in};
+		test::my_message res{};
+		ASSERT_EQ(res.decode(p), minipb::result::ok);
+		check(res);
+	}
+
+	// Unknown groups (including nested ones) get skipped
+	const uint8_t unknown[] = {(7 << 3) | 3, (1 << 3) | 0, 5, (8 << 3) | 3, (8 << 3) | 4, (7 << 3) | 4, (2 << 3) | 0, 9};
+	{
+		minipb::array_input_stream in{unknown};
+		minipb::msg_parser p{in};
+		test::message_a res{};
+		ASSERT_EQ(res.decode(p), minipb::result::ok);
+		ASSERT_EQ(res.field2, 9);
+	}
+
+	// Malformed input
+	auto decode = [](const std::string& data) {
+		minipb::array_input_stream in{data.data(), data.size()};
+		minipb::msg_parser p{in};
+		test::my_message res{};
+		return res.decode(p);
+	};
+	// Stray end tag
+	ASSERT_EQ(decode(std::string{"\x14"}), minipb::result::invalid_input);
+	// End tag of a different field
+	ASSERT_EQ(decode(std::string{"\x13\x1c"}), minipb::result::invalid_input);
+	// Missing end tag
+	ASSERT_NE(decode(encoded.substr(0, encoded.size() - 1)), minipb::result::ok);
+	ASSERT_NE(decode(std::string{"\x3b\x08\x01"}), minipb::result::ok);
+}
+
+TEST(MinipbTest, Records) {
+	std::vector<test::message_b> msgs(100);
+	for (size_t i = 0; i < msgs.size(); i++) {
+		msgs[i].field1 = std::string(i, 'x');
+		msgs[i].field2 = std::make_unique<test::message_a>();
+		msgs[i].field2->field1 = {static_cast<int32_t>(i), 2, 3};
+		msgs[i].field3 = static_cast<float>(i);
+	}
+	std::string encoded;
+	minipb::container_output_stream<std::string> out{encoded};
+	{
+		minipb::record_writer w{out, 1024};
+		for (auto& m : msgs)
+			ASSERT_EQ(w.write(m), minipb::result::ok);
+		ASSERT_EQ(w.records(), msgs.size());
+		// Full batches have been written already
+		ASSERT_GT(encoded.size(), 0);
+		ASSERT_EQ(w.flush(), minipb::result::ok);
+	}
+	// Same framing as length delimited fields
+	std::string expected;
+	for (auto& m : msgs) {
+		std::string record;
+		minipb::container_output_stream<std::string> rs{record};
+		minipb::msg_builder rb{rs};
+		ASSERT_EQ(m.encode(rb), minipb::result::ok);
+		uint8_t len[10];
+		expected.append(reinterpret_cast<char*>(len), minipb::encoder::varint_build(record.size(), len));
+		expected += record;
+	}
+	ASSERT_EQ(encoded, expected);
+
+	// Records of a failed write stay batched
+	uint8_t small[8];
+	minipb::array_output_stream small_stream{small, sizeof(small)};
+	{
+		minipb::record_writer w{small_stream, 0};
+		ASSERT_EQ(w.write(msgs[10]), minipb::result::out_of_space);
+		ASSERT_EQ(w.records(), 1);
+		ASSERT_EQ(w.flush(), minipb::result::out_of_space);
+	}
+
+	auto check = [&](minipb::basic_record_reader<minipb::array_input_stream>& r, size_t i) {
+		test::message_b res{};
+		ASSERT_EQ(r.read(res), minipb::result::ok);
+		ASSERT_EQ(res.field1, msgs[i].field1);
+		ASSERT_TRUE(res.field2);
+		ASSERT_EQ(res.field2->field1, msgs[i].field2->field1);
+		ASSERT_EQ(res.field3, msgs[i].field3);
+	};
+	minipb::array_input_stream in{encoded.data(), encoded.size()};
+	minipb::basic_record_reader<minipb::array_input_stream> r{in};
+	for (size_t i = 0; i < 50; i++)
+		check(r, i);
+	// Raw records reference the input
+	minipb::string_view view;
+	ASSERT_EQ(r.read(view), minipb::result::ok);
+	ASSERT_GE(view.data(), encoded.data());
+	ASSERT_LT(view.data(), encoded.data() + encoded.size());
+	std::string copy;
+	ASSERT_EQ(r.read(copy), minipb::result::ok);
+	ASSERT_EQ(r.skip(), minipb::result::ok);
+	for (size_t i = 53; i < msgs.size(); i++)
+		check(r, i);
+	ASSERT_TRUE(r.is_eof());
+	ASSERT_EQ(r.records(), msgs.size());
+
+	// Any input stream works, views need contiguous input
+	single_byte_input_stream slow{encoded.data(), encoded.size()};
+	minipb::record_reader sr{slow};
+	test::message_b res{};
+	ASSERT_EQ(sr.read(res), minipb::result::ok);
+	ASSERT_EQ(sr.read(copy), minipb::result::ok);
+	auto second = 1 + static_cast<size_t>(expected[0]);
+	ASSERT_EQ(copy, expected.substr(second + 1, static_cast<size_t>(expected[second])));
+	ASSERT_EQ(sr.read(view), minipb::result::general_error);
+	// The failed view left the stream at the start of the record
+	auto third = second + 1 + static_cast<size_t>(expected[second]);
+	ASSERT_EQ(sr.read(copy), minipb::result::ok);
+	ASSERT_EQ(copy, expected.substr(third + 1, static_cast<size_t>(expected[third])));
+	ASSERT_EQ(sr.records(), 3);
+
+	// Buffered input provides data() only once the rest of the input is buffered
+	size_t source_pos = 0;
+	auto source = [&](void* data, size_t len) {
+		len = std::min(len, encoded.size() - source_pos);
+		memcpy(data, encoded.data() + source_pos, len);
+		source_pos += len;
+		return len;
+	};
+	minipb::buffered_input_stream buffered{source, encoded.size(), 64};
+	minipb::record_reader br{buffered};
+	ASSERT_EQ(br.read(view), minipb::result::general_error);
+	ASSERT_EQ(br.read(copy), minipb::result::ok);
+	ASSERT_EQ(copy, expected.substr(1, static_cast<size_t>(expected[0])));
+
+	// Truncated record
+	minipb::array_input_stream trunc{encoded.data(), encoded.size() - 1};
+	minipb::basic_record_reader<minipb::array_input_stream> tr{trunc};
+	size_t count = 0;
+	while (!tr.is_eof() && tr.skip() == minipb::result::ok)
+		count++;
+	ASSERT_EQ(count, msgs.size() - 1);
+}
+
+TEST(MinipbTest, RecordFile) {
+	std::vector<test::message_b> msgs(1000);
+	for (size_t i = 0; i < msgs.size(); i++) {
+		msgs[i].field1 = std::string(i % 50, 'x');
+		msgs[i].field3 = static_cast<float>(i);
+	}
+	// One record larger than a block
+	msgs[500].field1 = std::string(5000, 'y');
+	std::string file;
+	minipb::container_output_stream<std::string> out{file};
+	minipb::record_file_writer w{out, 1024};
+	for (auto& m : msgs)
+		ASSERT_EQ(w.write(m), minipb::result::ok);
+	ASSERT_EQ(w.finish(), minipb::result::ok);
+
+	minipb::record_file_reader r{file.data(), file.size()};
+	ASSERT_EQ(r.status(), minipb::result::ok);
+	ASSERT_EQ(r.record_count(), msgs.size());
+	ASSERT_GT(r.block_count(), 10);
+
+	// Every block can be read on its own, records stay in order across blocks
+	size_t index = 0;
+	for (size_t b = 0; b < r.block_count(); b++) {
+		auto block = r.block(b);
+		ASSERT_LE(block.bytes_available(), 5100);
+		minipb::basic_record_reader<minipb::array_input_stream> rr{block};
+		while (!rr.is_eof()) {
+			test::message_b res{};
+			ASSERT_EQ(rr.read(res), minipb::result::ok);
+			ASSERT_EQ(res.field1, msgs[index].field1);
+			ASSERT_EQ(res.field3, msgs[index].field3);
+			index++;
+		}
+		ASSERT_EQ(rr.records(), r.block_records(b));
+	}
+	ASSERT_EQ(index, msgs.size());
+
+	// Splitting covers every block exactly once
+	for (size_t parts : {1, 3, 7, 1000}) {
+		size_t next = 0;
+		uint64_t records = 0;
+		for (size_t p = 0; p < parts; p++) {
+			auto range = r.split(p, parts);
+			ASSERT_EQ(range.first, next);
+			ASSERT_GE(range.last, range.first);
+			for (auto b = range.first; b < range.last; b++)
+				records += r.block_records(b);
+			next = range.last;
+		}
+		ASSERT_EQ(next, r.block_count());
+		ASSERT_EQ(records, msgs.size());
+	}
+	auto half = r.split(0, 2);
+	ASSERT_GT(half.last, r.block_count() / 4);
+	ASSERT_LT(half.last, r.block_count() * 3 / 4);
+
+	// Empty files are valid
+	std::string empty;
+	minipb::container_output_stream<std::string> empty_out{empty};
+	ASSERT_EQ(minipb::record_file_writer{empty_out}.finish(), minipb::result::ok);
+	minipb::record_file_reader er{empty.data(), empty.size()};
+	ASSERT_EQ(er.status(), minipb::result::ok);
+	ASSERT_EQ(er.block_count(), 0);
+	ASSERT_EQ(er.record_count(), 0);
+
+	// Corrupted files are rejected
+	ASSERT_EQ(minipb::record_file_reader(file.data(), file.size() - 1).status(), minipb::result::invalid_input);
+	auto corrupt = file;
+	corrupt[minipb::record_file::header_size] ^= 1;
+	ASSERT_EQ(minipb::record_file_reader(corrupt.data(), corrupt.size()).status(), minipb::result::invalid_input);
+	// A corrupted last block leaves nothing behind of the blocks validated before it
+	corrupt = file;
+	auto last = reinterpret_cast<const char*>(r.block(r.block_count() - 1).data()) - file.data();
+	corrupt[static_cast<size_t>(last) - minipb::record_file::block_header_size + 4] ^= 1;
+	minipb::record_file_reader cr{corrupt.data(), corrupt.size()};
+	ASSERT_EQ(cr.status(), minipb::result::invalid_input);
+	ASSERT_EQ(cr.block_count(), 0);
+	ASSERT_EQ(cr.record_count(), 0);
+}
+
+TEST(MinipbTest, ParallelDecode) {
+	std::vector<test::message_b> msgs(2000);
+	for (size_t i = 0; i < msgs.size(); i++) {
+		msgs[i].field1 = std::string(i % 50, 'x');
+		msgs[i].field3 = static_cast<float>(i);
+	}
+	std::string file, stream;
+	minipb::container_output_stream<std::string> file_out{file}, stream_out{stream};
+	minipb::record_file_writer fw{file_out, 1024};
+	{
+		minipb::record_writer sw{stream_out};
+		for (auto& m : msgs) {
+			ASSERT_EQ(fw.write(m), minipb::result::ok);
+			ASSERT_EQ(sw.write(m), minipb::result::ok);
+		}
+	}
+	ASSERT_EQ(fw.finish(), minipb::result::ok);
+	minipb::record_file_reader reader{file.data(), file.size()};
+
+	for (size_t threads : {1, 4}) {
+		minipb::thread_pool pool{threads};
+		ASSERT_EQ(pool.size(), threads);
+
+		// Ordered delivery happens on the calling thread
+		std::vector<float> seen;
+		auto collect = [&](test::message_b& m) { seen.push_back(m.field3); };
+		minipb::parallel_decoder<test::message_b> ordered{pool};
+		ASSERT_EQ(ordered.decode(reader, collect), minipb::result::ok);
+		ASSERT_EQ(seen.size(), msgs.size());
+		for (size_t i = 0; i < msgs.size(); i++)
+			ASSERT_EQ(seen[i], msgs[i].field3);
+		seen.clear();
+		ASSERT_EQ(ordered.decode(stream.data(), stream.size(), collect, 1000), minipb::result::ok);
+		ASSERT_EQ(seen.size(), msgs.size());
+		for (size_t i = 0; i < msgs.size(); i++)
+			ASSERT_EQ(seen[i], msgs[i].field3);
+
+		// Unordered delivery calls the callback concurrently
+		std::mutex mutex;
+		seen.clear();
+		auto collect_locked = [&](test::message_b& m) {
+			std::lock_guard<std::mutex> lock{mutex};
+			seen.push_back(m.field3);
+		};
+		minipb::parallel_decoder<test::message_b> unordered{pool, false};
+		ASSERT_EQ(unordered.decode(reader, collect_locked), minipb::result::ok);
+		ASSERT_EQ(unordered.decode(stream.data(), stream.size(), collect_locked, 1000), minipb::result::ok);
+		ASSERT_EQ(seen.size(), 2 * msgs.size());
+		std::sort(seen.begin(), seen.end());
+		for (size_t i = 0; i < seen.size(); i++)
+			ASSERT_EQ(seen[i], msgs[i / 2].field3);
+
+		// Records before an error are still delivered in order
+		// The first tag of the middle record gets the invalid wire type 7
+		auto corrupt = stream;
+		size_t offset = 0;
+		for (size_t i = 0; i < msgs.size() / 2; i++)
+			offset += minipb::encoder::varint_size(msgs[i].byte_size()) + msgs[i].byte_size();
+		corrupt[offset + minipb::encoder::varint_size(msgs[msgs.size() / 2].byte_size())] = '\xff';
+		seen.clear();
+		ASSERT_NE(ordered.decode(corrupt.data(), corrupt.size(), collect, 1000), minipb::result::ok);
+		ASSERT_EQ(seen.size(), msgs.size() / 2);
+		for (size_t i = 0; i < seen.size(); i++)
+			ASSERT_EQ(seen[i], msgs[i].field3);
+		ASSERT_NE(unordered.decode(corrupt.data(), corrupt.size(), collect_locked, 1000), minipb::result::ok);
+		// The middle record is cut off after its length, so splitting the input into chunks fails
+		auto truncated = stream.substr(0, offset + 1);
+		seen.clear();
+		ASSERT_NE(ordered.decode(truncated.data(), truncated.size(), collect, 1000), minipb::result::ok);
+		ASSERT_EQ(seen.size(), msgs.size() / 2);
+		for (size_t i = 0; i < seen.size(); i++)
+			ASSERT_EQ(seen[i], msgs[i].field3);
+
+		// Exceptions of an ordered callback reach the caller after the running chunks finished
+		seen.clear();
+		auto throwing = [&](test::message_b& m) {
+			if (seen.size() == 100) throw std::runtime_error{"stop"};
+			seen.push_back(m.field3);
+		};
+		ASSERT_THROW(ordered.decode(stream.data(), stream.size(), throwing, 1000), std::runtime_error);
+		ASSERT_EQ(seen.size(), 100);
+		seen.clear();
+		ASSERT_EQ(ordered.decode(reader, collect), minipb::result::ok);
+		ASSERT_EQ(seen.size(), msgs.size());
+
+		// Plain tasks
+		std::atomic<size_t> count{0};
+		for (size_t i = 0; i < 100; i++)
+			pool.submit([&count] { count++; });
+		pool.wait();
+		ASSERT_EQ(count, 100);
+	}
+}